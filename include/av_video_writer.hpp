@@ -0,0 +1,83 @@
+#ifndef AV_VIDEO_WRITER_HPP
+#define AV_VIDEO_WRITER_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include "frame_index.hpp"
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVStream;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+// Per-stream video encoder: "opencv" (cv::VideoWriter) or a libavcodec encoder name such as "ffv1"
+struct VideoEncoderConfig {
+    std::string encoder = "opencv";
+    int threads = 0;    // 0: let libavcodec decide
+    std::string preset; // encoder private options, e.g. "veryfast" for libx264; empty keeps the default
+    std::string tune;
+    int crf = -1;       // -1: encoder default
+    int gop = 0;        // keyframe interval in frames, 0: encoder default
+    std::string pixelFormat; // libav name the encoder gets, e.g. "yuv420p"; empty: the input or its closest fit
+};
+
+// Layout of the frames handed to AvVideoWriter::write()
+enum class VideoPixelFormat {
+    GRAY8,
+    GRAY16,     // little endian, e.g. raw depth
+    BGR24,
+    YUYV422,    // packed, as most UVC color profiles deliver it
+    UYVY422,
+    NV12,       // luma plane followed by the interleaved chroma plane, same stride
+};
+
+std::string videoPixelFormatName(VideoPixelFormat format);
+
+// Encodes frames with libavcodec and muxes them with libavformat.
+// PTS come from the capture timestamps (ms), so the file keeps the real frame timing.
+// Frames the encoder cannot take as they are go through libswscale straight into its own format.
+class AvVideoWriter {
+    public:
+        AvVideoWriter() = default;
+        ~AvVideoWriter();
+        // encoderPixelFormat: libav name to encode in, empty picks the input format or the
+        // closest one the encoder takes (yuv420p for lossy encoders that list it)
+        bool open(const std::string& fileName, const std::string& codecName, int width, int height,
+                  VideoPixelFormat pixelFormat, float fps, int threads,
+                  const std::map<std::string, std::string>& codecOptions = {},
+                  const std::string& encoderPixelFormat = "");
+        bool isOpened() const;
+        bool write(const uint8_t *data, int stride, uint64_t timeStamp);
+        // A frame in another layout than the one given to open() (e.g. decoded pre-roll)
+        bool write(const uint8_t *data, int stride, VideoPixelFormat format, uint64_t timeStamp);
+        void release();
+        std::string getError() const;
+        // Format the encoder actually receives, kept after release() for metadata
+        std::string getEncoderPixelFormat() const;
+        // Report each packet's file position to the frame added last to frameIndex before write()
+        void setFrameIndex(FrameIndexWriter *frameIndex);
+    private:
+        bool encode(AVFrame *frame);
+        bool fail(const std::string& what, int err);
+
+        AVFormatContext *formatContext = nullptr;
+        AVCodecContext *codecContext = nullptr;
+        AVStream *stream = nullptr;
+        AVFrame *frame = nullptr;
+        AVPacket *packet = nullptr;
+        SwsContext *swsContext = nullptr;
+        VideoPixelFormat inputFormat = VideoPixelFormat::GRAY8;
+        std::string encoderPixelFormat;
+        bool hasFirstTimeStamp = false;
+        uint64_t firstTimeStamp = 0;
+        int64_t lastPts = -1;
+        std::string errorMsg;
+        FrameIndexWriter *frameIndex = nullptr;
+        std::map<int64_t, uint32_t> ptsFrames;  // frames in the encoder, by pts
+
+};
+
+#endif
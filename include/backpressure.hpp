@@ -0,0 +1,99 @@
+#ifndef BACKPRESSURE_HPP
+#define BACKPRESSURE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// What a stream gives up under load. Bits, so a stream can hold several at once.
+enum DegradeStep : uint32_t {
+    DEGRADE_SKIP_IMAGES = 1,   // no image files, video and timecodes carry on
+    DEGRADE_JPEG_QUALITY = 2,  // JPEG images at the reduced quality
+    DEGRADE_DECIMATE = 4,      // keep one frame in every `decimation`
+};
+
+// Returns false for a name that is not a step
+inline bool parseDegradeStep(const std::string& name, DegradeStep& step) {
+    if (name == "skipImages") {
+        step = DEGRADE_SKIP_IMAGES;
+    } else if (name == "jpegQuality") {
+        step = DEGRADE_JPEG_QUALITY;
+    } else if (name == "decimate") {
+        step = DEGRADE_DECIMATE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline std::string degradeStepName(DegradeStep step) {
+    switch (step) {
+        case DEGRADE_JPEG_QUALITY:
+            return "jpegQuality";
+        case DEGRADE_DECIMATE:
+            return "decimate";
+        default:
+            return "skipImages";
+    }
+}
+
+struct BackpressureConfig {
+    bool isEnable = false;
+    // taken one by one as overload persists, undone in reverse as it clears
+    std::vector<DegradeStep> ladder = {DEGRADE_SKIP_IMAGES, DEGRADE_JPEG_QUALITY, DEGRADE_DECIMATE};
+    // steps each stream takes part in, by stream name; streams not listed never degrade
+    std::map<std::string, std::vector<DegradeStep>> streams;
+    float queueHigh = 0.75f;     // writer queue fill (0-1) that counts as overload
+    float queueLow = 0.25f;      // and as calm
+    float latencyHighMs = 250;   // hand-off to written, smoothed
+    float latencyLowMs = 80;
+    int escalateMs = 500;        // overloaded this long before each step
+    int recoverMs = 3000;        // calm this long before a step is undone
+    int jpegQuality = 60;
+    int decimation = 3;
+};
+
+// One degradation level for the whole recorder: disk and CPU are shared, so overload
+// on any stream moves every stream down its own part of the ladder. Workers report
+// after each frame and read their steps without locking.
+class BackpressureController {
+    public:
+        explicit BackpressureController(const BackpressureConfig& config);
+        // Returns the id for report(); call before the stream gets frames
+        int registerStream(const std::string& name);
+        // Steps the stream takes part in (DegradeStep bits)
+        uint32_t getStreamSteps(const std::string& name) const;
+        // Steps in force now among the given ones
+        uint32_t getActiveSteps(uint32_t streamSteps) const;
+        // Stream worker, once per frame: its queue fill (0-1) and the frame's latency
+        void report(int stream, float queueFill, int64_t latencyNs);
+        const BackpressureConfig& getConfig() const;
+        // Config, time at each level and every transition
+        nlohmann::json getMetadata();
+    private:
+        struct Load {
+            std::string name;
+            float queueFill = 0;
+            double latencyMs = 0;  // moving average
+        };
+
+        void changeLevel(int level, int64_t nowNs, const Load& worst);
+
+        BackpressureConfig config;
+        std::atomic<int> level{0};
+        std::mutex mutex;
+        std::vector<Load> loads;
+        int64_t startNs;
+        int64_t overSinceNs = 0;
+        int64_t calmSinceNs = 0;
+        int64_t levelSinceNs;
+        int maxLevel = 0;
+        std::vector<int64_t> levelNs;  // time spent at each level
+        std::vector<nlohmann::json> transitions;
+};
+
+#endif
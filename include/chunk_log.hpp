@@ -0,0 +1,197 @@
+#ifndef CHUNK_LOG_HPP
+#define CHUNK_LOG_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "file_writer.hpp"
+
+// Single-file recording (<record>/record.rrlog), append only:
+//   ChunkLogFileHeader
+//   blocks: ChunkLogBlockHeader + body
+//     CHANNEL: JSON {id, name, encoding, info}
+//     CHUNK:   ChunkLogChunkHeader + compressed records (ChunkLogRecordHeader + payload each)
+//     INDEX:   one ChunkLogIndexEntry per chunk
+//     SUMMARY: JSON (channels with counts and their last metadata, chunk totals)
+//   ChunkLogTrailer
+// A reader seeks to the trailer and reads index and summary in one go; a file cut short
+// (no trailer) can still be read by walking the blocks from the start.
+enum class ChunkCompression {
+    NONE = 0,
+    ZSTD = 1,
+    LZ4 = 2,
+};
+
+ChunkCompression parseChunkCompression(const std::string& name);
+std::string chunkCompressionName(ChunkCompression compression);
+
+enum ChunkLogBlockTag : uint32_t {
+    CHUNK_LOG_CHANNEL = 1,
+    CHUNK_LOG_CHUNK = 2,
+    CHUNK_LOG_INDEX = 3,
+    CHUNK_LOG_SUMMARY = 4,
+};
+
+struct ChunkLogFileHeader {
+    char magic[6] = {'R', 'R', 'L', 'O', 'G', '\0'};
+    uint16_t version = 1;
+};
+
+struct ChunkLogBlockHeader {
+    uint32_t tag;
+    uint32_t reserved = 0;
+    uint64_t length;  // body bytes
+};
+
+struct ChunkLogChunkHeader {
+    uint64_t startUs;
+    uint64_t endUs;
+    uint64_t rawSize;  // records before compression
+    uint32_t compression;
+    uint32_t recordCount;
+};
+
+struct ChunkLogRecordHeader {
+    uint16_t channel;
+    uint16_t reserved;
+    uint32_t size;  // payload bytes
+    uint64_t timeStampUs;
+};
+
+struct ChunkLogIndexEntry {
+    uint64_t offset;  // of the chunk's block header
+    uint64_t length;  // block header and body
+    uint64_t startUs;
+    uint64_t endUs;
+    uint32_t recordCount;
+    uint32_t compression;
+};
+
+struct ChunkLogTrailer {
+    uint64_t indexOffset;    // block header of the index; the summary block follows it
+    uint64_t trailerOffset;  // where this trailer starts
+    char magic[8] = {'R', 'R', 'L', 'O', 'G', 'E', 'N', 'D'};
+};
+static_assert(sizeof(ChunkLogFileHeader) == 8 && sizeof(ChunkLogBlockHeader) == 16 && sizeof(ChunkLogChunkHeader) == 32 &&
+              sizeof(ChunkLogRecordHeader) == 16 && sizeof(ChunkLogIndexEntry) == 40 && sizeof(ChunkLogTrailer) == 24,
+              "chunk log layout changed");
+
+// Payload of a "rover.frame" record, followed by dataSize bytes of pixels in format
+struct ChunkLogFrameHeader {
+    uint32_t frameType;
+    uint32_t format;  // OBFormat
+    uint32_t width;
+    uint32_t height;
+    float valueScale;
+    uint32_t dataSize;
+};
+static_assert(sizeof(ChunkLogFrameHeader) == 24, "chunk log frame layout changed");
+
+// Payloads: "rover.frame" (ChunkLogFrameHeader + pixels), "rover.imu" (one ImuSample), "json"
+class ChunkLogWriter {
+    public:
+        ChunkLogWriter() = default;
+        ~ChunkLogWriter();
+        // chunkBytes: records are gathered up to this size before one compressed write
+        bool open(const std::string& path, ChunkCompression compression, size_t chunkBytes,
+                  const FileWriterConfig& fileWriterConfig = FileWriterConfig());
+        bool isOpened();
+        // Returns the channel id for write(); info is kept in the file with the channel
+        uint16_t addChannel(const std::string& name, const std::string& encoding, const nlohmann::json& info);
+        // Thread safe. head and data are stored back to back as one record payload.
+        void write(uint16_t channel, uint64_t timeStampUs, const void *data, size_t size);
+        void write(uint16_t channel, uint64_t timeStampUs, const void *head, size_t headSize, const void *data, size_t size);
+        // Latest record timestamp so far, for records without a device clock (e.g. metadata)
+        uint64_t getLastTimeStampUs();
+        // Flush the open chunk, then write index, summary and trailer
+        void close();
+        std::string getPath() const;
+        uint64_t getBytesWritten();
+        nlohmann::json getMetadata();
+    private:
+        struct Block {
+            uint32_t tag;
+            std::vector<uint8_t> body;
+            // chunks only
+            ChunkLogChunkHeader chunk = {};
+        };
+        struct Channel {
+            std::string name;
+            std::string encoding;
+            nlohmann::json info;
+            uint64_t recordCount = 0;
+            uint64_t bytes = 0;
+            uint64_t firstUs = 0;
+            uint64_t lastUs = 0;
+        };
+
+        void sealChunk();
+        void writerLoop();
+        void writeBlock(Block& block);
+        bool compress(const std::vector<uint8_t>& raw, std::vector<uint8_t>& out);
+
+        std::string path;
+        ChunkCompression compression = ChunkCompression::NONE;
+        size_t chunkBytes = 4 << 20;
+        FileWriter file;
+        uint64_t offset = 0;  // writer thread, and close() after it has stopped
+
+        // producers fill the open chunk; sealed blocks go to the writer thread
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<Channel> channels;
+        std::vector<uint8_t> chunk;
+        ChunkLogChunkHeader chunkHeader = {};
+        std::deque<Block> pending;
+        bool isOpen = false;
+        bool isClosing = false;
+        uint64_t lastUs = 0;
+        uint64_t rawBytes = 0;
+        uint64_t bytesWritten = 0;
+        uint64_t blockedCount = 0;  // writes that waited for the writer thread
+        bool isWriteFailed = false; // set by the writer thread; nothing is written or indexed after
+        uint64_t droppedCount = 0;  // blocks not written because of it
+        std::vector<ChunkLogIndexEntry> index;
+        std::thread writer;
+        void *compressContext = nullptr;  // ZSTD_CCtx, reused across chunks
+};
+
+// One record handed out by ChunkLogReader; data points into the reader's chunk buffer
+struct ChunkLogRecord {
+    uint16_t channel;
+    uint64_t timeStampUs;
+    const uint8_t *data;
+    uint32_t size;
+};
+
+class ChunkLogReader {
+    public:
+        bool open(const std::string& path);
+        // Channel info as written: {id, name, encoding, info}
+        const std::vector<nlohmann::json>& getChannels() const;
+        const std::vector<ChunkLogIndexEntry>& getChunks() const;
+        // Empty for a file that was not closed
+        const nlohmann::json& getSummary() const;
+        // Calls back every record in [startUs, endUs], reading only the chunks that overlap it.
+        // Records come chunk by chunk in file order. Returns false on a read or decompression error.
+        bool read(uint64_t startUs, uint64_t endUs, const std::function<void(const ChunkLogRecord&)>& callback);
+        std::string errorMsg;
+    private:
+        bool readTrailer();
+        bool scanBlocks();
+        bool readChunk(const ChunkLogIndexEntry& entry, std::vector<uint8_t>& raw);
+
+        std::ifstream ifs;
+        std::vector<nlohmann::json> channels;
+        std::vector<ChunkLogIndexEntry> chunks;
+        nlohmann::json summary;
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef COLOR_CONVERT_HPP
+#define COLOR_CONVERT_HPP
+
+#include <cstdint>
+
+// SIMD kernel used for packed YUV 4:2:2 to BGR conversion
+enum ColorConvertBackend {
+    CONVERT_SCALAR,
+    CONVERT_SSSE3,
+    CONVERT_AVX2,
+    CONVERT_NEON,
+};
+
+// Fastest backend supported by this CPU
+ColorConvertBackend bestColorConvertBackend();
+const char *colorConvertBackendName(ColorConvertBackend backend);
+
+// Convert YUYV (or UYVY) straight to BGR888 in one pass, BT.601 limited range.
+// width must be even. All backends produce identical output.
+void packedYuvToBgr(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,
+                    int width, int height, bool isUyvy);
+void packedYuvToBgr(ColorConvertBackend backend, const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,
+                    int width, int height, bool isUyvy);
+
+#endif
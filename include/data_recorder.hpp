@@ -1,6 +1,7 @@
 #ifndef DATA_RECORDER_HPP
 #define DATA_RECORDER_HPP
 
+#include <array>
 #include <iostream>
 #include <filesystem>
 #include <chrono>
@@ -9,40 +10,84 @@
 #include <fstream>
 #include <filesystem>
 #include <atomic>
+#include <future>
+#include <mutex>
+#include <condition_variable>
 #include <nlohmann/json.hpp>
 #include "libobsensor/ObSensor.hpp"
 #include "opencv2/opencv.hpp"
 #include "stream_manager.hpp"
-
-struct Settings {
-    std::vector<OBSensorType> sensorTypes;
-    std::vector<std::string> streamNames;
-    std::vector<bool> isSaveVideo;
-    std::vector<bool> isSaveImage;
-    std::vector<int> profileIdx;
-    std::vector<std::string> containerFormats;
-    std::vector<int> codecs;
-    std::vector<std::string> imageFormats;
-    std::vector<std::vector<int>> compressionParams;
-    float videoLength;
-    std::string saveDir;
-    int recordCount;
-};
+#include "settings.hpp"
+#include "frame_source.hpp"
+#include "pre_roll_buffer.hpp"
+#include "trace.hpp"
+#include "chunk_log.hpp"
 
 class DataRecorder {
     public:
         DataRecorder(Settings settings);
+        // Record from a source that is already open and stays open after this record
+        DataRecorder(Settings settings, std::shared_ptr<FrameSource> source);
+        ~DataRecorder();
         void createSaveDir();
         void startProcess();
         void process();
         void stopProcess();
         void saveMetadata();
+        // Start of the trigger-to-first-frame measurement, defaults to startProcess()
+        void setTriggerTime(std::chrono::steady_clock::time_point triggerTime);
+        // Returns once no more frames or IMU samples are taken; writers may still be finalising
+        void waitCaptureStopped();
 
     private:
-        ob::Context context;
-        std::shared_ptr<ob::Pipeline> pipe;
-        std::shared_ptr<ob::Config> config;
-        std::shared_ptr<ob::Device> device;
+        void setupStreams(const Settings& settings);
+        void finishProcess();
+        void startPreRoll();
+        void preRollLoop();
+        void flushPreRoll();
+        void preRollFlushLoop();
+        void onFrame(std::shared_ptr<SourceFrame> frame);
+        void markFirstFrame();
+        void statsLoop();
+        void exportStats();
+        void dumpTrace(const std::string& fileName);
+
+        std::shared_ptr<FrameSource> source;
+        bool isOwnSource = true;
+        std::shared_ptr<ImageEncoderPool> imagePool;
+        std::shared_ptr<FrameBufferPool> bufferPool;
+
+        // frames taken while waiting for the trigger, written first once it comes
+        std::unique_ptr<PreRollBuffer> preRoll;
+        std::thread preRollThread;
+        std::atomic<bool> isPreRolling{false};
+        // after the trigger: queues the ring to the writers, then the live frames held behind it
+        std::thread preRollFlushThread;
+
+        // callback ingestion: the source threads hand frames to onFrame, which routes them by state
+        enum class IngestState { ARMED, PRE_ROLL, DRAINING, RECORDING, STOPPED };
+        bool isCallbackIngest = false;
+        std::atomic<IngestState> ingestState{IngestState::ARMED};
+        std::array<std::atomic<int>, 32> warmUpFrames{};  // frames skipped so far, by frame type
+
+        // live stats files, written off the capture thread
+        int statsIntervalMs = 0;
+        std::string statsPromPath;
+        std::thread statsThread;
+        std::mutex statsMutex;
+        std::condition_variable statsCv;
+        bool isStatsRunning = false;
+
+        // single-file recording; metadata snapshots go to their own channel
+        std::shared_ptr<ChunkLogWriter> chunkLog;
+        uint16_t metadataChannel = 0;
+
+        // one degradation level for every image stream while writers fall behind
+        std::shared_ptr<BackpressureController> backpressure;
+
+        // Chrome trace files written for this record
+        bool isTrace = false;
+        std::vector<std::string> traceFiles;
 
         std::atomic<bool> stopFlag{false};
         bool isUseFlag = false;
@@ -52,6 +97,17 @@ class DataRecorder {
         std::string crtDir;
         int frameCount = 0;
         int recordCount = 0;
+        int segmentCount = 0;
+
+        // session timing [ms]
+        std::chrono::steady_clock::time_point triggerTime;
+        bool hasTriggerTime = false;
+        std::atomic<bool> hasFirstFrame{false};
+        double armMs = 0;
+        std::atomic<double> triggerToFirstFrameMs{-1};
+        double finalizeMs = 0;
+        std::promise<void> captureStopped;
+        std::shared_future<void> captureStoppedFuture;
 };
 
 #endif
@@ -0,0 +1,46 @@
+#ifndef DEPTH_PREVIEW_HPP
+#define DEPTH_PREVIEW_HPP
+
+#include <string>
+#include <cstdint>
+#include "opencv2/opencv.hpp"
+
+// How 16-bit depth is turned into the 8-bit preview (video and lossy images)
+enum class DepthPreviewMode {
+    AUTO,       // per-frame min/max stretch
+    FIXED,      // fixed metric range, gray
+    COLORMAP,   // fixed metric range through a colormap, BGR
+};
+
+DepthPreviewMode parseDepthPreviewMode(const std::string& name);
+std::string depthPreviewModeName(DepthPreviewMode mode);
+
+struct DepthPreviewConfig {
+    DepthPreviewMode mode = DepthPreviewMode::AUTO;
+    float minMm = 300;
+    float maxMm = 5000;
+    std::string colormap = "turbo";  // jet, turbo, inferno or viridis
+};
+
+// Single pass depth -> 8-bit (or BGR) conversion into a reused buffer.
+// Invalid pixels (0) stay black, pixels beyond the range saturate.
+class DepthPreview {
+    public:
+        DepthPreview();
+        explicit DepthPreview(const DepthPreviewConfig& config);
+        const DepthPreviewConfig& getConfig() const;
+        bool isColor() const;
+        void convert(const cv::Mat& depth, float valueScale, cv::Mat& dst);
+    private:
+        void updateScale(float valueScale);
+
+        DepthPreviewConfig config;
+        float currentScale = -1;
+        uint16_t lo = 0;        // raw value mapped to 0
+        uint16_t range = 256;   // raw values mapped to 0..255, at least 256
+        uint16_t mul = 0;       // 255 * 65536 / range, rounded up
+        uint8_t colorTable[256][3];
+        std::vector<uint8_t> rowBuffer;
+};
+
+#endif
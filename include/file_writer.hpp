@@ -0,0 +1,74 @@
+#ifndef FILE_WRITER_HPP
+#define FILE_WRITER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "stream_stats.hpp"
+
+enum class FileWriteMode {
+    BUFFERED,  // page cache, writeback started every syncBytes and waited for one window later
+    DIRECT,    // O_DIRECT aligned blocks, no page cache; falls back to BUFFERED where unsupported
+};
+
+FileWriteMode parseFileWriteMode(const std::string& name);
+std::string fileWriteModeName(FileWriteMode mode);
+
+// Defaults suit the small per-stream logs (timecodes, indexes, IMU), which grow by a few KB
+// a second; the chunk log is opened with larger blocks and steps.
+struct FileWriterConfig {
+    FileWriteMode mode = FileWriteMode::BUFFERED;
+    size_t blockBytes = 64 << 10;       // write unit and buffer size, rounded up to 4 KiB
+    size_t preallocateBytes = 1 << 20;  // fallocate step ahead of the data, 0 disables
+    size_t syncBytes = 1 << 20;         // BUFFERED: dirty data allowed before writeback is forced
+};
+
+// Append-only file for timecodes, indexes, IMU logs and the chunk log. Data is gathered
+// into one aligned block and written a block at a time, so the file grows in large steps
+// into space reserved ahead with fallocate, and the page cache never builds up a backlog
+// that the kernel flushes all at once. Every write and sync call is timed.
+// One writing thread; getMetadata() may be called from any.
+class FileWriter {
+    public:
+        FileWriter() = default;
+        ~FileWriter();
+        FileWriter(const FileWriter&) = delete;
+        FileWriter& operator=(const FileWriter&) = delete;
+        bool open(const std::string& fileName, const FileWriterConfig& config);
+        bool isOpened() const;
+        bool write(const void *data, size_t size);
+        // Put what is buffered into the file. DIRECT writes the whole pages direct and the
+        // last partial page through the page cache, so the file never ends in padding.
+        bool flush();
+        void close();
+        // Data bytes, excluding padding
+        uint64_t getSize() const;
+        // What the file is really written with, after any fallback
+        FileWriteMode getMode() const;
+        nlohmann::json getMetadata() const;
+        std::string errorMsg;
+    private:
+        bool writeAt(int fd, const uint8_t *data, size_t size, uint64_t offset);
+        void preallocate(uint64_t end);
+        void startWriteback();
+
+        int fd = -1;
+        int tailFd = -1;            // DIRECT: same file without O_DIRECT, for the partial page
+        FileWriterConfig config;
+        std::atomic<FileWriteMode> mode{FileWriteMode::BUFFERED};
+        uint8_t *buffer = nullptr;  // aligned, config.blockBytes
+        size_t used = 0;
+        uint64_t bufferOffset = 0;  // file offset of buffer[0]
+        uint64_t allocated = 0;     // reserved up to here
+        std::atomic<bool> isPreallocate{false};
+        uint64_t syncedTo = 0;      // BUFFERED: writeback started up to here
+        uint64_t waitFrom = 0;      // and waited for up to here
+        std::atomic<uint64_t> size{0};
+        std::atomic<uint64_t> writeCount{0};
+        std::atomic<uint64_t> syncCount{0};
+        std::atomic<uint64_t> maxWriteNs{0};
+        LatencyHistogram writeLatency;  // one pwrite or sync_file_range call
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef FRAME_BUFFER_POOL_HPP
+#define FRAME_BUFFER_POOL_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// Reusable frame-sized buffers shared by all streams, with one byte budget over
+// everything the pool has allocated (free and in flight).
+// Create with std::make_shared: buffers keep the pool alive until they are returned.
+class FrameBufferPool : public std::enable_shared_from_this<FrameBufferPool> {
+    public:
+        FrameBufferPool(size_t budgetBytes, int waitMs);
+        ~FrameBufferPool();
+        // Reuses a free buffer of the same size when possible. When the budget is used up,
+        // waits up to waitMs for a buffer to come back, then allocates anyway (counted as overBudget).
+        std::shared_ptr<uint8_t> acquire(size_t size);
+        // Pre-allocate count buffers of size so steady state starts warm
+        void reserve(size_t size, int count);
+        nlohmann::json getMetadata();
+    private:
+        uint8_t *allocate(size_t size);
+        void release(uint8_t *data, size_t size);
+        bool evictFor(size_t size);
+
+        size_t budgetBytes;
+        std::chrono::milliseconds wait;
+        std::mutex mutex;
+        std::condition_variable released;
+        std::map<size_t, std::vector<uint8_t *>> freeBuffers;   // by size
+        size_t allocatedBytes = 0;
+        size_t inUseBytes = 0;
+        size_t peakAllocatedBytes = 0;
+        size_t peakInUseBytes = 0;
+        uint64_t acquireCount = 0;
+        uint64_t hitCount = 0;
+        uint64_t waitCount = 0;
+        uint64_t overBudgetCount = 0;
+};
+
+#endif
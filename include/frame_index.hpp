@@ -0,0 +1,90 @@
+#ifndef FRAME_INDEX_HPP
+#define FRAME_INDEX_HPP
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include "file_writer.hpp"
+
+// <segment>_frames.idx: this header, then one record per frame of the segment in capture
+// order, so frame n is at sizeof(header) + n * recordSize
+struct FrameIndexHeader {
+    char magic[6] = {'R', 'R', 'F', 'I', 'X', '\0'};
+    uint16_t version = 1;
+    uint32_t recordSize = 32;
+    uint32_t reserved = 0;
+};
+
+enum FrameIndexFlags : uint32_t {
+    FRAME_INDEX_KEY = 1,     // the packet is a key frame
+    FRAME_INDEX_PACKET = 2,  // offset and size are known
+    FRAME_INDEX_IMAGE = 4,   // an image file was written for the frame
+};
+
+struct FrameIndexRecord {
+    uint64_t timeStampUs;  // device timestamp
+    uint64_t offset;       // where the muxer wrote the frame's packet in the video file
+    uint32_t size;         // packet bytes
+    uint32_t flags;        // FrameIndexFlags
+    uint32_t streamFrame;  // frame count of the whole stream, the <n> of image "<n>_<ms>ms<ext>"
+    uint32_t keyFrame;     // key frame at or before this one that decoding starts from
+};
+static_assert(sizeof(FrameIndexHeader) == 16 && sizeof(FrameIndexRecord) == 32, "frame index layout changed");
+
+// Written on the stream's worker thread. The stream adds every frame in order; the muxer
+// then reports where its packet went, which with B-frames can be out of order, so records
+// are held until every earlier frame is settled.
+class FrameIndexWriter {
+    public:
+        FrameIndexWriter() = default;
+        ~FrameIndexWriter();
+        bool open(const std::string& fileName, const FileWriterConfig& config);
+        bool isOpened() const;
+        // isPacketExpected: a muxer will call setPacket() for this frame
+        void addFrame(uint64_t timeStampUs, uint32_t streamFrame, bool hasImage, bool isPacketExpected);
+        // Number of the frame added last, for the muxer to attach its packet to
+        uint32_t getLastFrame() const;
+        void setPacket(uint32_t frameNumber, uint64_t offset, uint32_t size, bool isKey);
+        void close();
+    private:
+        struct Pending {
+            FrameIndexRecord record;
+            bool isSettled;
+        };
+
+        void emitSettled(bool isAll);
+
+        FileWriter file;
+        std::deque<Pending> pending;
+        uint32_t firstPending = 0;   // frame number of pending.front()
+        uint32_t frameCount = 0;
+        uint32_t lastKeyFrame = 0;
+};
+
+// Read-only view of a frame index, memory mapped, for analysis tools and replay.
+// Timestamp lookups are binary searches; frame lookups index the records directly.
+class FrameIndexReader {
+    public:
+        FrameIndexReader() = default;
+        ~FrameIndexReader();
+        FrameIndexReader(const FrameIndexReader&) = delete;
+        FrameIndexReader& operator=(const FrameIndexReader&) = delete;
+        bool open(const std::string& fileName);
+        void close();
+        size_t size() const;
+        const FrameIndexRecord& at(size_t frameNumber) const;
+        // Last frame at or before timeStampUs, -1 if every frame is later
+        int64_t findFrame(uint64_t timeStampUs) const;
+        // Frame closest to timeStampUs, -1 if the index is empty
+        int64_t findNearestFrame(uint64_t timeStampUs) const;
+        // Where a decoder has to start to show frameNumber
+        int64_t findKeyFrame(size_t frameNumber) const;
+        std::string errorMsg;
+    private:
+        void *map = nullptr;
+        size_t mapSize = 0;
+        const FrameIndexRecord *records = nullptr;
+        size_t count = 0;
+};
+
+#endif
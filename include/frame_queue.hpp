@@ -0,0 +1,160 @@
+#ifndef FRAME_QUEUE_HPP
+#define FRAME_QUEUE_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// What to do when a producer pushes into a full queue
+enum class DropPolicy {
+    DROP_OLDEST,  // discard the oldest queued item and keep the new one
+    DROP_NEWEST,  // discard the new item
+    BLOCK,        // wait until the consumer frees a slot
+};
+
+inline DropPolicy parseDropPolicy(const std::string& name) {
+    if (name == "dropNewest") {
+        return DropPolicy::DROP_NEWEST;
+    } else if (name == "block") {
+        return DropPolicy::BLOCK;
+    }
+    return DropPolicy::DROP_OLDEST;
+}
+
+inline std::string dropPolicyName(DropPolicy policy) {
+    switch (policy) {
+        case DropPolicy::DROP_NEWEST:
+            return "dropNewest";
+        case DropPolicy::BLOCK:
+            return "block";
+        default:
+            return "dropOldest";
+    }
+}
+
+// Bounded queue between the capture thread and a stream's worker thread.
+// Everything is under one mutex, so the image encoder pool also uses it with several producers and consumers.
+template <typename T>
+class FrameQueue {
+    public:
+        FrameQueue(size_t capacity, DropPolicy policy) :
+            slots(capacity > 0 ? capacity : 1), policy(policy) {}
+
+        // Returns false if an item was dropped to make this push fit
+        bool push(T item) {
+            return push(std::move(item), this->policy);
+        }
+
+        // Push with a policy other than the queue's own (e.g. BLOCK for a backlog that must not drop)
+        bool push(T item, DropPolicy policy) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            if (this->closed) {
+                return false;
+            }
+            bool isDropped = false;
+            if (this->count == this->slots.size()) {
+                if (policy == DropPolicy::BLOCK) {
+                    this->notFull.wait(lock, [this] { return this->count < this->slots.size() || this->closed; });
+                    if (this->closed) {
+                        return false;
+                    }
+                } else if (policy == DropPolicy::DROP_NEWEST) {
+                    this->dropCount++;
+                    return false;
+                } else {
+                    this->slots[this->head] = T();
+                    this->head = (this->head + 1) % this->slots.size();
+                    this->count--;
+                    this->dropCount++;
+                    isDropped = true;
+                }
+            }
+            this->slots[(this->head + this->count) % this->slots.size()] = std::move(item);
+            this->count++;
+            if (this->count > this->peakCount) {
+                this->peakCount = this->count;
+            }
+            lock.unlock();
+            this->notEmpty.notify_one();
+            return !isDropped;
+        }
+
+        // Blocks until an item is available. Returns false once closed and drained.
+        bool pop(T& item) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->notEmpty.wait(lock, [this] { return this->count > 0 || this->closed; });
+            if (this->count == 0) {
+                return false;
+            }
+            item = std::move(this->slots[this->head]);
+            this->slots[this->head] = T();
+            this->head = (this->head + 1) % this->slots.size();
+            this->count--;
+            lock.unlock();
+            this->notFull.notify_one();
+            return true;
+        }
+
+        // Same as pop() but gives up after timeout
+        bool popFor(T& item, std::chrono::milliseconds timeout) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            if (!this->notEmpty.wait_for(lock, timeout, [this] { return this->count > 0 || this->closed; })) {
+                return false;
+            }
+            if (this->count == 0) {
+                return false;
+            }
+            item = std::move(this->slots[this->head]);
+            this->slots[this->head] = T();
+            this->head = (this->head + 1) % this->slots.size();
+            this->count--;
+            lock.unlock();
+            this->notFull.notify_one();
+            return true;
+        }
+
+        // Wake the consumer; remaining items are still handed out by pop()
+        void close() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->closed = true;
+            }
+            this->notEmpty.notify_all();
+            this->notFull.notify_all();
+        }
+
+        size_t size() {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->count;
+        }
+
+        size_t capacity() const {
+            return this->slots.size();
+        }
+
+        size_t getDropCount() {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->dropCount;
+        }
+
+        size_t getPeakCount() {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->peakCount;
+        }
+
+    private:
+        std::vector<T> slots;
+        DropPolicy policy;
+        std::mutex mutex;
+        std::condition_variable notEmpty;
+        std::condition_variable notFull;
+        size_t head = 0;
+        size_t count = 0;
+        size_t dropCount = 0;
+        size_t peakCount = 0;
+        bool closed = false;
+};
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef FRAME_SOURCE_HPP
+#define FRAME_SOURCE_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include "libobsensor/ObSensor.hpp"
+#include "opencv2/opencv.hpp"
+#include "frame_queue.hpp"
+#include "settings.hpp"
+
+// Resolved video stream profile, independent of the SDK profile object
+struct VideoProfileInfo {
+    OBFormat format = OB_FORMAT_UNKNOWN;
+    int width = 0;
+    int height = 0;
+    float fps = 0;
+    OBCameraIntrinsic intrinsic = {};
+    OBCameraDistortion distortion = {};
+    // extrinsic from this stream to the default color stream
+    bool hasExtrinsic = false;
+    OBExtrinsic extrinsic = {};
+};
+
+// One image frame handed to the stream managers
+struct SourceFrame {
+    OBFrameType type = OB_FRAME_UNKNOWN;
+    OBFormat format = OB_FORMAT_UNKNOWN;
+    int width = 0;
+    int height = 0;
+    uint64_t timeStamp = 0;    // device timestamp [ms]
+    uint64_t timeStampUs = 0;  // device timestamp [us]
+    float valueScale = 1.0f;   // depth only
+    uint8_t *data = nullptr;
+    uint32_t dataSize = 0;
+    bool isPng = false;        // pre-roll: data holds a PNG of the pixels
+    std::shared_ptr<SourceFrame> pair;  // stereo IR: the right frame of the same frameset
+    int64_t queuedNs = 0;      // when the capture thread handed it to a worker [StageProfiler::now()]
+    bool isBacklog = false;    // pre-roll: its wait in the queue says nothing about the writer's load
+
+    // keep the pixels alive: either the SDK frame or an owned buffer
+    std::shared_ptr<ob::Frame> sdkFrame;
+    std::shared_ptr<std::vector<uint8_t>> buffer;
+};
+
+struct SourceFrameSet {
+    std::vector<std::shared_ptr<SourceFrame>> frames;
+
+    std::shared_ptr<SourceFrame> getFrame(OBFrameType type) const {
+        for (auto &frame : this->frames) {
+            if (frame->type == type) {
+                return frame;
+            }
+        }
+        return nullptr;
+    }
+};
+
+// One gyro or accel sample
+struct ImuSample {
+    uint64_t timeStamp = 0;  // device timestamp [ms]
+    float temperature = 0;
+    float x = 0;
+    float y = 0;
+    float z = 0;
+};
+
+// Binary IMU log (<stream>.bin): this header, then raw little endian ImuSample records
+struct ImuBinaryHeader {
+    char magic[6] = {'R', 'R', 'I', 'M', 'U', '\0'};
+    uint16_t version = 1;
+    uint32_t sensorType = 0;
+    uint32_t recordSize = sizeof(ImuSample);
+};
+static_assert(sizeof(ImuSample) == 24 && sizeof(ImuBinaryHeader) == 16, "IMU binary layout changed");
+
+typedef std::function<void(const ImuSample&)> ImuCallback;
+typedef std::function<void(std::shared_ptr<SourceFrame>)> FrameCallback;
+
+OBFrameType frameTypeOf(OBSensorType sensorType);
+
+// Where frames come from: the camera, a generator or a previous recording.
+// Methods throw (ob::Error or std::exception) when a stream cannot be set up.
+class FrameSource {
+    public:
+        virtual ~FrameSource() = default;
+        virtual std::string getName() = 0;
+        virtual bool hasSensor(OBSensorType sensorType) = 0;
+        virtual VideoProfileInfo getVideoProfile(OBSensorType sensorType, int profileIdx) = 0;
+        virtual void enableStream(OBSensorType sensorType, int profileIdx) = 0;
+        virtual void startImu(OBSensorType sensorType, int profileIdx, ImuCallback callback) = 0;
+        virtual void stopImu(OBSensorType sensorType) = 0;
+        virtual void start() = 0;
+        virtual void stop() = 0;
+        // Returns nullptr on timeout
+        virtual std::shared_ptr<SourceFrameSet> waitForFrames(uint32_t timeoutMs) = 0;
+        // True once a finite source has delivered everything
+        virtual bool isFinished() { return false; }
+        // Hand each image frame to callback as it arrives instead of through waitForFrames.
+        // Sensors may call it concurrently. Returns false if the source cannot. Set it before start(); on a running source it only
+        // swaps the callback, and once setFrameCallback(nullptr) returns no call is in flight.
+        // That wait includes a callback blocked on a full queue, so callbacks should only block briefly.
+        virtual bool setFrameCallback(FrameCallback callback) { return false; }
+    protected:
+        bool storeFrameCallback(FrameCallback callback);
+        bool isCallbackMode();
+        void deliverFrame(std::shared_ptr<SourceFrame> frame);
+    private:
+        // sensors deliver without locking: the callback is swapped atomically and the setter
+        // waits for the calls in flight before it frees the old one
+        std::mutex frameCallbackMutex;                   // setters only
+        std::unique_ptr<FrameCallback> frameCallbackOwner;
+        std::atomic<FrameCallback *> frameCallback{nullptr};
+        std::atomic<int> frameCallbacksInFlight{0};
+        std::atomic<bool> hasFrameCallback{false};
+};
+
+// Builds the source selected by settings.frameSource
+std::shared_ptr<FrameSource> createFrameSource(const Settings& settings);
+
+class OrbbecFrameSource : public FrameSource {
+    public:
+        OrbbecFrameSource();
+        std::string getName() override;
+        bool hasSensor(OBSensorType sensorType) override;
+        VideoProfileInfo getVideoProfile(OBSensorType sensorType, int profileIdx) override;
+        void enableStream(OBSensorType sensorType, int profileIdx) override;
+        void startImu(OBSensorType sensorType, int profileIdx, ImuCallback callback) override;
+        void stopImu(OBSensorType sensorType) override;
+        void start() override;
+        void stop() override;
+        std::shared_ptr<SourceFrameSet> waitForFrames(uint32_t timeoutMs) override;
+        bool setFrameCallback(FrameCallback callback) override;
+    private:
+        std::shared_ptr<SourceFrame> wrapFrame(std::shared_ptr<ob::Frame> frame, OBFrameType type);
+        void startSensor(OBSensorType sensorType, std::shared_ptr<ob::StreamProfile> profile);
+
+        ob::Context context;
+        std::shared_ptr<ob::Device> device;
+        std::shared_ptr<ob::Pipeline> pipe;
+        std::shared_ptr<ob::Config> config;
+        std::vector<OBFrameType> enabledTypes;
+        std::map<OBSensorType, int> enabledProfileIdx;
+        bool isStarted = false;
+        std::map<OBSensorType, std::shared_ptr<ob::Sensor>> imuSensors;
+        // callback mode: every video sensor runs on its own instead of through the pipeline
+        std::vector<std::pair<OBSensorType, std::shared_ptr<ob::StreamProfile>>> enabledProfiles;
+        std::map<OBSensorType, std::shared_ptr<ob::Sensor>> videoSensors;
+        // resolved once, records after the first reuse them
+        std::map<std::pair<int, int>, VideoProfileInfo> profileCache;
+};
+
+// Generates color/depth/IR/IMU frames for the profiles listed in <profileDir>/*_profiles.csv
+class SyntheticFrameSource : public FrameSource {
+    public:
+        SyntheticFrameSource(const std::string& profileDir, bool isRealtime, float rate);
+        ~SyntheticFrameSource() override;
+        std::string getName() override;
+        bool hasSensor(OBSensorType sensorType) override;
+        VideoProfileInfo getVideoProfile(OBSensorType sensorType, int profileIdx) override;
+        void enableStream(OBSensorType sensorType, int profileIdx) override;
+        void startImu(OBSensorType sensorType, int profileIdx, ImuCallback callback) override;
+        void stopImu(OBSensorType sensorType) override;
+        void start() override;
+        void stop() override;
+        std::shared_ptr<SourceFrameSet> waitForFrames(uint32_t timeoutMs) override;
+        bool setFrameCallback(FrameCallback callback) override;
+
+        // Build one frame without starting the generator thread
+        std::shared_ptr<SourceFrame> makeFrame(OBSensorType sensorType, int profileIdx, uint64_t index, uint64_t timeStampUs);
+    private:
+        struct Stream {
+            OBSensorType sensorType;
+            int profileIdx;
+            VideoProfileInfo profile;
+        };
+        struct Imu {
+            ImuCallback callback;
+            float rate;
+            std::thread thread;
+            std::atomic<bool> running{false};
+        };
+        typedef std::vector<std::shared_ptr<std::vector<uint8_t>>> Patterns;
+
+        const Patterns& getPatterns(OBSensorType sensorType, int profileIdx);
+        void generateLoop();
+        void imuLoop(OBSensorType sensorType, Imu *imu);
+        void startImuThread(OBSensorType sensorType, Imu *imu);
+
+        std::map<OBSensorType, std::vector<VideoProfileInfo>> profiles;
+        std::map<std::pair<int, int>, Patterns> patternCache;
+        std::mutex patternMutex;
+        std::vector<Stream> streams;
+        std::map<OBSensorType, std::unique_ptr<Imu>> imus;
+        bool isRealtime;
+        float rate;
+        std::atomic<bool> running{false};
+        std::chrono::steady_clock::time_point startTime;
+        std::thread generator;
+        FrameQueue<std::shared_ptr<SourceFrameSet>> queue;
+};
+
+// Re-feeds a recording directory written by DataRecorder
+class ReplayFrameSource : public FrameSource {
+    public:
+        ReplayFrameSource(const std::string& recordDir, bool isRealtime);
+        ~ReplayFrameSource() override;
+        std::string getName() override;
+        bool hasSensor(OBSensorType sensorType) override;
+        VideoProfileInfo getVideoProfile(OBSensorType sensorType, int profileIdx) override;
+        void enableStream(OBSensorType sensorType, int profileIdx) override;
+        void startImu(OBSensorType sensorType, int profileIdx, ImuCallback callback) override;
+        void stopImu(OBSensorType sensorType) override;
+        void start() override;
+        void stop() override;
+        std::shared_ptr<SourceFrameSet> waitForFrames(uint32_t timeoutMs) override;
+        bool isFinished() override;
+    private:
+        struct Stream {
+            OBSensorType sensorType;
+            VideoProfileInfo profile;
+            std::vector<uint64_t> timeStamps;
+            std::vector<float> valueScales;
+            std::vector<std::string> imagePaths;
+            std::vector<std::string> videoPaths;  // one per segment
+            size_t videoIdx = 0;
+            cv::VideoCapture capture;
+            size_t next = 0;
+            bool isEnable = false;
+            bool isStereo = false;  // left | right IR in one video, split on read
+        };
+        struct Imu {
+            std::string csvPath;
+            ImuCallback callback;
+            std::thread thread;
+            std::atomic<bool> running{false};
+        };
+
+        std::shared_ptr<SourceFrame> readFrame(Stream& stream);
+        void replayLoop();
+        void imuLoop(OBSensorType sensorType, Imu *imu);
+        void startImuThread(OBSensorType sensorType, Imu *imu);
+        void waitUntil(uint64_t timeStamp);
+
+        std::string recordDir;
+        bool isRealtime;
+        std::map<OBSensorType, Stream> streams;
+        std::map<OBSensorType, std::unique_ptr<Imu>> imus;
+        uint64_t firstTimeStamp = 0;
+        std::atomic<bool> running{false};
+        std::atomic<bool> finished{false};
+        std::chrono::steady_clock::time_point startTime;
+        std::thread replayer;
+        FrameQueue<std::shared_ptr<SourceFrameSet>> queue;
+};
+
+#endif
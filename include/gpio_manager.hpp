@@ -1,34 +1,102 @@
-extern "C" {
-    #include <gpiod.h>
-    #include <stdlib.h>
-    #include <stdio.h>
-    #include <unistd.h>
-}
+#ifndef GPIO_MANAGER_HPP
+#define GPIO_MANAGER_HPP
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "settings.hpp"
+
+struct gpiod_chip;
+struct gpiod_line;
+
+// One level change on the input line
+struct GpioEdge {
+    bool isRising = false;
+    std::chrono::steady_clock::time_point time;  // kernel event timestamp when the backend has one
+};
+
+// Input (PDU_C) and output (camera) lines, independent of where they come from
+class GpioBackend {
+    public:
+        virtual ~GpioBackend() = default;
+        virtual std::string getName() = 0;
+        // Current input level: 1, 0, or -1 on error
+        virtual int readInput() = 0;
+        // Wait up to timeoutMs for an input edge: 1 with the edge, 0 on timeout, -1 on error
+        virtual int waitEdge(int timeoutMs, GpioEdge& edge) = 0;
+        virtual void setOutput(bool value) = 0;
+};
+
+// libgpiod v1 character device lines, also used for gpio-sim chips
+class LibgpiodBackend : public GpioBackend {
+    public:
+        LibgpiodBackend(const std::string& inputChip, int inputLine, const std::string& outputChip, int outputLine);
+        ~LibgpiodBackend() override;
+        std::string getName() override;
+        int readInput() override;
+        int waitEdge(int timeoutMs, GpioEdge& edge) override;
+        void setOutput(bool value) override;
+    private:
+        struct gpiod_chip *chip_PDU_C = nullptr;
+        struct gpiod_line *line_PDU_C = nullptr;
+        struct gpiod_chip *chip_camera = nullptr;
+        struct gpiod_line *line_camera = nullptr;
+};
+
+// In-process lines for running without the board: setInput() plays the PDU signal
+class FakeGpioBackend : public GpioBackend {
+    public:
+        FakeGpioBackend(bool initialLevel = false);
+        std::string getName() override;
+        int readInput() override;
+        int waitEdge(int timeoutMs, GpioEdge& edge) override;
+        void setOutput(bool value) override;
+        void setInput(bool level);
+        bool getOutput();
+    private:
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<GpioEdge> edges;
+        bool level;
+        std::atomic<bool> output{false};
+};
+
+// Builds the backend selected by settings.gpioBackend ("libgpiod" or "fake")
+std::unique_ptr<GpioBackend> createGpioBackend(const Settings& settings);
+
+// Debounced PDU_C input. A monitor thread turns edges into level changes once the
+// line has been stable for debounceMs, and waiters are woken right away.
 class GpioManager {
     public:
-        GpioManager();
+        GpioManager(std::unique_ptr<GpioBackend> backend, int debounceMs);
         ~GpioManager();
         bool get_GPIO_PDU_C();
+        // Block until PDU_C is debounced to level; false on timeout (negative waits forever)
+        bool wait_GPIO_PDU_C(bool level, int timeoutMs);
+        std::future<bool> wait_GPIO_PDU_C_async(bool level, int timeoutMs);
+        // Time of the first edge of the last accepted change, the start of a trigger
+        std::chrono::steady_clock::time_point getLastEdgeTime();
         void set_GPIO_camera(bool value);
+        GpioBackend *getBackend();
 
     private:
-        // GPIO_PDU_C (PIN11: GPIO3_C1)
-        // for input
-        const char *GPIO_PDU_C_CHIPNAME = "gpiochip3";
-        const int GPIO_PDU_C_LINE_OFFSET = 17;
-        struct gpiod_chip *chip_PDU_C;
-        struct gpiod_line *line_PDU_C;
-
-        // GPIO_camera (PIN13: GPIO3_B7)
-        // for output
-        const char *GPIO_camera_CHIPNAME = "gpiochip3";
-        const int GPIO_camera_LINE_OFFSET = 15;
-        struct gpiod_chip *chip_camera;
-        struct gpiod_line *line_camera;
-
-        bool return_val = false;
-        bool last_PDU_C_val = false;
-        int PDU_C_continuous_count = 0;
-        int PDU_C_continuous_threshold = 10;
+        void monitorLoop();
+
+        std::unique_ptr<GpioBackend> backend;
+        int debounceMs = 20;
+        std::thread monitor;
+        std::atomic<bool> isRunning{false};
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool return_val = false;  // debounced level
+        std::chrono::steady_clock::time_point lastEdgeTime;
 };
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef IMAGE_ENCODER_POOL_HPP
+#define IMAGE_ENCODER_POOL_HPP
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "opencv2/opencv.hpp"
+#include "frame_queue.hpp"
+
+// Shared worker pool for cv::imencode. Images are encoded in parallel but written
+// to disk in submission order per stream (channel). Nothing queued is dropped.
+class ImageEncoderPool {
+    public:
+        ImageEncoderPool(int threads, int queueDepth);
+        ~ImageEncoderPool();
+        int registerChannel(const std::string& name);
+        // image must stay valid until encoded: pass an owned Mat or the owner of its buffer.
+        // Blocks while the queue is full.
+        void submit(int channel, const std::string& fileName, const cv::Mat& image,
+                    const std::vector<int>& params, std::shared_ptr<void> owner = nullptr);
+        // An image that is already encoded (e.g. passthrough JPEG): written in order with the rest
+        void submitEncoded(int channel, const std::string& fileName, std::vector<uint8_t> data);
+        // Wait until every image submitted on the channel is on disk
+        void flush(int channel);
+        void close();
+        int getThreadCount() const;
+        nlohmann::json getMetadata();
+        nlohmann::json getChannelMetadata(int channel);
+        uint64_t getChannelBytes(int channel);
+    private:
+        struct Job {
+            int channel;
+            uint64_t seq;
+            std::string fileName;
+            cv::Mat image;
+            std::vector<int> params;
+            std::shared_ptr<void> owner;
+        };
+        struct Encoded {
+            std::string fileName;
+            std::vector<uint8_t> data;
+            bool isOk;
+        };
+        struct Channel {
+            std::string name;
+            uint64_t nextSeq = 0;       // next sequence handed out by submit()
+            uint64_t nextWrite = 0;     // next sequence to be written
+            bool isWriting = false;
+            std::map<uint64_t, Encoded> ready;
+            uint64_t written = 0;
+            uint64_t failed = 0;
+            uint64_t bytes = 0;
+            uint64_t reordered = 0;     // encodes that finished ahead of an earlier frame
+        };
+
+        void workerLoop(int index);
+        // hand over an encoded image and write whatever is next in order
+        void complete(int channel, uint64_t seq, Encoded encoded);
+
+        FrameQueue<Job> queue;
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable written;
+        std::map<int, Channel> channels;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef MKV_WRITER_HPP
+#define MKV_WRITER_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "frame_index.hpp"
+
+// Minimal Matroska muxer for one video track of already compressed key frames (e.g. V_MJPEG).
+// Frames keep their capture timestamps, so dropped frames do not shift the timeline.
+class MkvWriter {
+    public:
+        MkvWriter() = default;
+        ~MkvWriter();
+        bool open(const std::string& fileName, const std::string& codecId, int width, int height, float fps);
+        bool isOpened() const;
+        // timeStamp in ms, monotonic
+        bool write(const uint8_t *data, size_t size, uint64_t timeStamp);
+        void release();
+        uint64_t getFrameCount() const;
+        // Report each frame's file position to the frame added last to frameIndex before write()
+        void setFrameIndex(FrameIndexWriter *frameIndex);
+    private:
+        struct CuePoint {
+            uint64_t time;
+            uint64_t clusterPos;
+        };
+
+        void startCluster(uint64_t timeStamp);
+        void finishCluster();
+        void patchUint(uint64_t filePos, uint64_t value);
+
+        std::ofstream ofs;
+        uint64_t segmentDataPos = 0;    // file offset of the segment payload
+        uint64_t cuesSeekPos = 0;       // SeekPosition placeholder for Cues
+        uint64_t durationPos = 0;       // Duration placeholder in Info
+        uint64_t clusterSizePos = 0;    // size field of the open cluster
+        uint64_t clusterTime = 0;
+        bool isClusterOpen = false;
+        bool hasFirstTimeStamp = false;
+        uint64_t firstTimeStamp = 0;
+        uint64_t lastTime = 0;
+        uint64_t frameCount = 0;
+        std::vector<CuePoint> cues;
+        FrameIndexWriter *frameIndex = nullptr;
+};
+
+#endif
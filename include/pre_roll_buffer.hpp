@@ -0,0 +1,70 @@
+#ifndef PRE_ROLL_BUFFER_HPP
+#define PRE_ROLL_BUFFER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "opencv2/opencv.hpp"
+#include "frame_source.hpp"
+
+// The last few seconds of framesets, kept compressed in memory while waiting for a trigger.
+// Color is stored as JPEG (MJPEG frames as received), depth and IR as PNG; timestamps are kept.
+// Compression runs on the buffer's own thread, so the delivery threads only queue the frames.
+// After trigger() nothing more is compressed: frames pushed while the ring is drained with pop()
+// are held raw behind it, and once all of it is out the ring closes and push() hands frames back.
+class PreRollBuffer {
+    public:
+        PreRollBuffer(float seconds, size_t budgetBytes, int jpegQuality);
+        ~PreRollBuffer();
+        // Before the trigger: queue the frameset for compression, dropping the oldest past the
+        // window or budget. After it: hold the frameset raw behind the ring, waiting for room.
+        // Returns false once the ring has been drained and closed: the frameset is live.
+        bool push(const SourceFrameSet& frameset);
+        // Stop compressing; framesets not compressed yet go out raw, still ahead of the live ones
+        void trigger();
+        // Oldest frameset held, waiting for the one being compressed. isLive is set for frames
+        // pushed after the trigger, which go to the writers as they are. Returns false and
+        // closes the ring once nothing is left.
+        bool pop(std::shared_ptr<SourceFrameSet>& frameset, bool& isLive);
+        nlohmann::json getMetadata();
+    private:
+        void compressLoop();
+        std::shared_ptr<SourceFrame> compress(const SourceFrame& frame);
+
+        float seconds;
+        size_t budgetBytes;
+        std::vector<int> jpegParams;
+        std::vector<int> pngParams;
+        cv::Mat bgrMat;  // reused color conversion output
+
+        std::mutex mutex;
+        std::condition_variable pendingCv;
+        std::condition_variable ringCv;
+        std::condition_variable liveCv;
+        std::deque<SourceFrameSet> pending;  // still holding the source's buffers
+        std::deque<SourceFrameSet> live;     // after the trigger, raw, behind the ring
+        size_t heldCount = 0;                // of those, the ones pushed before the trigger
+        bool isCompressing = false;
+        bool isTriggered = false;
+        bool isClosed = false;
+        bool isStopping = false;
+        std::thread compressThread;
+        std::deque<std::pair<std::shared_ptr<SourceFrameSet>, size_t>> ring;  // frameset and its bytes
+        size_t bytes = 0;
+        size_t peakBytes = 0;
+        uint64_t pushCount = 0;
+        uint64_t pendingDropCount = 0;
+        uint64_t evictCount = 0;
+        uint64_t flushCount = 0;
+        uint64_t liveCount = 0;
+};
+
+// Turn a PNG pre-roll frame back into raw pixels; other frames are returned as they are
+std::shared_ptr<SourceFrame> decodePreRollFrame(std::shared_ptr<SourceFrame> frame);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef SESSION_RUNNER_HPP
+#define SESSION_RUNNER_HPP
+
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include "data_recorder.hpp"
+#include "settings.hpp"
+#include "frame_source.hpp"
+
+// Back-to-back records on one frame source that stays open between them.
+// The next record is armed (directories, writers) before its trigger, and the
+// previous record finalises its files on its own thread while that happens.
+class SessionRunner {
+    public:
+        SessionRunner(Settings settings);
+        ~SessionRunner();
+        // Prepare the next record; returns once the previous one stopped capturing
+        void arm();
+        // Trigger: start recording the armed record
+        void start();
+        // Trigger time from the input edge, for trigger-to-first-frame latency
+        void start(std::chrono::steady_clock::time_point triggerTime);
+        // Stop capturing; the record finalises in the background
+        void stop();
+        // Wait until every stopped record is finalised
+        void wait();
+        int getRecordCount();
+    private:
+        struct Session {
+            std::unique_ptr<DataRecorder> recorder;
+            std::thread thread;
+        };
+
+        Settings settings;
+        std::shared_ptr<FrameSource> source;
+        bool isSourceStarted = false;
+        int recordCount = 0;
+        std::unique_ptr<DataRecorder> armed;
+        std::unique_ptr<Session> active;
+        std::unique_ptr<Session> finishing;
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef SETTINGS_HPP
+#define SETTINGS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include "libobsensor/ObSensor.hpp"
+#include "frame_queue.hpp"
+#include "depth_preview.hpp"
+#include "av_video_writer.hpp"
+#include "timecode_writer.hpp"
+#include "thread_placement.hpp"
+#include "backpressure.hpp"
+#include "file_writer.hpp"
+
+struct Settings {
+    std::vector<OBSensorType> sensorTypes;
+    std::vector<std::string> streamNames;
+    std::vector<bool> isSaveVideo;
+    std::vector<bool> isSaveImage;
+    std::vector<int> profileIdx;
+    std::vector<std::string> containerFormats;
+    std::vector<int> codecs;
+    std::vector<std::string> imageFormats;
+    std::vector<std::vector<int>> compressionParams;
+    float videoLength;
+    std::string saveDir;
+    int recordCount = 0;
+
+    // per-stream video encoder ("opencv" or a libavcodec encoder)
+    std::vector<VideoEncoderConfig> videoEncoders;
+
+    // per-stream writer queue
+    std::vector<int> queueDepths;
+    std::vector<DropPolicy> dropPolicies;
+
+    // frame source: "orbbec", "synthetic" or "replay"
+    std::string frameSource = "orbbec";
+    std::string sourceDir = "";     // profile CSV dir (synthetic) or record dir (replay)
+    bool sourceRealtime = true;     // false: deliver frames as fast as possible
+    float sourceRate = 0;           // synthetic fps override, 0 uses the profile fps
+
+    // store MJPEG color frames as received (.mkv video, .jpg images)
+    bool mjpegPassthrough = false;
+
+    // shared image encode pool, 0 threads encodes on each stream's worker
+    int imageEncoderThreads = 0;
+    int imageQueueDepth = 16;
+
+    // IMU log: "csv" or "binary", samples buffered between the sensor callback and the writer
+    std::string imuFormat = "csv";
+    int imuRingSize = 4096;
+
+    // timecode sidecar: flush budget and optional binary index
+    TimecodeConfig timecode;
+
+    // shared frame buffer pool, off unless a budget is set (e.g. 256 MB)
+    int bufferBudgetMb = 0;
+    int bufferWaitMs = 500;
+
+    // 8-bit depth preview used for depth video and lossy depth images
+    DepthPreviewConfig depthPreview;
+
+    // split videos and timecodes into segments by duration or size, 0 disables a limit
+    float segmentSeconds = 0;
+    int segmentMb = 0;
+
+    // PDU_C trigger input and camera output: "libgpiod" (real or gpio-sim chips) or "fake"
+    std::string gpioBackend = "libgpiod";
+    std::string gpioInputChip = "gpiochip3";
+    int gpioInputLine = 17;     // PIN11: GPIO3_C1
+    std::string gpioOutputChip = "gpiochip3";
+    int gpioOutputLine = 15;    // PIN13: GPIO3_B7
+    int gpioDebounceMs = 50;    // level must hold this long after the last edge
+
+    // keep the seconds before the trigger compressed in memory, 0 disables pre-roll
+    float preRollSeconds = 0;
+    int preRollMb = 128;
+    int preRollJpegQuality = 90;    // color frames that are not MJPEG already
+
+    // record ir_left and ir_right as one side-by-side "ir_stereo" video with one timecode
+    bool stereoIr = false;
+
+    // CPU sets and SCHED_FIFO priority per thread role, see thread_placement.hpp
+    std::map<std::string, ThreadConfig> threads;
+
+    // live per-stream counters: stats.json and a Prometheus textfile, 0 ms disables the export
+    int statsIntervalMs = 0;
+    std::string statsPromPath;  // empty: stats.prom in the record directory
+
+    // hot-path spans written as trace.json when a record closes; SIGUSR2 toggles, SIGUSR1 dumps
+    bool trace = false;
+    int traceBufferEvents = 65536;  // per thread
+
+    // "frameset": poll synchronised framesets; "callback": every sensor delivers its frames as they arrive
+    std::string ingestMode = "frameset";
+
+    // "files": videos, timecodes, images and CSVs per stream; "chunklog": every stream in one record.rrlog
+    std::string recordFormat = "files";
+    std::string chunkCompression = "zstd";  // "zstd", "lz4" or "none"
+    int chunkKb = 4096;                     // records gathered per compressed write
+
+    // shed image writes, JPEG quality and frames of chosen streams while writers fall behind
+    BackpressureConfig backpressure;
+
+    // timecodes, frame indexes and IMU logs: preallocated block writes, "buffered" or "direct"
+    FileWriterConfig fileWriter;
+    // the chunk log takes whole chunks, so it gets large blocks and steps (mode follows fileWriter)
+    FileWriterConfig chunkLogWriter = {FileWriteMode::BUFFERED, 1 << 20, 64 << 20, 8 << 20};
+};
+
+Settings loadSettings(const std::string& settingsPath);
+
+#endif
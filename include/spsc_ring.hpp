@@ -0,0 +1,70 @@
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Lock-free single-producer/single-consumer ring of trivially copyable items.
+// push() never blocks or allocates, so it is safe on SDK callback threads.
+template <typename T>
+class SpscRing {
+    public:
+        // capacity is rounded up to a power of two
+        explicit SpscRing(size_t capacity) {
+            size_t size = 2;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            this->slots.resize(size);
+            this->mask = size - 1;
+        }
+
+        // Producer side. Returns false (and counts an overflow) when full.
+        bool push(const T& item) {
+            size_t head = this->head.load(std::memory_order_relaxed);
+            if (head - this->tailCache == this->slots.size()) {
+                this->tailCache = this->tail.load(std::memory_order_acquire);
+                if (head - this->tailCache == this->slots.size()) {
+                    this->overflowCount.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            this->slots[head & this->mask] = item;
+            this->head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side. Copies up to maxCount items into out.
+        size_t popBatch(T *out, size_t maxCount) {
+            size_t tail = this->tail.load(std::memory_order_relaxed);
+            size_t count = this->head.load(std::memory_order_acquire) - tail;
+            if (count > maxCount) {
+                count = maxCount;
+            }
+            for (size_t i = 0; i < count; i++) {
+                out[i] = this->slots[(tail + i) & this->mask];
+            }
+            this->tail.store(tail + count, std::memory_order_release);
+            return count;
+        }
+
+        size_t capacity() const {
+            return this->slots.size();
+        }
+
+        size_t getOverflowCount() const {
+            return this->overflowCount.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::vector<T> slots;
+        size_t mask;
+        // producer and consumer indices live on separate cache lines
+        alignas(64) std::atomic<size_t> head{0};
+        size_t tailCache = 0;   // producer's last view of tail
+        alignas(64) std::atomic<size_t> tail{0};
+        alignas(64) std::atomic<size_t> overflowCount{0};
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef STAGE_PROFILER_HPP
+#define STAGE_PROFILER_HPP
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include "trace.hpp"
+
+enum ProfileStage {
+    STAGE_CONVERT,    // color format conversion
+    STAGE_NORMALIZE,  // depth 16-bit to 8-bit
+    STAGE_ENCODE,     // video writer
+    STAGE_IMWRITE,    // per-frame image files
+    STAGE_TIMECODE,   // timecode / IMU line
+    STAGE_COUNT,
+};
+
+const char *stageName(ProfileStage stage);
+
+// Per-stream latency samples for each processing stage.
+// Only the stream's own worker thread records into it.
+class StageProfiler {
+    public:
+        static int64_t now();
+        static int64_t threadCpuTime();
+
+        void record(ProfileStage stage, int64_t ns);
+        void addFrame(int64_t startNs, int64_t endNs);
+        void addCpuTime(int64_t ns);
+        nlohmann::json toJson();
+
+    private:
+        std::vector<int64_t> samples[STAGE_COUNT];
+        int64_t frameCount = 0;
+        int64_t firstStart = 0;
+        int64_t lastEnd = 0;
+        int64_t cpuTime = 0;
+};
+
+// Times consecutive stages of one frame into the profiler and, while tracing, as trace spans.
+// Does nothing without either.
+class StageTimer {
+    public:
+        StageTimer(StageProfiler *profiler, ProfileStage stage) : profiler(profiler), stage(stage), isTracing(isTraceEnabled()) {
+            if (this->profiler || this->isTracing) {
+                this->start = StageProfiler::now();
+            }
+        }
+        // Idle until the first next()
+        explicit StageTimer(StageProfiler *profiler) : profiler(profiler), stage(STAGE_COUNT), isRunning(false), isTracing(isTraceEnabled()) {}
+        ~StageTimer() {
+            stop();
+        }
+        // Close the current stage and start timing the next one
+        void next(ProfileStage stage) {
+            if (!this->profiler && !this->isTracing) {
+                return;
+            }
+            int64_t t = StageProfiler::now();
+            if (this->isRunning) {
+                record(t);
+            }
+            this->stage = stage;
+            this->start = t;
+            this->isRunning = true;
+        }
+        void stop() {
+            if ((this->profiler || this->isTracing) && this->isRunning) {
+                record(StageProfiler::now());
+                this->isRunning = false;
+            }
+        }
+    private:
+        void record(int64_t end) {
+            if (this->profiler) {
+                this->profiler->record(this->stage, end - this->start);
+            }
+            if (this->isTracing) {
+                traceEvent(stageName(this->stage), this->start, end - this->start);
+            }
+        }
+
+        StageProfiler *profiler;
+        ProfileStage stage;
+        int64_t start = 0;
+        bool isRunning = true;
+        bool isTracing;
+};
+
+#endif
@@ -5,14 +5,31 @@
 #include <nlohmann/json.hpp>
 #include <filesystem>
 #include <fstream>
+#include <thread>
+#include <future>
+#include <deque>
+#include <mutex>
 #include "libobsensor/ObSensor.hpp"
 #include "opencv2/opencv.hpp"
+#include "frame_queue.hpp"
+#include "frame_source.hpp"
+#include "stage_profiler.hpp"
+#include "mkv_writer.hpp"
+#include "depth_preview.hpp"
+#include "av_video_writer.hpp"
+#include "image_encoder_pool.hpp"
+#include "spsc_ring.hpp"
+#include "timecode_writer.hpp"
+#include "frame_buffer_pool.hpp"
+#include "pre_roll_buffer.hpp"
+#include "thread_placement.hpp"
+#include "stream_stats.hpp"
+#include "chunk_log.hpp"
+#include "backpressure.hpp"
 
 class StreamManager {
     public:
-        StreamManager(std::shared_ptr<ob::Pipeline> pipe,
-                      std::shared_ptr<ob::Device> device,
-                      std::shared_ptr<ob::Config> config,
+        StreamManager(std::shared_ptr<FrameSource> source,
                       OBSensorType sensorType,
                       const std::string& streamName,
                       const std::string& saveDir,
@@ -21,9 +38,26 @@ class StreamManager {
         std::string getStreamName();
         int getSensorType();
         virtual nlohmann::json getMetadata();
-        virtual void processFrameset(std::shared_ptr<ob::FrameSet> frameset);
+        virtual void processFrameset(std::shared_ptr<SourceFrameSet> frameset);
+        // Callback ingestion: one frame of any type, straight from the source thread
+        virtual void processFrame(std::shared_ptr<SourceFrame> frame);
         virtual void close();
+        // Stop taking data from the source; close() still drains and finalises the files
+        virtual void stopCapture();
+        // Number of output segments so far; changes when metadata should be saved again
+        virtual int getSegmentCount();
+        // Pre-roll: frames captured before the trigger, written ahead of the live ones without dropping
+        virtual void processPreRoll(std::shared_ptr<SourceFrameSet> frameset);
+        // Pre-roll: the trigger has come, data held in memory goes out ahead of live data
+        virtual void endPreRoll();
+        // Collect per-stage latencies (benchmark only)
+        void setProfiler(std::shared_ptr<StageProfiler> profiler);
+        // Live counters, readable from any thread while recording
+        const StreamStats& getStats();
     protected:
+        std::shared_ptr<FrameSource> source;
+        std::shared_ptr<StageProfiler> profiler;
+        StreamStats stats;
         bool isEnable = false;
         std::string errorMsg = "";
         int sensorType;
@@ -33,44 +67,160 @@ class StreamManager {
     private:
 };
 
+// Per-stream options for ImageStreamManager, one entry of each settings list
+struct ImageStreamConfig {
+    bool isSaveVideo = false;
+    bool isSaveImage = false;
+    std::string containerFormat;
+    int codec = 0;                      // OpenCV fourcc
+    std::string imageFormat;
+    std::vector<int> compressionParams; // cv::imwrite params
+    int queueDepth = 0;
+    DropPolicy dropPolicy = DropPolicy::BLOCK;
+    bool isMjpegPassthrough = false;
+    DepthPreviewConfig depthPreview;
+    VideoEncoderConfig encoder;
+    TimecodeConfig timecode;
+    float segmentSeconds = 0;
+    int segmentMb = 0;
+    bool isStereo = false;              // IR left also takes IR right into one video
+};
+
 class ImageStreamManager : public StreamManager {
     public:
-        ImageStreamManager(std::shared_ptr<ob::Pipeline> pipe,
-                           std::shared_ptr<ob::Device> device,
-                           std::shared_ptr<ob::Config> config,
+        ImageStreamManager(std::shared_ptr<FrameSource> source,
                            OBSensorType sensorType,
                            const std::string& streamName,
                            const std::string& saveDir,
                            int profileIdx,
-                           bool isSaveVideo,
-                           bool isSaveImage,
-                           const std::string& containerFormat,
-                           int codec,
-                           const std::string& imageFormat,
-                           std::vector<int> compressionParams);
+                           const ImageStreamConfig& config,
+                           std::shared_ptr<ChunkLogWriter> chunkLog = nullptr);
+        ~ImageStreamManager() override;
         nlohmann::json getMetadata() override;
-        void processFrameset(std::shared_ptr<ob::FrameSet> frameset) override;
+        void processFrameset(std::shared_ptr<SourceFrameSet> frameset) override;
+        void processFrame(std::shared_ptr<SourceFrame> frame) override;
         void close() override;
-        void processColorFrame(std::shared_ptr<ob::FrameSet> frameset);
-        void processDepthFrame(std::shared_ptr<ob::FrameSet> frameset);
-        void processIrFrame(std::shared_ptr<ob::FrameSet> frameset);
-        void setCameraParams(std::shared_ptr<ob::VideoStreamProfile> profile, bool isColor);
+        int getSegmentCount() override;
+        void processPreRoll(std::shared_ptr<SourceFrameSet> frameset) override;
+        void processColorFrame(std::shared_ptr<SourceFrame> colorFrame);
+        void processDepthFrame(std::shared_ptr<SourceFrame> depthFrame);
+        void processIrFrame(std::shared_ptr<SourceFrame> irFrame);
+        void setCameraParams(const VideoProfileInfo& profile, bool isColor);
+        // Encode images on a shared pool instead of this stream's worker
+        void setImageEncoderPool(std::shared_ptr<ImageEncoderPool> pool);
+        // Take image copies from a shared pool instead of the heap
+        void setBufferPool(std::shared_ptr<FrameBufferPool> pool);
+        // Shed work under load as the controller's ladder says
+        void setBackpressure(std::shared_ptr<BackpressureController> controller);
     private:
+        // One video file and its timecode sidecar
+        struct Segment {
+            int index = 0;
+            std::string videoName;
+            std::string timecodeName;
+            std::string timecodeIndexName;
+            std::string frameIndexName;
+            FrameIndexWriter frameIndex;  // declared first: the writers below report into it
+            cv::VideoWriter videoWriter;
+            MkvWriter mkvWriter;    // compressed frames in passthrough mode
+            AvVideoWriter avWriter; // libavcodec encoders (e.g. lossless 16-bit depth)
+            TimecodeWriter timecodeWriter;
+            std::string errorMsg;
+            int frameCount = 0;
+            uint64_t firstTimeStamp = 0;
+            uint64_t lastTimeStamp = 0;
+            void release();
+            nlohmann::json getMetadata() const;
+        };
+
+        void workerLoop();
+        void reportLoad(int64_t latencyNs);
+        std::shared_ptr<SourceFrame> pickFrame(const SourceFrameSet& frameset);
+        void pairFrame(std::shared_ptr<SourceFrame> frame, bool isBacklog);
+        void queueFrame(std::shared_ptr<SourceFrame> frame, bool isBacklog);
+        std::unique_ptr<Segment> openSegment(int index);
+        void updateSegment(uint64_t timeStamp);
+        void indexFrame(const SourceFrame& frame);
+        bool isSegmentFull(uint64_t timeStamp);
+        void rollSegment();
+        void processMjpegFrame(std::shared_ptr<SourceFrame> colorFrame);
+        bool isVideoOpened();
+        void updateBytesWritten();
+        void writeVideo(const cv::Mat& mat, uint64_t timeStamp);
+        void writeImage(const std::string& imageName, const cv::Mat& mat, std::shared_ptr<SourceFrame> frame);
+        void writeChunkFrame(std::shared_ptr<SourceFrame> frame);
+
         bool isSaveVideo;
         bool isSaveImage;
-        std::shared_ptr<ob::StreamProfile> colorProfile;
-        ob::FormatConvertFilter filter;
+        cv::Mat bgrMat;  // reused color conversion output
+        DepthPreview depthPreview;
+        cv::Mat depthMat8;  // reused depth preview output
+        cv::Mat stereoMat;  // reused side-by-side IR pair
 
         std::string containerFormat;
         int codec;
         std::string imageFormat;
         std::vector<int> compressionParams;
 
-        std::string videoName;
+        std::string videoName;  // first segment, kept for readers of a single file
         std::string timecodeName;
-        cv::VideoWriter videoWriter;
-        std::ofstream timecodeWriter;
+        std::string timecodeIndexName;
+        bool isColorVideo = false;
+        bool isMjpegPassthrough = false;
+        VideoEncoderConfig encoderConfig;
+        bool isAvVideo = false;
+        bool isRawDepthVideo = false;  // depth encoded as GRAY16 by a lossless encoder, not the preview
+        bool isStereo = false;  // IR left and right packed side by side
+        int videoWidth = 0;
+        nlohmann::json rightCamera;
+        size_t unpairedCount = 0;
+        // callback ingestion: left and right IR arrive separately and wait here for each other
+        std::mutex stereoMutex;
+        std::shared_ptr<SourceFrame> pendingLeft;
+        std::shared_ptr<SourceFrame> pendingRight;
+        VideoPixelFormat videoPixelFormat = VideoPixelFormat::GRAY8;  // what the libav writer is opened with
+        TimecodeConfig timecodeConfig;
+        std::shared_ptr<ImageEncoderPool> imagePool;
+        int imageChannel = -1;
+        std::shared_ptr<FrameBufferPool> bufferPool;
         int count = 0;
+        std::vector<std::string> outputFiles;  // video and timecode files so far (worker thread)
+        uint64_t imageBytes = 0;               // images written on the worker thread
+        // single-file recording: frames go to the chunk log instead of videos and images
+        std::shared_ptr<ChunkLogWriter> chunkLog;
+        uint16_t chunkChannel = 0;
+        uint64_t bytesCheckTimeStamp = 0;
+
+        // load shedding, decided per frame on the worker thread
+        std::shared_ptr<BackpressureController> backpressure;
+        int backpressureStream = -1;
+        uint32_t degradeSteps = 0;        // steps this stream takes part in
+        uint32_t activeSteps = 0;         // in force for the current frame
+        bool isImageFrame = false;        // the current frame gets an image file
+        std::vector<int> degradedParams;  // compressionParams at the reduced JPEG quality
+        int decimateCount = 0;
+        std::atomic<uint64_t> skippedImages{0};
+        std::atomic<uint64_t> failedImages{0};  // written on the worker thread, without a pool
+        std::atomic<uint64_t> degradedImages{0};
+        std::atomic<uint64_t> decimatedFrames{0};
+
+        // the next segment is opened and the previous one released off the worker thread
+        float segmentSeconds = 0;
+        int segmentMb = 0;
+        bool isSegmented = false;
+        bool isRollFailed = false;
+        std::unique_ptr<Segment> segment;
+        std::future<std::unique_ptr<Segment>> nextSegment;
+        std::future<void> closingSegment;
+        uint64_t sizeCheckTimeStamp = 0;
+        std::mutex segmentMutex;
+        std::vector<nlohmann::json> segments;  // guarded by segmentMutex
+
+        // frames are handed from the capture thread to the worker thread
+        int queueDepth;
+        DropPolicy dropPolicy;
+        std::unique_ptr<FrameQueue<std::shared_ptr<SourceFrame>>> frameQueue;
+        std::thread worker;
 
         float fps;
         int width;
@@ -93,20 +243,43 @@ class ImageStreamManager : public StreamManager {
 
 class ImuStreamManager : public StreamManager {
     public:
-        ImuStreamManager(std::shared_ptr<ob::Pipeline> pipe,
-                         std::shared_ptr<ob::Device> device,
-                         std::shared_ptr<ob::Config> config,
+        ImuStreamManager(std::shared_ptr<FrameSource> source,
                          OBSensorType sensorType,
                          const std::string& streamName,
                          const std::string& saveDir,
-                         int profileIdx);
+                         int profileIdx,
+                         const std::string& imuFormat,
+                         int ringSize,
+                         float preRollSeconds,
+                         const FileWriterConfig& fileWriterConfig = FileWriterConfig(),
+                         std::shared_ptr<ChunkLogWriter> chunkLog = nullptr);
+        ~ImuStreamManager() override;
         nlohmann::json getMetadata() override;
-        void processFrameset(std::shared_ptr<ob::FrameSet> frameset) override;
+        void processFrameset(std::shared_ptr<SourceFrameSet> frameset) override;
         void close() override;
-        void imuCallback(std::shared_ptr<ob::Frame> frame);
+        void stopCapture() override;
+        void endPreRoll() override;
+        void imuCallback(const ImuSample& sample);
     private:
+        void writerLoop();
+
         std::string imuName;
-        std::ofstream imuWriter;
+        std::string imuFormat;  // "csv", "binary" or "chunklog"
+        FileWriter imuWriter;
+        std::shared_ptr<ChunkLogWriter> chunkLog;
+        uint16_t chunkChannel = 0;
+
+        // the sensor callback only pushes, the writer thread formats and writes in batches
+        std::unique_ptr<SpscRing<ImuSample>> ring;
+        std::thread writer;
+        std::atomic<bool> isWriting{false};
+        bool isImuStarted = false;
+        // pre-roll: samples stay in memory, trimmed to the window, until the trigger
+        std::atomic<bool> isHolding{false};
+        uint64_t holdWindowMs = 0;
+        uint64_t preRollSamples = 0;
+        uint64_t samplesWritten = 0;
+        uint64_t bytesWritten = 0;
 };
 
 #endif
@@ -0,0 +1,67 @@
+#ifndef STREAM_STATS_HPP
+#define STREAM_STATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// Latency histogram with fixed buckets. Recorded from one thread, read from any.
+class LatencyHistogram {
+    public:
+        static const int BUCKET_COUNT = 12;
+        LatencyHistogram();
+        void record(int64_t ns);
+        nlohmann::json toJson() const;
+        // Prometheus histogram lines: name_bucket{labels,le=...}, name_sum, name_count
+        void appendPrometheus(std::string& out, const std::string& name, const std::string& labels) const;
+    private:
+        std::atomic<uint64_t> buckets[BUCKET_COUNT];
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sumNs{0};
+        std::atomic<uint64_t> maxNs{0};
+};
+
+// Live counters of one stream. Each counter has a single writer thread and uses relaxed
+// atomics, so the exporter can read them at any time without stalling capture.
+class StreamStats {
+    public:
+        // Enables drop detection from timestamp gaps; 0 disables it
+        void setExpectedFps(float fps);
+
+        // capture thread
+        void onReceived(uint64_t timeStamp);
+        void onQueued(bool isDropped, size_t queueSize);
+        void onDropped();
+
+        // worker thread
+        void onWritten(int64_t latencyNs, uint64_t frames = 1);
+        void recordEncode(int64_t ns);
+        void setBytesWritten(uint64_t bytes);
+
+        nlohmann::json toJson() const;
+        // Prometheus text exposition of several streams, labelled by stream name
+        static std::string toPrometheus(const std::vector<std::pair<std::string, const StreamStats *>>& streams);
+    private:
+        std::atomic<float> expectedFps{0};
+        uint64_t lastTimeStamp = 0;    // capture thread only
+        std::chrono::steady_clock::time_point lastArrival;  // capture thread only
+        std::atomic<uint64_t> framesReceived{0};
+        std::atomic<uint64_t> framesWritten{0};
+        std::atomic<uint64_t> gapDrops{0};
+        std::atomic<uint64_t> queueDrops{0};
+        std::atomic<uint64_t> queueSize{0};
+        std::atomic<uint64_t> peakQueueSize{0};
+        std::atomic<uint64_t> bytesWritten{0};
+        LatencyHistogram encodeLatency;  // one video encoder call
+        LatencyHistogram writeLatency;   // capture hand-off to the frame fully processed
+        LatencyHistogram arrivalJitter;  // |host inter-arrival time - expected frame period|
+};
+
+// Replace path with content in one step, so readers (e.g. node_exporter textfiles) never see half a file
+bool writeFileAtomic(const std::string& path, const std::string& content);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef THREAD_PLACEMENT_HPP
+#define THREAD_PLACEMENT_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// CPU set and scheduling policy for one role of thread
+struct ThreadConfig {
+    std::vector<int> cpus;  // empty: any CPU
+    int fifoPriority = 0;   // 1-99 runs the thread SCHED_FIFO, 0 keeps the normal policy
+};
+
+// Roles: "capture" (frameset loop and pre-roll), "imu" (IMU drain), "imuCallback" (SDK callback),
+// "encoder" (per-stream video/timecode worker) and "imageEncoder" (image pool workers
+// and pre-roll compression).
+// Threads are started inside constructors, so the configs are process wide; DataRecorder sets them before its streams.
+void setThreadConfigs(const std::map<std::string, ThreadConfig>& configs);
+
+// Apply the role's config to the calling thread and record what it actually got under name
+void placeThread(const std::string& role, const std::string& name);
+
+// Effective placement of every thread placed so far, keyed by name
+nlohmann::json getThreadPlacement();
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef TIMECODE_WRITER_HPP
+#define TIMECODE_WRITER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "file_writer.hpp"
+
+struct TimecodeConfig {
+    bool isIndex = false;       // also write <stream>_timecode.idx
+    bool isFrameIndex = false;  // also write <stream>_frames.idx (frame_index.hpp)
+    int flushIntervalMs = 1000; // flush at least this often while frames arrive
+    FileWriterConfig fileWriter; // also used for <stream>_frames.idx
+};
+
+// <stream>_timecode.idx: this header, then one record per frame, so frame n is at
+// sizeof(header) + n * recordSize
+struct TimecodeIndexHeader {
+    char magic[6] = {'R', 'R', 'T', 'C', 'I', '\0'};
+    uint16_t version = 1;
+    uint32_t recordSize = 16;
+    uint32_t reserved = 0;
+};
+
+struct TimecodeIndexRecord {
+    uint64_t timeStampUs;
+    float valueScale;
+    uint32_t reserved;
+};
+static_assert(sizeof(TimecodeIndexHeader) == 16 && sizeof(TimecodeIndexRecord) == 16, "timecode index layout changed");
+
+// Buffered timecode text (and optional binary index). Lines are formatted with
+// std::to_chars into the file writer's block and made visible on a time budget.
+class TimecodeWriter {
+    public:
+        TimecodeWriter() = default;
+        ~TimecodeWriter();
+        bool open(const std::string& fileName, const std::string& header, const std::string& indexName,
+                  const TimecodeConfig& config);
+        bool isOpened() const;
+        void write(uint64_t timeStamp, uint64_t timeStampUs);
+        void write(uint64_t timeStamp, uint64_t timeStampUs, float valueScale);
+        void flush();
+        void close();
+        // Write latency of the text and index files
+        nlohmann::json getMetadata() const;
+    private:
+        void append(uint64_t timeStamp, uint64_t timeStampUs, float valueScale, bool hasValueScale);
+
+        FileWriter textWriter;
+        FileWriter indexWriter;
+        std::chrono::steady_clock::time_point lastFlush;
+        std::chrono::milliseconds flushInterval{1000};
+        // value scale rarely changes, so its text is cached
+        float cachedScale = 0;
+        std::string cachedScaleText;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Hot-path tracing. Spans go into a fixed ring per thread (no locks after the thread's first span)
+// and are written out as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+// When tracing is off a span costs one relaxed load.
+
+extern std::atomic<bool> traceEnabled;
+
+inline bool isTraceEnabled() {
+    return traceEnabled.load(std::memory_order_relaxed);
+}
+
+void setTraceEnabled(bool isEnabled);
+// Events kept per thread; applies to threads that have not traced yet
+void setTraceBufferSize(size_t events);
+int64_t traceNow();
+// name must be a string literal (or otherwise outlive the trace)
+void traceEvent(const char *name, int64_t startNs, int64_t durationNs);
+
+// Write the spans recorded since the previous dump
+bool writeChromeTrace(const std::string& path);
+
+// SIGUSR1 asks for a dump, SIGUSR2 toggles tracing. The handler only sets flags;
+// the capture loop picks the dump request up with takeTraceDumpRequest().
+void installTraceSignals();
+bool takeTraceDumpRequest();
+
+class TraceSpan {
+    public:
+        explicit TraceSpan(const char *name) : name(name) {
+            if (isTraceEnabled()) {
+                this->start = traceNow();
+            }
+        }
+        ~TraceSpan() {
+            if (this->start != 0) {
+                traceEvent(this->name, this->start, traceNow() - this->start);
+            }
+        }
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+    private:
+        const char *name;
+        int64_t start = 0;
+};
+
+#endif
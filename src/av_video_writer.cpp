@@ -0,0 +1,302 @@
+#include <iostream>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+#include <libswscale/swscale.h>
+}
+#include "av_video_writer.hpp"
+
+namespace {
+
+AVPixelFormat toAvPixelFormat(VideoPixelFormat format) {
+    switch (format) {
+        case VideoPixelFormat::GRAY8:
+            return AV_PIX_FMT_GRAY8;
+        case VideoPixelFormat::GRAY16:
+            return AV_PIX_FMT_GRAY16LE;
+        case VideoPixelFormat::YUYV422:
+            return AV_PIX_FMT_YUYV422;
+        case VideoPixelFormat::UYVY422:
+            return AV_PIX_FMT_UYVY422;
+        case VideoPixelFormat::NV12:
+            return AV_PIX_FMT_NV12;
+        default:
+            return AV_PIX_FMT_BGR24;
+    }
+}
+
+std::string avErrorString(int err) {
+    char buf[AV_ERROR_MAX_STRING_SIZE] = {0};
+    av_strerror(err, buf, sizeof(buf));
+    return buf;
+}
+
+}
+
+std::string videoPixelFormatName(VideoPixelFormat format) {
+    return av_get_pix_fmt_name(toAvPixelFormat(format));
+}
+
+AvVideoWriter::~AvVideoWriter() {
+    release();
+}
+
+bool AvVideoWriter::fail(const std::string& what, int err) {
+    this->errorMsg = what;
+    if (err < 0) {
+        this->errorMsg += ": " + avErrorString(err);
+    }
+    std::cerr << "Error: " << this->errorMsg << std::endl;
+    release();
+    return false;
+}
+
+bool AvVideoWriter::open(const std::string& fileName, const std::string& codecName, int width, int height,
+                         VideoPixelFormat pixelFormat, float fps, int threads,
+                         const std::map<std::string, std::string>& codecOptions,
+                         const std::string& encoderPixelFormat) {
+    release();
+    this->errorMsg = "";
+    this->hasFirstTimeStamp = false;
+    this->lastPts = -1;
+    this->inputFormat = pixelFormat;
+
+    const AVCodec *codec = avcodec_find_encoder_by_name(codecName.c_str());
+    if (!codec) {
+        return fail("Encoder not found: " + codecName, 0);
+    }
+    // Feed the requested format, else the input as it is when the encoder takes it, else
+    // yuv420p for lossy encoders (the closest fit to BGR24 is 4:4:4, which few players
+    // decode), else the closest format the encoder lists
+    AVPixelFormat inputAvFormat = toAvPixelFormat(pixelFormat);
+    auto isListed = [codec](AVPixelFormat format) {
+        bool isListed = codec->pix_fmts == nullptr;
+        for (const AVPixelFormat *p = codec->pix_fmts; p && *p != AV_PIX_FMT_NONE; p++) {
+            isListed |= *p == format;
+        }
+        return isListed;
+    };
+    AVPixelFormat avFormat = inputAvFormat;
+    if (!encoderPixelFormat.empty()) {
+        avFormat = av_get_pix_fmt(encoderPixelFormat.c_str());
+        if (avFormat == AV_PIX_FMT_NONE || !isListed(avFormat)) {
+            return fail(codecName + " does not accept pixel format " + encoderPixelFormat, 0);
+        }
+    } else if (!isListed(inputAvFormat)) {
+        const AVCodecDescriptor *descriptor = avcodec_descriptor_get(codec->id);
+        bool isLossy = descriptor && (descriptor->props & AV_CODEC_PROP_LOSSY);
+        if (isLossy && isListed(AV_PIX_FMT_YUV420P)) {
+            avFormat = AV_PIX_FMT_YUV420P;
+        } else {
+            avFormat = avcodec_find_best_pix_fmt_of_list(codec->pix_fmts, inputAvFormat, 0, nullptr);
+        }
+        if (avFormat == AV_PIX_FMT_NONE) {
+            return fail(codecName + " does not accept " + av_get_pix_fmt_name(inputAvFormat), 0);
+        }
+    }
+    if (avFormat != inputAvFormat) {
+        std::cout << codecName << ": converting " << av_get_pix_fmt_name(inputAvFormat) << " to " << av_get_pix_fmt_name(avFormat) << std::endl;
+    }
+    this->encoderPixelFormat = av_get_pix_fmt_name(avFormat);
+
+    int err = avformat_alloc_output_context2(&this->formatContext, nullptr, nullptr, fileName.c_str());
+    if (err < 0 || !this->formatContext) {
+        return fail("Failed to create container for " + fileName, err);
+    }
+    this->stream = avformat_new_stream(this->formatContext, nullptr);
+    this->codecContext = avcodec_alloc_context3(codec);
+    if (!this->stream || !this->codecContext) {
+        return fail("Failed to allocate encoder", AVERROR(ENOMEM));
+    }
+
+    // Timestamps are in ms, matching the timecode file
+    this->codecContext->width = width;
+    this->codecContext->height = height;
+    this->codecContext->pix_fmt = avFormat;
+    this->codecContext->time_base = AVRational{1, 1000};
+    this->codecContext->framerate = AVRational{(int)(fps * 1000 + 0.5f), 1000};
+    this->codecContext->thread_count = threads;
+    this->codecContext->thread_type = FF_THREAD_SLICE | FF_THREAD_FRAME;
+    if (this->formatContext->oformat->flags & AVFMT_GLOBALHEADER) {
+        this->codecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    this->stream->time_base = this->codecContext->time_base;
+
+    AVDictionary *options = nullptr;
+    for (const auto& option : codecOptions) {
+        av_dict_set(&options, option.first.c_str(), option.second.c_str(), 0);
+    }
+    err = avcodec_open2(this->codecContext, codec, &options);
+    // options left in the dictionary were not recognised by this encoder
+    AVDictionaryEntry *unused = nullptr;
+    while ((unused = av_dict_get(options, "", unused, AV_DICT_IGNORE_SUFFIX))) {
+        std::cerr << "Warning: " << codecName << " ignores option " << unused->key << "=" << unused->value << std::endl;
+    }
+    av_dict_free(&options);
+    if (err < 0) {
+        return fail("Failed to open encoder " + codecName, err);
+    }
+    err = avcodec_parameters_from_context(this->stream->codecpar, this->codecContext);
+    if (err < 0) {
+        return fail("Failed to copy encoder parameters", err);
+    }
+
+    if (!(this->formatContext->oformat->flags & AVFMT_NOFILE)) {
+        err = avio_open(&this->formatContext->pb, fileName.c_str(), AVIO_FLAG_WRITE);
+        if (err < 0) {
+            return fail("Failed to open " + fileName, err);
+        }
+    }
+    err = avformat_write_header(this->formatContext, nullptr);
+    if (err < 0) {
+        return fail("Failed to write header to " + fileName, err);
+    }
+
+    this->frame = av_frame_alloc();
+    this->packet = av_packet_alloc();
+    if (!this->frame || !this->packet) {
+        return fail("Failed to allocate frame", AVERROR(ENOMEM));
+    }
+    this->frame->format = avFormat;
+    this->frame->width = width;
+    this->frame->height = height;
+    err = av_frame_get_buffer(this->frame, 0);
+    if (err < 0) {
+        return fail("Failed to allocate frame buffer", err);
+    }
+    return true;
+}
+
+bool AvVideoWriter::isOpened() const {
+    return this->frame != nullptr;
+}
+
+std::string AvVideoWriter::getError() const {
+    return this->errorMsg;
+}
+
+std::string AvVideoWriter::getEncoderPixelFormat() const {
+    return this->encoderPixelFormat;
+}
+
+bool AvVideoWriter::write(const uint8_t *data, int stride, uint64_t timeStamp) {
+    return write(data, stride, this->inputFormat, timeStamp);
+}
+
+bool AvVideoWriter::write(const uint8_t *data, int stride, VideoPixelFormat format, uint64_t timeStamp) {
+    if (!isOpened()) {
+        return false;
+    }
+    if (!this->hasFirstTimeStamp) {
+        this->firstTimeStamp = timeStamp;
+        this->hasFirstTimeStamp = true;
+    }
+    // PTS must increase strictly, duplicated timestamps are nudged by 1 ms
+    int64_t pts = timeStamp > this->firstTimeStamp ? (int64_t)(timeStamp - this->firstTimeStamp) : 0;
+    if (pts <= this->lastPts) {
+        pts = this->lastPts + 1;
+    }
+    this->lastPts = pts;
+
+    // The encoder may still reference the previous buffer
+    int err = av_frame_make_writable(this->frame);
+    if (err < 0) {
+        this->errorMsg = "Failed to make frame writable: " + avErrorString(err);
+        return false;
+    }
+    int width = this->frame->width;
+    int height = this->frame->height;
+    AVPixelFormat avFormat = toAvPixelFormat(format);
+    const uint8_t *planes[4] = {data, nullptr, nullptr, nullptr};
+    int strides[4] = {stride, 0, 0, 0};
+    if (avFormat == AV_PIX_FMT_NV12) {
+        planes[1] = data + (size_t)stride * height;
+        strides[1] = stride;
+    }
+    if (avFormat == this->codecContext->pix_fmt) {
+        av_image_copy(this->frame->data, this->frame->linesize, planes, strides, avFormat, width, height);
+    } else {
+        // same size, so this is only the pixel format conversion
+        this->swsContext = sws_getCachedContext(this->swsContext, width, height, avFormat, width, height,
+                                                this->codecContext->pix_fmt, SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (!this->swsContext) {
+            this->errorMsg = std::string("Failed to convert from ") + av_get_pix_fmt_name(avFormat);
+            return false;
+        }
+        sws_scale(this->swsContext, planes, strides, 0, height, this->frame->data, this->frame->linesize);
+    }
+    this->frame->pts = pts;
+    if (this->frameIndex) {
+        this->ptsFrames[pts] = this->frameIndex->getLastFrame();
+    }
+    return encode(this->frame);
+}
+
+bool AvVideoWriter::encode(AVFrame *frame) {
+    int err = avcodec_send_frame(this->codecContext, frame);
+    if (err < 0) {
+        this->errorMsg = "Failed to send frame: " + avErrorString(err);
+        return false;
+    }
+    while (true) {
+        err = avcodec_receive_packet(this->codecContext, this->packet);
+        if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) {
+            return true;
+        } else if (err < 0) {
+            this->errorMsg = "Failed to encode frame: " + avErrorString(err);
+            return false;
+        }
+        // packets leave the encoder in decode order, the pts tells which frame they are
+        auto indexed = this->ptsFrames.find(this->packet->pts);
+        bool isIndexed = indexed != this->ptsFrames.end();
+        uint32_t frameNumber = isIndexed ? indexed->second : 0;
+        if (isIndexed) {
+            this->ptsFrames.erase(indexed);
+        }
+        bool isKey = (this->packet->flags & AV_PKT_FLAG_KEY) != 0;
+        uint32_t size = this->packet->size;
+        uint64_t offset = avio_tell(this->formatContext->pb);
+
+        av_packet_rescale_ts(this->packet, this->codecContext->time_base, this->stream->time_base);
+        this->packet->stream_index = this->stream->index;
+        err = av_interleaved_write_frame(this->formatContext, this->packet);
+        if (isIndexed && err >= 0) {
+            this->frameIndex->setPacket(frameNumber, offset, size, isKey);
+        }
+        if (err < 0) {
+            this->errorMsg = "Failed to write packet: " + avErrorString(err);
+            return false;
+        }
+    }
+}
+
+void AvVideoWriter::release() {
+    // Flush delayed packets and finish the container (index, duration)
+    if (this->frame && this->codecContext) {
+        encode(nullptr);
+        av_write_trailer(this->formatContext);
+    }
+    if (this->codecContext) {
+        avcodec_free_context(&this->codecContext);
+    }
+    if (this->formatContext) {
+        if (this->formatContext->pb && !(this->formatContext->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&this->formatContext->pb);
+        }
+        avformat_free_context(this->formatContext);
+        this->formatContext = nullptr;
+    }
+    av_frame_free(&this->frame);
+    av_packet_free(&this->packet);
+    sws_freeContext(this->swsContext);
+    this->swsContext = nullptr;
+    this->stream = nullptr;
+    this->frameIndex = nullptr;
+    this->ptsFrames.clear();
+}
+
+void AvVideoWriter::setFrameIndex(FrameIndexWriter *frameIndex) {
+    this->frameIndex = frameIndex;
+}
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include "backpressure.hpp"
+
+namespace {
+
+int64_t steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// weight of the newest frame in the latency average, a few frames of memory at 30 fps
+const double LATENCY_ALPHA = 0.2;
+
+}
+
+BackpressureController::BackpressureController(const BackpressureConfig& config) : config(config) {
+    this->startNs = steadyNs();
+    this->levelSinceNs = this->startNs;
+    this->levelNs.assign(this->config.ladder.size() + 1, 0);
+    this->config.decimation = std::max(1, this->config.decimation);
+}
+
+int BackpressureController::registerStream(const std::string& name) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Load load;
+    load.name = name;
+    this->loads.push_back(load);
+    return (int)this->loads.size() - 1;
+}
+
+uint32_t BackpressureController::getStreamSteps(const std::string& name) const {
+    auto it = this->config.streams.find(name);
+    if (it == this->config.streams.end()) {
+        return 0;
+    }
+    uint32_t steps = 0;
+    for (DegradeStep step : it->second) {
+        steps |= step;
+    }
+    return steps;
+}
+
+uint32_t BackpressureController::getActiveSteps(uint32_t streamSteps) const {
+    int level = this->level.load(std::memory_order_relaxed);
+    uint32_t active = 0;
+    for (int i = 0; i < level; i++) {
+        active |= this->config.ladder[i];
+    }
+    return active & streamSteps;
+}
+
+const BackpressureConfig& BackpressureController::getConfig() const {
+    return this->config;
+}
+
+void BackpressureController::report(int stream, float queueFill, int64_t latencyNs) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (stream < 0 || stream >= (int)this->loads.size()) {
+        return;
+    }
+    Load& load = this->loads[stream];
+    load.queueFill = queueFill;
+    load.latencyMs += LATENCY_ALPHA * (latencyNs / 1e6 - load.latencyMs);
+
+    // overloaded if any stream is, calm only if all are; in between holds the level
+    bool isOver = false;
+    bool isCalm = true;
+    const Load *worst = &load;
+    for (const Load& other : this->loads) {
+        bool isOtherOver = other.queueFill >= this->config.queueHigh || other.latencyMs >= this->config.latencyHighMs;
+        if (isOtherOver && !isOver) {
+            worst = &other;
+        }
+        isOver = isOver || isOtherOver;
+        isCalm = isCalm && other.queueFill <= this->config.queueLow && other.latencyMs <= this->config.latencyLowMs;
+    }
+
+    int64_t nowNs = steadyNs();
+    int level = this->level.load(std::memory_order_relaxed);
+    if (isOver) {
+        this->calmSinceNs = 0;
+        if (this->overSinceNs == 0) {
+            this->overSinceNs = nowNs;
+        } else if (nowNs - this->overSinceNs >= (int64_t)this->config.escalateMs * 1000000 && level < (int)this->config.ladder.size()) {
+            changeLevel(level + 1, nowNs, *worst);
+            this->overSinceNs = nowNs;
+        }
+    } else if (isCalm) {
+        this->overSinceNs = 0;
+        if (this->calmSinceNs == 0) {
+            this->calmSinceNs = nowNs;
+        } else if (nowNs - this->calmSinceNs >= (int64_t)this->config.recoverMs * 1000000 && level > 0) {
+            changeLevel(level - 1, nowNs, *worst);
+            this->calmSinceNs = nowNs;
+        }
+    } else {
+        this->overSinceNs = 0;
+        this->calmSinceNs = 0;
+    }
+}
+
+// Called with the mutex held
+void BackpressureController::changeLevel(int level, int64_t nowNs, const Load& worst) {
+    int from = this->level.load(std::memory_order_relaxed);
+    this->levelNs[from] += nowNs - this->levelSinceNs;
+    this->levelSinceNs = nowNs;
+    this->level.store(level, std::memory_order_relaxed);
+    this->maxLevel = std::max(this->maxLevel, level);
+
+    bool isUp = level > from;
+    DegradeStep step = this->config.ladder[isUp ? from : level];
+    nlohmann::json transition;
+    transition["timeMs"] = (nowNs - this->startNs) / 1000000;
+    transition["unixMs"] = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    transition["from"] = from;
+    transition["to"] = level;
+    transition["step"] = degradeStepName(step);
+    transition["action"] = isUp ? "apply" : "restore";
+    transition["stream"] = worst.name;
+    transition["queueFill"] = worst.queueFill;
+    transition["latencyMs"] = worst.latencyMs;
+    this->transitions.push_back(transition);
+
+    if (isUp) {
+        std::cerr << "[WARN] Backpressure: " << degradeStepName(step) << " applied (level " << level << "), " << worst.name
+                  << " queue " << (int)(worst.queueFill * 100) << "%, latency " << (int)worst.latencyMs << " ms" << std::endl;
+    } else {
+        std::cout << "[INFO] Backpressure: " << degradeStepName(step) << " restored (level " << level << ")" << std::endl;
+    }
+}
+
+nlohmann::json BackpressureController::getMetadata() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    nlohmann::json j;
+    std::vector<std::string> ladder;
+    for (DegradeStep step : this->config.ladder) {
+        ladder.push_back(degradeStepName(step));
+    }
+    j["ladder"] = ladder;
+    for (const auto& item : this->config.streams) {
+        std::vector<std::string> steps;
+        for (DegradeStep step : item.second) {
+            steps.push_back(degradeStepName(step));
+        }
+        j["streams"][item.first] = steps;
+    }
+    j["queueHigh"] = this->config.queueHigh;
+    j["queueLow"] = this->config.queueLow;
+    j["latencyHighMs"] = this->config.latencyHighMs;
+    j["latencyLowMs"] = this->config.latencyLowMs;
+    j["escalateMs"] = this->config.escalateMs;
+    j["recoverMs"] = this->config.recoverMs;
+    j["jpegQuality"] = this->config.jpegQuality;
+    j["decimation"] = this->config.decimation;
+
+    int level = this->level.load(std::memory_order_relaxed);
+    std::vector<double> levelSeconds;
+    for (int i = 0; i < (int)this->levelNs.size(); i++) {
+        int64_t ns = this->levelNs[i] + (i == level ? steadyNs() - this->levelSinceNs : 0);
+        levelSeconds.push_back(ns / 1e9);
+    }
+    j["level"] = level;
+    j["maxLevel"] = this->maxLevel;
+    j["levelSeconds"] = levelSeconds;
+    j["transitions"] = this->transitions;
+    return j;
+}
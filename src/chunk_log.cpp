@@ -0,0 +1,561 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include "chunk_log.hpp"
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+namespace {
+
+// sealed chunks waiting for the writer thread before write() blocks
+const size_t MAX_PENDING_BLOCKS = 4;
+// fast enough for the capture rates on the rover's ARM cores
+const int ZSTD_LEVEL = 1;
+
+void append(std::vector<uint8_t>& buffer, const void *data, size_t size) {
+    if (size > 0) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        buffer.insert(buffer.end(), bytes, bytes + size);
+    }
+}
+
+bool isAvailable(ChunkCompression compression) {
+    switch (compression) {
+#ifdef HAVE_ZSTD
+        case ChunkCompression::ZSTD:
+            return true;
+#endif
+#ifdef HAVE_LZ4
+        case ChunkCompression::LZ4:
+            return true;
+#endif
+        case ChunkCompression::NONE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+}
+
+ChunkCompression parseChunkCompression(const std::string& name) {
+    if (name == "zstd") {
+        return ChunkCompression::ZSTD;
+    } else if (name == "lz4") {
+        return ChunkCompression::LZ4;
+    }
+    return ChunkCompression::NONE;
+}
+
+std::string chunkCompressionName(ChunkCompression compression) {
+    switch (compression) {
+        case ChunkCompression::ZSTD:
+            return "zstd";
+        case ChunkCompression::LZ4:
+            return "lz4";
+        default:
+            return "none";
+    }
+}
+
+ChunkLogWriter::~ChunkLogWriter() {
+    close();
+}
+
+bool ChunkLogWriter::open(const std::string& path, ChunkCompression compression, size_t chunkBytes,
+                          const FileWriterConfig& fileWriterConfig) {
+    if (!isAvailable(compression)) {
+        std::cerr << "[WARN] Chunk log: built without " << chunkCompressionName(compression) << ", chunks are stored uncompressed" << std::endl;
+        compression = ChunkCompression::NONE;
+    }
+    if (!this->file.open(path, fileWriterConfig)) {
+        return false;
+    }
+    ChunkLogFileHeader header;
+    this->file.write(&header, sizeof(header));
+    this->offset = sizeof(header);
+    this->path = path;
+    this->compression = compression;
+    this->chunkBytes = std::max<size_t>(chunkBytes, 64 << 10);
+    this->chunk.reserve(this->chunkBytes + (1 << 20));
+#ifdef HAVE_ZSTD
+    if (compression == ChunkCompression::ZSTD) {
+        this->compressContext = ZSTD_createCCtx();
+    }
+#endif
+    this->isOpen = true;
+    this->writer = std::thread(&ChunkLogWriter::writerLoop, this);
+    return true;
+}
+
+bool ChunkLogWriter::isOpened() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->isOpen;
+}
+
+uint16_t ChunkLogWriter::addChannel(const std::string& name, const std::string& encoding, const nlohmann::json& info) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    uint16_t id = (uint16_t)this->channels.size();
+    Channel channel;
+    channel.name = name;
+    channel.encoding = encoding;
+    channel.info = info;
+    this->channels.push_back(channel);
+
+    // written ahead of any chunk that can hold its records
+    nlohmann::json j;
+    j["id"] = id;
+    j["name"] = name;
+    j["encoding"] = encoding;
+    j["info"] = info;
+    std::string text = j.dump();
+    Block block;
+    block.tag = CHUNK_LOG_CHANNEL;
+    append(block.body, text.data(), text.size());
+    this->pending.push_back(std::move(block));
+    this->cv.notify_all();
+    return id;
+}
+
+void ChunkLogWriter::write(uint16_t channel, uint64_t timeStampUs, const void *data, size_t size) {
+    write(channel, timeStampUs, data, size, nullptr, 0);
+}
+
+void ChunkLogWriter::write(uint16_t channel, uint64_t timeStampUs, const void *head, size_t headSize, const void *data, size_t size) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (!this->isOpen || this->isClosing || channel >= this->channels.size()) {
+        return;
+    }
+    ChunkLogRecordHeader record;
+    record.channel = channel;
+    record.reserved = 0;
+    record.size = (uint32_t)(headSize + size);
+    record.timeStampUs = timeStampUs;
+    append(this->chunk, &record, sizeof(record));
+    append(this->chunk, head, headSize);
+    append(this->chunk, data, size);
+
+    // records of different streams are not in time order within a chunk, so the range covers them all
+    if (this->chunkHeader.recordCount == 0 || timeStampUs < this->chunkHeader.startUs) {
+        this->chunkHeader.startUs = timeStampUs;
+    }
+    this->chunkHeader.endUs = std::max(this->chunkHeader.endUs, timeStampUs);
+    this->chunkHeader.recordCount++;
+    Channel& stats = this->channels[channel];
+    if (stats.recordCount == 0) {
+        stats.firstUs = timeStampUs;
+    }
+    stats.recordCount++;
+    stats.bytes += record.size;
+    stats.lastUs = std::max(stats.lastUs, timeStampUs);
+    this->lastUs = std::max(this->lastUs, timeStampUs);
+    this->rawBytes += sizeof(record) + record.size;
+
+    if (this->chunk.size() >= this->chunkBytes) {
+        // the card is behind: hold the producer instead of growing without bound
+        if (this->pending.size() >= MAX_PENDING_BLOCKS) {
+            this->blockedCount++;
+            this->cv.wait(lock, [this] { return this->pending.size() < MAX_PENDING_BLOCKS || this->isClosing; });
+            // close() has sealed the chunk with this record in it
+            if (this->isClosing) {
+                return;
+            }
+        }
+        sealChunk();
+    }
+}
+
+uint64_t ChunkLogWriter::getLastTimeStampUs() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->lastUs;
+}
+
+// mutex held
+void ChunkLogWriter::sealChunk() {
+    if (this->chunk.empty()) {
+        return;
+    }
+    Block block;
+    block.tag = CHUNK_LOG_CHUNK;
+    block.body.swap(this->chunk);
+    block.chunk = this->chunkHeader;
+    block.chunk.rawSize = block.body.size();
+    this->pending.push_back(std::move(block));
+    this->chunk.reserve(this->chunkBytes + (1 << 20));
+    this->chunkHeader = {};
+    this->cv.notify_all();
+}
+
+void ChunkLogWriter::writerLoop() {
+    while (true) {
+        Block block;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->cv.wait(lock, [this] { return !this->pending.empty() || this->isClosing; });
+            if (this->pending.empty()) {
+                break;
+            }
+            block = std::move(this->pending.front());
+            this->pending.pop_front();
+        }
+        this->cv.notify_all();
+        writeBlock(block);
+    }
+}
+
+// Writer thread: compression and the file write happen off the producers' threads
+void ChunkLogWriter::writeBlock(Block& block) {
+    if (this->isWriteFailed) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->droppedCount++;
+        return;
+    }
+    ChunkLogBlockHeader header;
+    header.tag = block.tag;
+    uint64_t blockOffset = this->offset;
+    if (block.tag == CHUNK_LOG_CHUNK) {
+        std::vector<uint8_t> body;
+        body.resize(sizeof(ChunkLogChunkHeader));
+        block.chunk.compression = (uint32_t)this->compression;
+        // chunks that do not shrink are kept as they are
+        if (this->compression == ChunkCompression::NONE || !compress(block.body, body)) {
+            block.chunk.compression = (uint32_t)ChunkCompression::NONE;
+            body.resize(sizeof(ChunkLogChunkHeader));
+            append(body, block.body.data(), block.body.size());
+        }
+        std::memcpy(body.data(), &block.chunk, sizeof(ChunkLogChunkHeader));
+        block.body.swap(body);
+    }
+    header.length = block.body.size();
+    bool isOk = this->file.write(&header, sizeof(header)) && this->file.write(block.body.data(), block.body.size());
+    // a file cut short keeps every chunk written so far
+    if (isOk && block.tag == CHUNK_LOG_CHUNK) {
+        isOk = this->file.flush();
+    }
+    if (!isOk) {
+        // the file ends with what was indexed; the reader recovers it like a log never closed
+        std::cerr << "[WARN] Chunk log: " << this->file.errorMsg << ", later chunks are dropped" << std::endl;
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->isWriteFailed = true;
+        this->droppedCount++;
+        return;
+    }
+    this->offset += sizeof(header) + block.body.size();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->bytesWritten = this->offset;
+    if (block.tag == CHUNK_LOG_CHUNK) {
+        ChunkLogIndexEntry entry;
+        entry.offset = blockOffset;
+        entry.length = sizeof(header) + block.body.size();
+        entry.startUs = block.chunk.startUs;
+        entry.endUs = block.chunk.endUs;
+        entry.recordCount = block.chunk.recordCount;
+        entry.compression = block.chunk.compression;
+        this->index.push_back(entry);
+    }
+}
+
+// Appends the compressed records to out; false if the codec failed or did not help
+bool ChunkLogWriter::compress(const std::vector<uint8_t>& raw, std::vector<uint8_t>& out) {
+    size_t start = out.size();
+#ifdef HAVE_ZSTD
+    if (this->compression == ChunkCompression::ZSTD) {
+        out.resize(start + ZSTD_compressBound(raw.size()));
+        size_t n = ZSTD_compressCCtx((ZSTD_CCtx *)this->compressContext, out.data() + start, out.size() - start,
+                                     raw.data(), raw.size(), ZSTD_LEVEL);
+        if (ZSTD_isError(n) || n >= raw.size()) {
+            return false;
+        }
+        out.resize(start + n);
+        return true;
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (this->compression == ChunkCompression::LZ4) {
+        out.resize(start + LZ4_compressBound((int)raw.size()));
+        int n = LZ4_compress_default((const char *)raw.data(), (char *)out.data() + start, (int)raw.size(), (int)(out.size() - start));
+        if (n <= 0 || (size_t)n >= raw.size()) {
+            return false;
+        }
+        out.resize(start + n);
+        return true;
+    }
+#endif
+    return false;
+}
+
+void ChunkLogWriter::close() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->isOpen || this->isClosing) {
+            return;
+        }
+        sealChunk();
+        this->isClosing = true;
+    }
+    this->cv.notify_all();
+    this->writer.join();
+
+    // index and summary sit together right before the trailer, so one read gets both.
+    // After a write error there is neither: the log is read like one that was never closed.
+    if (!this->isWriteFailed) {
+        ChunkLogTrailer trailer;
+        trailer.indexOffset = this->offset;
+        Block indexBlock;
+        indexBlock.tag = CHUNK_LOG_INDEX;
+        append(indexBlock.body, this->index.data(), this->index.size() * sizeof(ChunkLogIndexEntry));
+        writeBlock(indexBlock);
+        Block summaryBlock;
+        summaryBlock.tag = CHUNK_LOG_SUMMARY;
+        std::string summary = getMetadata().dump();
+        append(summaryBlock.body, summary.data(), summary.size());
+        writeBlock(summaryBlock);
+        trailer.trailerOffset = this->offset;
+        if (!this->isWriteFailed && this->file.write(&trailer, sizeof(trailer))) {
+            this->offset += sizeof(trailer);
+        }
+    }
+    this->file.close();
+
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx((ZSTD_CCtx *)this->compressContext);
+    this->compressContext = nullptr;
+#endif
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->bytesWritten = this->offset;
+    this->isOpen = false;
+}
+
+std::string ChunkLogWriter::getPath() const {
+    return this->path;
+}
+
+uint64_t ChunkLogWriter::getBytesWritten() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->bytesWritten;
+}
+
+nlohmann::json ChunkLogWriter::getMetadata() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    nlohmann::json j;
+    j["path"] = this->path;
+    j["compression"] = chunkCompressionName(this->compression);
+    j["chunkBytes"] = this->chunkBytes;
+    j["chunkCount"] = this->index.size();
+    j["rawBytes"] = this->rawBytes;
+    j["bytesWritten"] = this->bytesWritten;
+    j["blockedWrites"] = this->blockedCount;
+    j["writeFailed"] = this->isWriteFailed;
+    j["droppedBlocks"] = this->droppedCount;
+    j["fileWriter"] = this->file.getMetadata();
+    nlohmann::json channels = nlohmann::json::array();
+    for (size_t i = 0; i < this->channels.size(); i++) {
+        const Channel& channel = this->channels[i];
+        nlohmann::json c;
+        c["id"] = i;
+        c["name"] = channel.name;
+        c["encoding"] = channel.encoding;
+        c["info"] = channel.info;
+        c["recordCount"] = channel.recordCount;
+        c["bytes"] = channel.bytes;
+        c["firstUs"] = channel.firstUs;
+        c["lastUs"] = channel.lastUs;
+        channels.push_back(c);
+    }
+    j["channels"] = channels;
+    return j;
+}
+
+bool ChunkLogReader::open(const std::string& path) {
+    this->ifs.open(path, std::ios::binary);
+    if (!this->ifs) {
+        this->errorMsg = "Failed to open file: " + path;
+        return false;
+    }
+    ChunkLogFileHeader header;
+    ChunkLogFileHeader expected;
+    if (!this->ifs.read((char *)&header, sizeof(header)) || std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0) {
+        this->errorMsg = "Not a chunk log: " + path;
+        return false;
+    }
+    if (readTrailer()) {
+        return true;
+    }
+    // not closed (e.g. power loss): recover what was completely written
+    this->ifs.clear();
+    return scanBlocks();
+}
+
+bool ChunkLogReader::readTrailer() {
+    this->ifs.seekg(0, std::ios::end);
+    uint64_t fileSize = this->ifs.tellg();
+    if (fileSize < sizeof(ChunkLogFileHeader) + sizeof(ChunkLogTrailer)) {
+        return false;
+    }
+    ChunkLogTrailer trailer;
+    ChunkLogTrailer expected;
+    this->ifs.seekg(fileSize - sizeof(trailer));
+    if (!this->ifs.read((char *)&trailer, sizeof(trailer)) || std::memcmp(trailer.magic, expected.magic, sizeof(trailer.magic)) != 0 ||
+        trailer.trailerOffset != fileSize - sizeof(trailer) || trailer.indexOffset >= trailer.trailerOffset) {
+        return false;
+    }
+
+    std::vector<uint8_t> tail(trailer.trailerOffset - trailer.indexOffset);
+    this->ifs.seekg(trailer.indexOffset);
+    if (!this->ifs.read((char *)tail.data(), tail.size())) {
+        return false;
+    }
+    ChunkLogBlockHeader indexHeader;
+    std::memcpy(&indexHeader, tail.data(), sizeof(indexHeader));
+    size_t summaryAt = sizeof(indexHeader) + indexHeader.length;
+    if (indexHeader.tag != CHUNK_LOG_INDEX || summaryAt + sizeof(ChunkLogBlockHeader) > tail.size()) {
+        return false;
+    }
+    ChunkLogBlockHeader summaryHeader;
+    std::memcpy(&summaryHeader, tail.data() + summaryAt, sizeof(summaryHeader));
+    if (summaryHeader.tag != CHUNK_LOG_SUMMARY || summaryAt + sizeof(summaryHeader) + summaryHeader.length > tail.size()) {
+        return false;
+    }
+    this->chunks.resize(indexHeader.length / sizeof(ChunkLogIndexEntry));
+    std::memcpy(this->chunks.data(), tail.data() + sizeof(indexHeader), this->chunks.size() * sizeof(ChunkLogIndexEntry));
+    const char *summaryText = (const char *)tail.data() + summaryAt + sizeof(summaryHeader);
+    this->summary = nlohmann::json::parse(summaryText, summaryText + summaryHeader.length, nullptr, false);
+    if (this->summary.is_discarded()) {
+        this->summary = nlohmann::json();
+        return false;
+    }
+    this->channels.clear();
+    for (auto& channel : this->summary.value("channels", nlohmann::json::array())) {
+        this->channels.push_back(channel);
+    }
+    return true;
+}
+
+bool ChunkLogReader::scanBlocks() {
+    this->ifs.seekg(0, std::ios::end);
+    uint64_t fileSize = this->ifs.tellg();
+    uint64_t offset = sizeof(ChunkLogFileHeader);
+    this->chunks.clear();
+    this->channels.clear();
+    ChunkLogBlockHeader header;
+    while (offset + sizeof(header) <= fileSize) {
+        this->ifs.seekg(offset);
+        if (!this->ifs.read((char *)&header, sizeof(header)) || offset + sizeof(header) + header.length > fileSize) {
+            break;
+        }
+        if (header.tag == CHUNK_LOG_CHANNEL) {
+            std::string text(header.length, '\0');
+            this->ifs.read(&text[0], text.size());
+            auto channel = nlohmann::json::parse(text, nullptr, false);
+            if (!channel.is_discarded()) {
+                this->channels.push_back(channel);
+            }
+        } else if (header.tag == CHUNK_LOG_CHUNK) {
+            ChunkLogChunkHeader chunk;
+            if (header.length < sizeof(chunk) || !this->ifs.read((char *)&chunk, sizeof(chunk))) {
+                break;
+            }
+            ChunkLogIndexEntry entry;
+            entry.offset = offset;
+            entry.length = sizeof(header) + header.length;
+            entry.startUs = chunk.startUs;
+            entry.endUs = chunk.endUs;
+            entry.recordCount = chunk.recordCount;
+            entry.compression = chunk.compression;
+            this->chunks.push_back(entry);
+        } else if (header.tag != CHUNK_LOG_INDEX && header.tag != CHUNK_LOG_SUMMARY) {
+            break;
+        }
+        offset += sizeof(header) + header.length;
+    }
+    this->ifs.clear();
+    return true;
+}
+
+const std::vector<nlohmann::json>& ChunkLogReader::getChannels() const {
+    return this->channels;
+}
+
+const std::vector<ChunkLogIndexEntry>& ChunkLogReader::getChunks() const {
+    return this->chunks;
+}
+
+const nlohmann::json& ChunkLogReader::getSummary() const {
+    return this->summary;
+}
+
+bool ChunkLogReader::readChunk(const ChunkLogIndexEntry& entry, std::vector<uint8_t>& raw) {
+    std::vector<uint8_t> block(entry.length);
+    this->ifs.seekg(entry.offset);
+    if (entry.length < sizeof(ChunkLogBlockHeader) + sizeof(ChunkLogChunkHeader) || !this->ifs.read((char *)block.data(), block.size())) {
+        this->errorMsg = "Failed to read chunk at " + std::to_string(entry.offset);
+        return false;
+    }
+    ChunkLogChunkHeader chunk;
+    std::memcpy(&chunk, block.data() + sizeof(ChunkLogBlockHeader), sizeof(chunk));
+    const uint8_t *data = block.data() + sizeof(ChunkLogBlockHeader) + sizeof(chunk);
+    size_t size = block.size() - sizeof(ChunkLogBlockHeader) - sizeof(chunk);
+    raw.resize(chunk.rawSize);
+    bool isOk = false;
+    switch ((ChunkCompression)chunk.compression) {
+        case ChunkCompression::NONE:
+            isOk = size == chunk.rawSize;
+            if (isOk) {
+                std::memcpy(raw.data(), data, size);
+            }
+            break;
+#ifdef HAVE_ZSTD
+        case ChunkCompression::ZSTD:
+            isOk = ZSTD_decompress(raw.data(), raw.size(), data, size) == chunk.rawSize;
+            break;
+#endif
+#ifdef HAVE_LZ4
+        case ChunkCompression::LZ4:
+            isOk = LZ4_decompress_safe((const char *)data, (char *)raw.data(), (int)size, (int)raw.size()) == (int)chunk.rawSize;
+            break;
+#endif
+        default:
+            break;
+    }
+    if (!isOk) {
+        this->errorMsg = "Failed to decompress chunk at " + std::to_string(entry.offset);
+    }
+    return isOk;
+}
+
+bool ChunkLogReader::read(uint64_t startUs, uint64_t endUs, const std::function<void(const ChunkLogRecord&)>& callback) {
+    std::vector<uint8_t> raw;
+    for (const auto& entry : this->chunks) {
+        if (entry.endUs < startUs || entry.startUs > endUs) {
+            continue;
+        }
+        if (!readChunk(entry, raw)) {
+            return false;
+        }
+        size_t pos = 0;
+        while (pos + sizeof(ChunkLogRecordHeader) <= raw.size()) {
+            ChunkLogRecordHeader header;
+            std::memcpy(&header, raw.data() + pos, sizeof(header));
+            pos += sizeof(header);
+            if (pos + header.size > raw.size()) {
+                this->errorMsg = "Truncated record in chunk at " + std::to_string(entry.offset);
+                return false;
+            }
+            if (header.timeStampUs >= startUs && header.timeStampUs <= endUs) {
+                ChunkLogRecord record;
+                record.channel = header.channel;
+                record.timeStampUs = header.timeStampUs;
+                record.data = raw.data() + pos;
+                record.size = header.size;
+                callback(record);
+            }
+            pos += header.size;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,240 @@
+#include "color_convert.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLOR_CONVERT_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define COLOR_CONVERT_NEON 1
+#endif
+
+// BT.601 limited range in 6-bit fixed point:
+//   R = 1.164 (Y - 16) + 1.596 (V - 128)
+//   G = 1.164 (Y - 16) - 0.391 (U - 128) - 0.813 (V - 128)
+//   B = 1.164 (Y - 16) + 2.018 (U - 128)
+// Every intermediate fits in int16, so the SIMD paths match the scalar one bit for bit.
+namespace {
+
+const int CY = 74;
+const int CRV = 102;
+const int CGU = 25;
+const int CGV = 52;
+const int CBU = 129;
+const int ROUND = 32;
+
+inline uint8_t clamp8(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : (uint8_t)v);
+}
+
+inline void storePixel(uint8_t *dst, int y, int d, int e) {
+    int yy = (y - 16) * CY + ROUND;
+    dst[0] = clamp8((yy + CBU * d) >> 6);
+    dst[1] = clamp8((yy - CGU * d - CGV * e) >> 6);
+    dst[2] = clamp8((yy + CRV * e) >> 6);
+}
+
+void convertRowScalar(const uint8_t *src, uint8_t *dst, int begin, int width, bool isUyvy) {
+    int yOff = isUyvy ? 1 : 0;
+    int uOff = isUyvy ? 0 : 1;
+    for (int x = begin; x < width; x += 2) {
+        const uint8_t *p = src + x * 2;
+        int d = p[uOff] - 128;
+        int e = p[uOff + 2] - 128;
+        storePixel(dst + x * 3, p[yOff], d, e);
+        storePixel(dst + x * 3 + 3, p[yOff + 2], d, e);
+    }
+}
+
+#ifdef COLOR_CONVERT_X86
+
+// 8 pixels of packed YUV in one register -> B, G, R as int16 lanes
+__attribute__((target("ssse3")))
+inline void yuvToBgr16(__m128i v, bool isUyvy, __m128i& b, __m128i& g, __m128i& r) {
+    const __m128i lowMask = _mm_set1_epi16(0x00ff);
+    __m128i y = isUyvy ? _mm_srli_epi16(v, 8) : _mm_and_si128(v, lowMask);
+    __m128i c = isUyvy ? _mm_and_si128(v, lowMask) : _mm_srli_epi16(v, 8);
+    // c = U0 V0 U1 V1 U2 V2 U3 V3 -> per-pixel U and V
+    __m128i u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xa0), 0xa0);
+    __m128i w = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xf5), 0xf5);
+    __m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    __m128i e = _mm_sub_epi16(w, _mm_set1_epi16(128));
+    __m128i yy = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)), _mm_set1_epi16(CY)), _mm_set1_epi16(ROUND));
+    r = _mm_srai_epi16(_mm_adds_epi16(yy, _mm_mullo_epi16(e, _mm_set1_epi16(CRV))), 6);
+    g = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(yy, _mm_mullo_epi16(d, _mm_set1_epi16(CGU))), _mm_mullo_epi16(e, _mm_set1_epi16(CGV))), 6);
+    b = _mm_srai_epi16(_mm_adds_epi16(yy, _mm_mullo_epi16(d, _mm_set1_epi16(CBU))), 6);
+}
+
+// Interleave 16 B, G and R bytes into 48 bytes of BGR
+__attribute__((target("ssse3")))
+inline void storeBgr48(uint8_t *dst, __m128i b, __m128i g, __m128i r) {
+    const __m128i b0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+    const __m128i g0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m128i r0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+    const __m128i g1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m128i r1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const __m128i r2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+    __m128i o0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b0), _mm_shuffle_epi8(g, g0)), _mm_shuffle_epi8(r, r0));
+    __m128i o1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b1), _mm_shuffle_epi8(g, g1)), _mm_shuffle_epi8(r, r1));
+    __m128i o2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b2), _mm_shuffle_epi8(g, g2)), _mm_shuffle_epi8(r, r2));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), o0);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), o1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 32), o2);
+}
+
+__attribute__((target("ssse3")))
+void convertRowSsse3(const uint8_t *src, uint8_t *dst, int width, bool isUyvy) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 2));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 2 + 16));
+        __m128i b0, g0, r0, b1, g1, r1;
+        yuvToBgr16(v0, isUyvy, b0, g0, r0);
+        yuvToBgr16(v1, isUyvy, b1, g1, r1);
+        storeBgr48(dst + x * 3, _mm_packus_epi16(b0, b1), _mm_packus_epi16(g0, g1), _mm_packus_epi16(r0, r1));
+    }
+    convertRowScalar(src, dst, x, width, isUyvy);
+}
+
+__attribute__((target("avx2")))
+inline void yuvToBgr16x16(__m256i v, bool isUyvy, __m256i& b, __m256i& g, __m256i& r) {
+    const __m256i lowMask = _mm256_set1_epi16(0x00ff);
+    __m256i y = isUyvy ? _mm256_srli_epi16(v, 8) : _mm256_and_si256(v, lowMask);
+    __m256i c = isUyvy ? _mm256_and_si256(v, lowMask) : _mm256_srli_epi16(v, 8);
+    __m256i u = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c, 0xa0), 0xa0);
+    __m256i w = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c, 0xf5), 0xf5);
+    __m256i d = _mm256_sub_epi16(u, _mm256_set1_epi16(128));
+    __m256i e = _mm256_sub_epi16(w, _mm256_set1_epi16(128));
+    __m256i yy = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(16)), _mm256_set1_epi16(CY)), _mm256_set1_epi16(ROUND));
+    r = _mm256_srai_epi16(_mm256_adds_epi16(yy, _mm256_mullo_epi16(e, _mm256_set1_epi16(CRV))), 6);
+    g = _mm256_srai_epi16(_mm256_subs_epi16(_mm256_subs_epi16(yy, _mm256_mullo_epi16(d, _mm256_set1_epi16(CGU))), _mm256_mullo_epi16(e, _mm256_set1_epi16(CGV))), 6);
+    b = _mm256_srai_epi16(_mm256_adds_epi16(yy, _mm256_mullo_epi16(d, _mm256_set1_epi16(CBU))), 6);
+}
+
+// packus works per 128-bit lane; put the 32 bytes back in pixel order
+__attribute__((target("avx2")))
+inline __m256i pack16x32(__m256i lo, __m256i hi) {
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8);
+}
+
+__attribute__((target("avx2")))
+void convertRowAvx2(const uint8_t *src, uint8_t *dst, int width, bool isUyvy) {
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x * 2));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x * 2 + 32));
+        __m256i b0, g0, r0, b1, g1, r1;
+        yuvToBgr16x16(v0, isUyvy, b0, g0, r0);
+        yuvToBgr16x16(v1, isUyvy, b1, g1, r1);
+        __m256i b = pack16x32(b0, b1);
+        __m256i g = pack16x32(g0, g1);
+        __m256i r = pack16x32(r0, r1);
+        storeBgr48(dst + x * 3, _mm256_castsi256_si128(b), _mm256_castsi256_si128(g), _mm256_castsi256_si128(r));
+        storeBgr48(dst + x * 3 + 48, _mm256_extracti128_si256(b, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(r, 1));
+    }
+    convertRowSsse3(src + x * 2, dst + x * 3, width - x, isUyvy);
+}
+
+#endif
+
+#ifdef COLOR_CONVERT_NEON
+
+// 8 even or odd pixels sharing the chroma terms
+inline void yuvToBgr8(uint8x8_t y8, int16x8_t d, int16x8_t e, uint8x8_t& b, uint8x8_t& g, uint8x8_t& r) {
+    int16x8_t c = vreinterpretq_s16_u16(vsubl_u8(y8, vdup_n_u8(16)));
+    int16x8_t yy = vaddq_s16(vmulq_n_s16(c, CY), vdupq_n_s16(ROUND));
+    r = vqshrun_n_s16(vqaddq_s16(yy, vmulq_n_s16(e, CRV)), 6);
+    g = vqshrun_n_s16(vqsubq_s16(vqsubq_s16(yy, vmulq_n_s16(d, CGU)), vmulq_n_s16(e, CGV)), 6);
+    b = vqshrun_n_s16(vqaddq_s16(yy, vmulq_n_s16(d, CBU)), 6);
+}
+
+void convertRowNeon(const uint8_t *src, uint8_t *dst, int width, bool isUyvy) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // YUYV: Y0 U Y1 V, UYVY: U Y0 V Y1
+        uint8x8x4_t v = vld4_u8(src + x * 2);
+        uint8x8_t y0 = isUyvy ? v.val[1] : v.val[0];
+        uint8x8_t u = isUyvy ? v.val[0] : v.val[1];
+        uint8x8_t y1 = isUyvy ? v.val[3] : v.val[2];
+        uint8x8_t w = isUyvy ? v.val[2] : v.val[3];
+        int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(u, vdup_n_u8(128)));
+        int16x8_t e = vreinterpretq_s16_u16(vsubl_u8(w, vdup_n_u8(128)));
+
+        uint8x8_t b0, g0, r0, b1, g1, r1;
+        yuvToBgr8(y0, d, e, b0, g0, r0);
+        yuvToBgr8(y1, d, e, b1, g1, r1);
+
+        uint8x8x2_t b = vzip_u8(b0, b1);
+        uint8x8x2_t g = vzip_u8(g0, g1);
+        uint8x8x2_t r = vzip_u8(r0, r1);
+        uint8x16x3_t bgr;
+        bgr.val[0] = vcombine_u8(b.val[0], b.val[1]);
+        bgr.val[1] = vcombine_u8(g.val[0], g.val[1]);
+        bgr.val[2] = vcombine_u8(r.val[0], r.val[1]);
+        vst3q_u8(dst + x * 3, bgr);
+    }
+    convertRowScalar(src, dst, x, width, isUyvy);
+}
+
+#endif
+
+}
+
+ColorConvertBackend bestColorConvertBackend() {
+#if defined(COLOR_CONVERT_X86)
+    static const ColorConvertBackend best = __builtin_cpu_supports("avx2") ? CONVERT_AVX2
+                                          : __builtin_cpu_supports("ssse3") ? CONVERT_SSSE3
+                                          : CONVERT_SCALAR;
+    return best;
+#elif defined(COLOR_CONVERT_NEON)
+    return CONVERT_NEON;
+#else
+    return CONVERT_SCALAR;
+#endif
+}
+
+const char *colorConvertBackendName(ColorConvertBackend backend) {
+    switch (backend) {
+        case CONVERT_SSSE3:
+            return "ssse3";
+        case CONVERT_AVX2:
+            return "avx2";
+        case CONVERT_NEON:
+            return "neon";
+        default:
+            return "scalar";
+    }
+}
+
+void packedYuvToBgr(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,
+                    int width, int height, bool isUyvy) {
+    packedYuvToBgr(bestColorConvertBackend(), src, srcStride, dst, dstStride, width, height, isUyvy);
+}
+
+void packedYuvToBgr(ColorConvertBackend backend, const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,
+                    int width, int height, bool isUyvy) {
+    for (int row = 0; row < height; row++) {
+        const uint8_t *s = src + (size_t)row * srcStride;
+        uint8_t *d = dst + (size_t)row * dstStride;
+        switch (backend) {
+#ifdef COLOR_CONVERT_X86
+            case CONVERT_AVX2:
+                convertRowAvx2(s, d, width, isUyvy);
+                break;
+            case CONVERT_SSSE3:
+                convertRowSsse3(s, d, width, isUyvy);
+                break;
+#endif
+#ifdef COLOR_CONVERT_NEON
+            case CONVERT_NEON:
+                convertRowNeon(s, d, width, isUyvy);
+                break;
+#endif
+            default:
+                convertRowScalar(s, d, 0, width, isUyvy);
+                break;
+        }
+    }
+}
@@ -1,11 +1,82 @@
+#include <algorithm>
 #include "data_recorder.hpp"
 
+namespace {
+
+// framesets a warm source may have queued before the trigger; a bound and not "until empty",
+// since a replay that is not paced would hand out its whole file
+const int MAX_STALE_FRAMESETS = 16;
+
+}
+
 DataRecorder::DataRecorder(Settings settings) {
+    auto armStart = std::chrono::steady_clock::now();
+    this->captureStoppedFuture = this->captureStopped.get_future().share();
+
+    // Open the frame source (camera, synthetic or replay)
+    try {
+        this->source = createFrameSource(settings);
+    } catch (ob::Error &e) {
+        std::cerr << "Error: " << e.getMessage() << std::endl;
+        exit(1);
+    } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        exit(1);
+    }
+
+    setupStreams(settings);
+    saveMetadata();
+    this->source->start();
+    if (this->preRoll) {
+        startPreRoll();
+    }
+    this->armMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - armStart).count();
+}
+
+DataRecorder::DataRecorder(Settings settings, std::shared_ptr<FrameSource> source) {
+    auto armStart = std::chrono::steady_clock::now();
+    this->captureStoppedFuture = this->captureStopped.get_future().share();
+    this->source = source;
+    this->isOwnSource = false;
+
+    setupStreams(settings);
+    if (this->preRoll) {
+        startPreRoll();
+    }
+    this->armMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - armStart).count();
+    saveMetadata();
+}
+
+DataRecorder::~DataRecorder() {
+    // armed but never triggered: the pre-roll is dropped
+    this->isPreRolling.store(false);
+    if (this->preRollThread.joinable()) {
+        this->preRollThread.join();
+    }
+    if (this->preRollFlushThread.joinable()) {
+        this->preRollFlushThread.join();
+    }
+    if (this->isCallbackIngest) {
+        bool isStopped = this->ingestState.exchange(IngestState::STOPPED) == IngestState::STOPPED;
+        // after finishProcess the callback may already belong to the next record
+        if (!isStopped) {
+            this->source->setFrameCallback(nullptr);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->statsMutex);
+        this->isStatsRunning = false;
+    }
+    this->statsCv.notify_all();
+    if (this->statsThread.joinable()) {
+        this->statsThread.join();
+    }
+}
+
+void DataRecorder::setupStreams(const Settings& settings) {
     this->videoLength = settings.videoLength;
     this->saveDir = settings.saveDir + "/data/";
     this->recordCount = settings.recordCount;
-    this->pipe = std::make_shared<ob::Pipeline>();
-    this->config = std::make_shared<ob::Config>();
     createSaveDir();
 
     // if videoLength is negative, record until stopProcess() is called
@@ -13,23 +84,89 @@ DataRecorder::DataRecorder(Settings settings) {
         this->isUseFlag = true;
     }
 
-    // Get connected device list
-    // Assert only one device is connected
-    auto devList = this->context.queryDeviceList();
-    if (devList->deviceCount() == 0) {
-        std::cerr << "No device found!" << std::endl;
-        exit(1);
+    // Placement for the threads the streams are about to start
+    setThreadConfigs(settings.threads);
+    this->statsIntervalMs = settings.statsIntervalMs;
+    this->statsPromPath = settings.statsPromPath;
+
+    // Tracing can also be switched on later (SIGUSR2); settings only turn it on
+    this->isTrace = settings.trace;
+    setTraceBufferSize(settings.traceBufferEvents);
+    if (settings.trace) {
+        setTraceEnabled(true);
+    }
+
+    // Shared image encoders for every stream that saves images
+    if (settings.imageEncoderThreads > 0) {
+        this->imagePool = std::make_shared<ImageEncoderPool>(settings.imageEncoderThreads, settings.imageQueueDepth);
+    }
+
+    // One memory budget for every buffer that outlives a frame
+    if (settings.bufferBudgetMb > 0) {
+        this->bufferPool = std::make_shared<FrameBufferPool>((size_t)settings.bufferBudgetMb << 20, settings.bufferWaitMs);
     }
-    this->device = devList->getDevice(0);
+
+    // Pre-roll only makes sense when recording waits for a trigger
+    if (settings.preRollSeconds > 0 && this->isUseFlag) {
+        this->preRoll = std::make_unique<PreRollBuffer>(settings.preRollSeconds, (size_t)settings.preRollMb << 20, settings.preRollJpegQuality);
+    }
+    float imuPreRollSeconds = this->preRoll ? settings.preRollSeconds : 0;
+
+    // One file for every stream instead of videos, images and CSVs
+    if (settings.recordFormat == "chunklog") {
+        this->chunkLog = std::make_shared<ChunkLogWriter>();
+        std::string chunkLogPath = this->crtDir + "/record.rrlog";
+        if (this->chunkLog->open(chunkLogPath, parseChunkCompression(settings.chunkCompression), (size_t)settings.chunkKb << 10, settings.chunkLogWriter)) {
+            this->metadataChannel = this->chunkLog->addChannel("metadata", "json", nullptr);
+        } else {
+            std::cerr << "Failed to open file: " << chunkLogPath << std::endl;
+            this->chunkLog = nullptr;
+        }
+    }
+
+    if (settings.backpressure.isEnable) {
+        this->backpressure = std::make_shared<BackpressureController>(settings.backpressure);
+    }
+
+    // The IR pair becomes one stream with ir_left's settings
+    bool isStereo = settings.stereoIr &&
+        std::count(settings.sensorTypes.begin(), settings.sensorTypes.end(), OB_SENSOR_IR_LEFT) > 0 &&
+        std::count(settings.sensorTypes.begin(), settings.sensorTypes.end(), OB_SENSOR_IR_RIGHT) > 0;
 
     // Enable all streams
     for (int i = 0; i < settings.sensorTypes.size(); i++) {
         OBSensorType st = settings.sensorTypes[i];
+        if (isStereo && st == OB_SENSOR_IR_RIGHT) {
+            continue;
+        }
         if (st == OB_SENSOR_COLOR || st == OB_SENSOR_DEPTH || st == OB_SENSOR_IR_RIGHT || st == OB_SENSOR_IR_LEFT) {
-            auto sm = std::make_shared<ImageStreamManager>(this->pipe, this->device, this->config, st, settings.streamNames[i], this->crtDir, settings.profileIdx[i], settings.isSaveVideo[i], settings.isSaveImage[i], settings.containerFormats[i], settings.codecs[i], settings.imageFormats[i], settings.compressionParams[i]);
+            bool isPair = isStereo && st == OB_SENSOR_IR_LEFT;
+            std::string streamName = isPair ? "ir_stereo" : settings.streamNames[i];
+            ImageStreamConfig config;
+            config.isSaveVideo = settings.isSaveVideo[i];
+            config.isSaveImage = settings.isSaveImage[i];
+            config.containerFormat = settings.containerFormats[i];
+            config.codec = settings.codecs[i];
+            config.imageFormat = settings.imageFormats[i];
+            config.compressionParams = settings.compressionParams[i];
+            config.queueDepth = settings.queueDepths[i];
+            config.dropPolicy = settings.dropPolicies[i];
+            config.isMjpegPassthrough = settings.mjpegPassthrough;
+            config.depthPreview = settings.depthPreview;
+            config.encoder = settings.videoEncoders[i];
+            config.timecode = settings.timecode;
+            config.segmentSeconds = settings.segmentSeconds;
+            config.segmentMb = settings.segmentMb;
+            config.isStereo = isPair;
+            auto sm = std::make_shared<ImageStreamManager>(this->source, st, streamName, this->crtDir, settings.profileIdx[i], config, this->chunkLog);
+            if (settings.isSaveImage[i]) {
+                sm->setImageEncoderPool(this->imagePool);
+                sm->setBufferPool(this->bufferPool);
+            }
+            sm->setBackpressure(this->backpressure);
             this->streamManagers.push_back(sm);
         } else if (st == OB_SENSOR_GYRO || st == OB_SENSOR_ACCEL) {
-            auto sm = std::make_shared<ImuStreamManager>(this->pipe, this->device, this->config, st, settings.streamNames[i], this->crtDir, settings.profileIdx[i]);
+            auto sm = std::make_shared<ImuStreamManager>(this->source, st, settings.streamNames[i], this->crtDir, settings.profileIdx[i], settings.imuFormat, settings.imuRingSize, imuPreRollSeconds, settings.fileWriter, this->chunkLog);
             this->streamManagers.push_back(sm);
         } else {
             std::cerr << "Invalid sensor type: " << st << std::endl;
@@ -37,16 +174,51 @@ DataRecorder::DataRecorder(Settings settings) {
         }
     }
 
-    saveMetadata();
-    this->pipe->start(this->config);
+    // Callback ingestion: frames reach the managers as each sensor delivers them
+    if (settings.ingestMode == "callback") {
+        this->isCallbackIngest = this->source->setFrameCallback([this](std::shared_ptr<SourceFrame> frame) {
+            onFrame(frame);
+        });
+        if (!this->isCallbackIngest) {
+            std::cerr << "[WARN] " << this->source->getName() << " source has no frame callbacks, polling framesets instead" << std::endl;
+        }
+    }
 }
 
 void DataRecorder::startProcess() {
+    placeThread("capture", "capture");
+    if (!this->hasTriggerTime) {
+        setTriggerTime(std::chrono::steady_clock::now());
+    }
+
+    // With pre-roll, what was captured before the trigger goes out first.
+    // Otherwise a warm source has been running since it was armed: drop what queued up before the trigger.
+    if (this->preRoll) {
+        flushPreRoll();
+    } else if (this->isCallbackIngest) {
+        this->ingestState.store(IngestState::RECORDING);
+    } else if (!this->isOwnSource) {
+        int stale = 0;
+        while (stale < MAX_STALE_FRAMESETS && this->source->waitForFrames(0) != nullptr) {
+            stale++;
+        }
+    }
+
+    if (this->statsIntervalMs > 0) {
+        this->isStatsRunning = true;
+        this->statsThread = std::thread(&DataRecorder::statsLoop, this);
+    }
+
     auto start = std::chrono::high_resolution_clock::now();
     int timeCount = 0;
     int loopCount = 0;
     while (true) {
-        process();
+        if (this->isCallbackIngest) {
+            // frames come in on the source's threads; this loop only keeps time
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        } else {
+            process();
+        }
 
         auto now = std::chrono::high_resolution_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - start);
@@ -54,52 +226,256 @@ void DataRecorder::startProcess() {
         if (timeCount != duration.count() / 100) {
             timeCount = duration.count() / 100;
             std::cout << "[INFO][Record #" << this->recordCount << "] " << "Elapsed time: " << duration.count() << " ms (avg frequency: " << loopCount / (duration.count() / 1000.0) << " Hz)" << std::endl;
-        }
 
-        // if isUseFlag is true and stopFlag is true, stop recording
-        if (this->isUseFlag && this->stopFlag.load()) {
+            // keep metadata.json listing every segment that has been started
+            int segmentCount = 0;
             for (auto &manager : this->streamManagers) {
-                manager->close();
+                segmentCount += manager->getSegmentCount();
             }
-            this->pipe->stop();
-            std::cout << "Record finished" << std::endl;
+            if (segmentCount != this->segmentCount) {
+                this->segmentCount = segmentCount;
+                saveMetadata();
+            }
+
+            // SIGUSR1: dump what the threads did up to now without stopping
+            if (takeTraceDumpRequest()) {
+                dumpTrace("trace_" + std::to_string(duration.count()) + "ms.json");
+            }
+        }
+
+        // if isUseFlag is true and stopFlag is true, or a replay has run out, stop recording
+        if ((this->isUseFlag && this->stopFlag.load()) || this->source->isFinished()) {
+            finishProcess();
             break;
         }
 
         // if isUseFlag is false and duration is longer than videoLength, stop recording
         if (!this->isUseFlag && duration.count() > this->videoLength * 1000) {
-            for (auto &manager : this->streamManagers) {
-                manager->close();
-            }
-            this->pipe->stop();
-            std::cout << "Record finished" << std::endl;
+            finishProcess();
             break;
         }
     }
 }
 
+// Stop taking data first, then drain and close the writers
+void DataRecorder::finishProcess() {
+    auto finalizeStart = std::chrono::steady_clock::now();
+    if (this->isCallbackIngest) {
+        this->ingestState.store(IngestState::STOPPED);
+        // returns once no callback is running, so nothing reaches the managers after this
+        this->source->setFrameCallback(nullptr);
+    }
+    // nothing goes into the ring any more; what is left of it still belongs to the recording
+    if (this->preRollFlushThread.joinable()) {
+        this->preRollFlushThread.join();
+    }
+    for (auto &manager : this->streamManagers) {
+        manager->stopCapture();
+    }
+    this->captureStopped.set_value();
+
+    for (auto &manager : this->streamManagers) {
+        manager->close();
+    }
+    if (this->isOwnSource) {
+        this->source->stop();
+    }
+    if (this->statsThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(this->statsMutex);
+            this->isStatsRunning = false;
+        }
+        this->statsCv.notify_all();
+        this->statsThread.join();
+        exportStats();
+    }
+    if (this->isTrace || isTraceEnabled()) {
+        dumpTrace("trace.json");
+    }
+    // the final metadata is the log's last record, then its index and summary close it
+    if (this->chunkLog) {
+        saveMetadata();
+        this->chunkLog->close();
+    }
+    this->finalizeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - finalizeStart).count();
+    saveMetadata();
+    std::cout << "[INFO][Record #" << this->recordCount << "] Record finished (finalize: " << this->finalizeMs << " ms)" << std::endl;
+}
+
 inline void DataRecorder::process() {
-    auto frameset = this->pipe->waitForFrames(100);
+    std::shared_ptr<SourceFrameSet> frameset;
+    {
+        TraceSpan span("waitForFrames");
+        frameset = this->source->waitForFrames(100);
+    }
     if(frameset == nullptr) {
         std::cout << "The frameset is null!" << std::endl;
         return;
     }
 
-    if (this->frameCount < 10) {
+    // skip the first frames while the camera settles; replays and warm sources keep every frame
+    if (this->isOwnSource && this->frameCount < 10 && this->source->getName() != "replay") {
         this->frameCount++;
         return;
     }
 
+    // held raw behind the pre-roll until the flusher has emptied the ring
+    if (this->preRoll) {
+        TraceSpan span("preRollPush");
+        if (this->preRoll->push(*frameset)) {
+            return;
+        }
+    }
+
+    TraceSpan span("dispatchFrameset");
     for (auto &manager : this->streamManagers)
     {
         manager->processFrameset(frameset);
     }
+    markFirstFrame();
+}
+
+// Source threads, callback ingestion only. Sensors deliver in parallel, so nothing here
+// takes a lock shared by all of them; each manager only takes its own frames.
+void DataRecorder::onFrame(std::shared_ptr<SourceFrame> frame) {
+    IngestState state = this->ingestState.load();
+    if (state == IngestState::ARMED || state == IngestState::STOPPED) {
+        return;
+    }
+    // skip each stream's first frames while the camera settles, as frameset mode does
+    if (this->isOwnSource) {
+        auto &skipped = this->warmUpFrames[(size_t)frame->type % this->warmUpFrames.size()];
+        if (skipped.load(std::memory_order_relaxed) < 10 && skipped.fetch_add(1) < 10) {
+            return;
+        }
+    }
+
+    if (state != IngestState::RECORDING) {
+        // one frame per entry; a stereo pair is matched again when the pre-roll is flushed.
+        // After the trigger the frame is held raw behind the ring, and refused once it is drained.
+        TraceSpan span("preRollPush");
+        SourceFrameSet frameset;
+        frameset.frames.push_back(frame);
+        if (this->preRoll->push(frameset)) {
+            return;
+        }
+    }
+
+    TraceSpan span("dispatchFrame");
+    for (auto &manager : this->streamManagers) {
+        manager->processFrame(frame);
+    }
+    markFirstFrame();
+}
+
+// First live frame after the trigger, from whichever thread delivers it
+void DataRecorder::markFirstFrame() {
+    if (this->hasFirstFrame.load(std::memory_order_relaxed) || this->hasFirstFrame.exchange(true)) {
+        return;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->triggerTime).count();
+    this->triggerToFirstFrameMs.store(ms);
+    std::cout << "[INFO][Record #" << this->recordCount << "] Trigger to first frame: " << ms << " ms" << std::endl;
+}
+
+void DataRecorder::startPreRoll() {
+    if (this->isCallbackIngest) {
+        this->ingestState.store(IngestState::PRE_ROLL);
+        return;
+    }
+    this->isPreRolling.store(true);
+    this->preRollThread = std::thread(&DataRecorder::preRollLoop, this);
+}
+
+// Runs between arming and the trigger: frames only go to the in-memory ring
+void DataRecorder::preRollLoop() {
+    placeThread("capture", "preroll");
+    while (this->isPreRolling.load()) {
+        std::shared_ptr<SourceFrameSet> frameset;
+        {
+            TraceSpan span("waitForFrames");
+            frameset = this->source->waitForFrames(100);
+        }
+        if (frameset == nullptr) {
+            continue;
+        }
+        if (this->isOwnSource && this->frameCount < 10 && this->source->getName() != "replay") {
+            this->frameCount++;
+            continue;
+        }
+        TraceSpan span("preRollPush");
+        this->preRoll->push(*frameset);
+    }
+}
+
+// Trigger path: hand the ring to the flusher and return; live frames are held raw behind
+// the pre-roll until it is out, so nothing waits for the backlog and nothing is re-encoded
+void DataRecorder::flushPreRoll() {
+    this->isPreRolling.store(false);
+    if (this->preRollThread.joinable()) {
+        this->preRollThread.join();
+    }
+    this->preRoll->trigger();
+    if (this->isCallbackIngest) {
+        this->ingestState.store(IngestState::DRAINING);
+    }
+    for (auto &manager : this->streamManagers) {
+        manager->endPreRoll();
+    }
+    this->preRollFlushThread = std::thread(&DataRecorder::preRollFlushLoop, this);
+}
+
+// Pushes every held frameset to the workers, waiting for room instead of dropping; the live
+// frames held behind them follow on the normal path
+void DataRecorder::preRollFlushLoop() {
+    placeThread("capture", "prerollFlush");
+    auto start = std::chrono::steady_clock::now();
+    size_t count = 0;
+    std::shared_ptr<SourceFrameSet> frameset;
+    bool isLive = false;
+    while (this->preRoll->pop(frameset, isLive)) {
+        if (!isLive) {
+            TraceSpan span("preRollFlush");
+            for (auto &manager : this->streamManagers) {
+                manager->processPreRoll(frameset);
+            }
+            count++;
+            continue;
+        }
+        TraceSpan span("dispatchHeld");
+        for (auto &manager : this->streamManagers) {
+            if (this->isCallbackIngest) {
+                for (auto &frame : frameset->frames) {
+                    manager->processFrame(frame);
+                }
+            } else {
+                manager->processFrameset(frameset);
+            }
+        }
+        markFirstFrame();
+    }
+    // the ring is closed, so later frames already bypass it; skip the push attempt as well
+    if (this->isCallbackIngest) {
+        IngestState draining = IngestState::DRAINING;
+        this->ingestState.compare_exchange_strong(draining, IngestState::RECORDING);
+    }
+    double drainMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "[INFO][Record #" << this->recordCount << "] Pre-roll: " << count << " framesets (" << drainMs << " ms)" << std::endl;
 }
 
 void DataRecorder::stopProcess() {
     this->stopFlag.store(true);
 }
 
+void DataRecorder::setTriggerTime(std::chrono::steady_clock::time_point triggerTime) {
+    this->triggerTime = triggerTime;
+    this->hasTriggerTime = true;
+}
+
+void DataRecorder::waitCaptureStopped() {
+    this->captureStoppedFuture.wait();
+}
+
 void DataRecorder::createSaveDir() {
     namespace fs = std::filesystem;
 
@@ -147,6 +523,43 @@ void DataRecorder::createSaveDir() {
     }
 }
 
+void DataRecorder::statsLoop() {
+    std::unique_lock<std::mutex> lock(this->statsMutex);
+    while (this->isStatsRunning) {
+        this->statsCv.wait_for(lock, std::chrono::milliseconds(this->statsIntervalMs));
+        lock.unlock();
+        exportStats();
+        lock.lock();
+    }
+}
+
+// stats.json for people and scripts, the .prom textfile for node_exporter
+void DataRecorder::exportStats() {
+    nlohmann::json j;
+    j["recordCount"] = this->recordCount;
+    j["elapsedMs"] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->triggerTime).count();
+    std::vector<std::pair<std::string, const StreamStats *>> streams;
+    for (auto &manager : this->streamManagers) {
+        j[manager->getStreamName()] = manager->getStats().toJson();
+        streams.push_back({manager->getStreamName(), &manager->getStats()});
+    }
+    std::string promPath = this->statsPromPath.empty() ? this->crtDir + "/stats.prom" : this->statsPromPath;
+    if (!writeFileAtomic(this->crtDir + "/stats.json", j.dump(4) + "\n") ||
+        !writeFileAtomic(promPath, StreamStats::toPrometheus(streams))) {
+        std::cerr << "Failed to write stats: " << promPath << std::endl;
+    }
+}
+
+void DataRecorder::dumpTrace(const std::string& fileName) {
+    std::string tracePath = this->crtDir + "/" + fileName;
+    if (writeChromeTrace(tracePath)) {
+        this->traceFiles.push_back(fileName);
+        std::cout << "[INFO][Record #" << this->recordCount << "] Save trace: " << tracePath << std::endl;
+    } else {
+        std::cerr << "Failed to write trace: " << tracePath << std::endl;
+    }
+}
+
 void DataRecorder::saveMetadata() {
     std::string metadataPath = this->crtDir + "/metadata.json";
     std::ofstream ofs(metadataPath);
@@ -157,9 +570,44 @@ void DataRecorder::saveMetadata() {
     nlohmann::json j;
     j["videoLength"] = this->videoLength;
     j["currentDir"] = this->crtDir;
+    j["frameSource"] = this->source->getName();
+    j["armMs"] = this->armMs;
+    j["ingestMode"] = this->isCallbackIngest ? "callback" : "frameset";
+    // written by a source thread under callback ingestion
+    double triggerToFirstFrameMs = this->triggerToFirstFrameMs.load();
+    if (triggerToFirstFrameMs >= 0) {
+        j["triggerToFirstFrameMs"] = triggerToFirstFrameMs;
+    }
+    if (this->finalizeMs > 0) {
+        j["finalizeMs"] = this->finalizeMs;
+    }
+    if (this->imagePool) {
+        j["imageEncoderPool"] = this->imagePool->getMetadata();
+    }
+    if (this->bufferPool) {
+        j["bufferPool"] = this->bufferPool->getMetadata();
+    }
+    if (this->preRoll) {
+        j["preRoll"] = this->preRoll->getMetadata();
+    }
+    j["threads"] = getThreadPlacement();
+    if (this->backpressure) {
+        j["backpressure"] = this->backpressure->getMetadata();
+    }
+    if (!this->traceFiles.empty()) {
+        j["traceFiles"] = this->traceFiles;
+    }
     for (auto &manager : this->streamManagers) {
         j[manager->getStreamName()] = manager->getMetadata();
     }
+    if (this->chunkLog) {
+        j["chunkLog"] = this->chunkLog->getMetadata();
+        // stamped with the newest frame, the log has no host clock
+        if (this->chunkLog->isOpened()) {
+            std::string text = j.dump();
+            this->chunkLog->write(this->metadataChannel, this->chunkLog->getLastTimeStampUs(), text.data(), text.size());
+        }
+    }
     ofs << j.dump(4) << std::endl;
     ofs.close();
     std::cout << "Save metadata: " << metadataPath << std::endl;
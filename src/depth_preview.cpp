@@ -0,0 +1,160 @@
+#include <cmath>
+#include <algorithm>
+#include "depth_preview.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define DEPTH_PREVIEW_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DEPTH_PREVIEW_NEON 1
+#endif
+
+namespace {
+
+// out = (min(sat(raw - lo), range) * mul) >> 16, which never exceeds 255
+void depthRowTo8(const uint16_t *src, uint8_t *dst, int width, uint16_t lo, uint16_t range, uint16_t mul) {
+    int x = 0;
+#if defined(DEPTH_PREVIEW_SSE2)
+    // SSE2 has no unsigned 16-bit min, clamp with a saturating add/sub pair
+    const __m128i vLo = _mm_set1_epi16((short)lo);
+    const __m128i vPad = _mm_set1_epi16((short)(65535 - range));
+    const __m128i vMul = _mm_set1_epi16((short)mul);
+    for (; x + 16 <= width; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + x + 8));
+        a = _mm_subs_epu16(_mm_adds_epu16(_mm_subs_epu16(a, vLo), vPad), vPad);
+        b = _mm_subs_epu16(_mm_adds_epu16(_mm_subs_epu16(b, vLo), vPad), vPad);
+        a = _mm_mulhi_epu16(a, vMul);
+        b = _mm_mulhi_epu16(b, vMul);
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(a, b));
+    }
+#elif defined(DEPTH_PREVIEW_NEON)
+    const uint16x8_t vLo = vdupq_n_u16(lo);
+    const uint16x8_t vRange = vdupq_n_u16(range);
+    const uint16x4_t vMul = vdup_n_u16(mul);
+    for (; x + 8 <= width; x += 8) {
+        uint16x8_t d = vminq_u16(vqsubq_u16(vld1q_u16(src + x), vLo), vRange);
+        uint32x4_t l = vmull_u16(vget_low_u16(d), vMul);
+        uint32x4_t h = vmull_u16(vget_high_u16(d), vMul);
+        uint16x8_t v = vcombine_u16(vshrn_n_u32(l, 16), vshrn_n_u32(h, 16));
+        vst1_u8(dst + x, vmovn_u16(v));
+    }
+#endif
+    for (; x < width; x++) {
+        uint32_t d = src[x] > lo ? std::min<uint32_t>(src[x] - lo, range) : 0;
+        dst[x] = (uint8_t)((d * mul) >> 16);
+    }
+}
+
+int colormapId(const std::string& name) {
+    if (name == "jet") {
+        return cv::COLORMAP_JET;
+    } else if (name == "inferno") {
+        return cv::COLORMAP_INFERNO;
+    } else if (name == "viridis") {
+        return cv::COLORMAP_VIRIDIS;
+    }
+    return cv::COLORMAP_TURBO;
+}
+
+}
+
+DepthPreviewMode parseDepthPreviewMode(const std::string& name) {
+    if (name == "fixed") {
+        return DepthPreviewMode::FIXED;
+    } else if (name == "colormap") {
+        return DepthPreviewMode::COLORMAP;
+    }
+    return DepthPreviewMode::AUTO;
+}
+
+std::string depthPreviewModeName(DepthPreviewMode mode) {
+    switch (mode) {
+        case DepthPreviewMode::FIXED:
+            return "fixed";
+        case DepthPreviewMode::COLORMAP:
+            return "colormap";
+        default:
+            return "auto";
+    }
+}
+
+DepthPreview::DepthPreview() : DepthPreview(DepthPreviewConfig()) {
+}
+
+DepthPreview::DepthPreview(const DepthPreviewConfig& config) {
+    this->config = config;
+    // 256 entry BGR table, index 0 is kept for invalid pixels
+    if (config.mode == DepthPreviewMode::COLORMAP) {
+        cv::Mat ramp(1, 256, CV_8UC1);
+        for (int i = 0; i < 256; i++) {
+            ramp.ptr<uint8_t>(0)[i] = (uint8_t)i;
+        }
+        cv::Mat colors;
+        cv::applyColorMap(ramp, colors, colormapId(config.colormap));
+        for (int i = 0; i < 256; i++) {
+            for (int c = 0; c < 3; c++) {
+                this->colorTable[i][c] = colors.ptr<uint8_t>(0)[i * 3 + c];
+            }
+        }
+    }
+}
+
+const DepthPreviewConfig& DepthPreview::getConfig() const {
+    return this->config;
+}
+
+bool DepthPreview::isColor() const {
+    return this->config.mode == DepthPreviewMode::COLORMAP;
+}
+
+void DepthPreview::updateScale(float valueScale) {
+    if (valueScale == this->currentScale) {
+        return;
+    }
+    this->currentScale = valueScale;
+    float scale = valueScale > 0 ? valueScale : 1.0f;
+    double lo = std::clamp(std::round((double)this->config.minMm / scale), 0.0, 65535.0 - 256);
+    double hi = std::clamp(std::round((double)this->config.maxMm / scale), lo + 256, 65535.0);
+    this->lo = (uint16_t)lo;
+    this->range = (uint16_t)(hi - lo);
+    this->mul = (uint16_t)std::ceil(255.0 * 65536 / this->range);
+}
+
+void DepthPreview::convert(const cv::Mat& depth, float valueScale, cv::Mat& dst) {
+    if (this->config.mode == DepthPreviewMode::AUTO) {
+        double min, max;
+        cv::minMaxLoc(depth, &min, &max);
+        double scale = max > min ? 255.0 / (max - min) : 0;
+        depth.convertTo(dst, CV_8UC1, scale, -min * scale);
+        return;
+    }
+
+    updateScale(valueScale);
+    int width = depth.cols;
+    if (this->config.mode == DepthPreviewMode::FIXED) {
+        dst.create(depth.rows, width, CV_8UC1);
+        for (int y = 0; y < depth.rows; y++) {
+            depthRowTo8(depth.ptr<uint16_t>(y), dst.ptr<uint8_t>(y), width, this->lo, this->range, this->mul);
+        }
+        return;
+    }
+
+    // colormap: each row goes through an L1 resident 8-bit buffer
+    dst.create(depth.rows, width, CV_8UC3);
+    this->rowBuffer.resize(width);
+    uint8_t *gray = this->rowBuffer.data();
+    for (int y = 0; y < depth.rows; y++) {
+        const uint16_t *src = depth.ptr<uint16_t>(y);
+        uint8_t *out = dst.ptr<uint8_t>(y);
+        depthRowTo8(src, gray, width, this->lo, this->range, this->mul);
+        for (int x = 0; x < width; x++) {
+            const uint8_t *color = this->colorTable[gray[x]];
+            bool isValid = src[x] != 0;
+            out[x * 3] = isValid ? color[0] : 0;
+            out[x * 3 + 1] = isValid ? color[1] : 0;
+            out[x * 3 + 2] = isValid ? color[2] : 0;
+        }
+    }
+}
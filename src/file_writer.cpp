@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "file_writer.hpp"
+
+namespace {
+
+// O_DIRECT wants buffer, offset and length aligned to the logical block size; 4 KiB covers flash
+const size_t ALIGNMENT = 4096;
+
+size_t alignUp(size_t size) {
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+int64_t steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+FileWriteMode parseFileWriteMode(const std::string& name) {
+    if (name == "direct") {
+        return FileWriteMode::DIRECT;
+    }
+    return FileWriteMode::BUFFERED;
+}
+
+std::string fileWriteModeName(FileWriteMode mode) {
+    switch (mode) {
+        case FileWriteMode::DIRECT:
+            return "direct";
+        default:
+            return "buffered";
+    }
+}
+
+FileWriter::~FileWriter() {
+    close();
+}
+
+bool FileWriter::open(const std::string& fileName, const FileWriterConfig& config) {
+    close();
+    this->config = config;
+    this->config.blockBytes = alignUp(std::max(config.blockBytes, ALIGNMENT));
+    FileWriteMode mode = config.mode;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    if (mode == FileWriteMode::DIRECT) {
+        this->fd = ::open(fileName.c_str(), flags | O_DIRECT, 0644);
+        if (this->fd < 0 && errno == EINVAL) {
+            std::cerr << "[WARN] No direct I/O for " << fileName << ", writing through the page cache" << std::endl;
+            mode = FileWriteMode::BUFFERED;
+        }
+    }
+    if (this->fd < 0) {
+        // whatever made the direct open fail, this handle goes through the page cache
+        mode = FileWriteMode::BUFFERED;
+        this->fd = ::open(fileName.c_str(), flags, 0644);
+    }
+    if (this->fd < 0) {
+        this->errorMsg = "Failed to open file: " + fileName;
+        return false;
+    }
+    if (mode == FileWriteMode::DIRECT) {
+        this->tailFd = ::open(fileName.c_str(), O_WRONLY | O_CLOEXEC);
+        if (this->tailFd < 0) {
+            std::cerr << "[WARN] No second handle for " << fileName << ", writing through the page cache" << std::endl;
+            fcntl(this->fd, F_SETFL, fcntl(this->fd, F_GETFL) & ~O_DIRECT);
+            mode = FileWriteMode::BUFFERED;
+        }
+    }
+    void *buffer = nullptr;
+    if (posix_memalign(&buffer, ALIGNMENT, this->config.blockBytes) != 0) {
+        ::close(this->fd);
+        this->fd = -1;
+        if (this->tailFd >= 0) {
+            ::close(this->tailFd);
+            this->tailFd = -1;
+        }
+        this->errorMsg = "Failed to allocate write buffer: " + fileName;
+        return false;
+    }
+    this->buffer = (uint8_t *)buffer;
+    this->mode.store(mode);
+    this->used = 0;
+    this->bufferOffset = 0;
+    this->allocated = 0;
+    this->isPreallocate.store(config.preallocateBytes > 0);
+    this->syncedTo = 0;
+    this->waitFrom = 0;
+    this->size.store(0);
+    return true;
+}
+
+bool FileWriter::isOpened() const {
+    return this->fd >= 0;
+}
+
+bool FileWriter::write(const void *data, size_t size) {
+    if (this->fd < 0) {
+        return false;
+    }
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (size > 0) {
+        size_t n = std::min(size, this->config.blockBytes - this->used);
+        std::memcpy(this->buffer + this->used, bytes, n);
+        this->used += n;
+        bytes += n;
+        size -= n;
+        this->size.fetch_add(n, std::memory_order_relaxed);
+        if (this->used == this->config.blockBytes) {
+            if (!writeAt(this->fd, this->buffer, this->used, this->bufferOffset)) {
+                return false;
+            }
+            this->bufferOffset += this->used;
+            this->used = 0;
+            startWriteback();
+        }
+    }
+    return true;
+}
+
+bool FileWriter::flush() {
+    if (this->fd < 0 || this->used == 0) {
+        return this->fd >= 0;
+    }
+    if (this->mode.load() == FileWriteMode::DIRECT) {
+        // whole pages are final; the partial one goes through the page cache, so the file
+        // ends at the data even if it is never closed, and is written direct once it fills
+        size_t aligned = this->used & ~(ALIGNMENT - 1);
+        if (aligned > 0 && !writeAt(this->fd, this->buffer, aligned, this->bufferOffset)) {
+            return false;
+        }
+        size_t tail = this->used - aligned;
+        if (tail > 0 && !writeAt(this->tailFd, this->buffer + aligned, tail, this->bufferOffset + aligned)) {
+            return false;
+        }
+        std::memmove(this->buffer, this->buffer + aligned, tail);
+        this->bufferOffset += aligned;
+        this->used = tail;
+        return true;
+    }
+    if (!writeAt(this->fd, this->buffer, this->used, this->bufferOffset)) {
+        return false;
+    }
+    this->bufferOffset += this->used;
+    this->used = 0;
+    startWriteback();
+    return true;
+}
+
+void FileWriter::close() {
+    if (this->fd < 0) {
+        return;
+    }
+    flush();
+    // release the space reserved past the data
+    if (ftruncate(this->fd, this->size.load()) != 0) {
+        std::cerr << "Failed to truncate file: " << std::strerror(errno) << std::endl;
+    }
+    ::close(this->fd);
+    this->fd = -1;
+    if (this->tailFd >= 0) {
+        ::close(this->tailFd);
+        this->tailFd = -1;
+    }
+    free(this->buffer);
+    this->buffer = nullptr;
+}
+
+uint64_t FileWriter::getSize() const {
+    return this->size.load(std::memory_order_relaxed);
+}
+
+FileWriteMode FileWriter::getMode() const {
+    return this->mode.load();
+}
+
+// One timed write, reserving space first when the file is about to outgrow it
+bool FileWriter::writeAt(int fd, const uint8_t *data, size_t size, uint64_t offset) {
+    int64_t start = steadyNs();
+    preallocate(offset + size);
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EINVAL && fd == this->fd && this->mode.load() == FileWriteMode::DIRECT) {
+            // some filesystems take O_DIRECT at open and refuse it on write
+            std::cerr << "[WARN] Direct write refused, writing through the page cache" << std::endl;
+            fcntl(this->fd, F_SETFL, fcntl(this->fd, F_GETFL) & ~O_DIRECT);
+            this->mode.store(FileWriteMode::BUFFERED);
+            continue;
+        }
+        if (n < 0) {
+            this->errorMsg = std::string("Failed to write file: ") + std::strerror(errno);
+            std::cerr << this->errorMsg << std::endl;
+            return false;
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    int64_t ns = steadyNs() - start;
+    this->writeLatency.record(ns);
+    this->writeCount.fetch_add(1, std::memory_order_relaxed);
+    if ((uint64_t)ns > this->maxWriteNs.load(std::memory_order_relaxed)) {
+        this->maxWriteNs.store(ns, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+// KEEP_SIZE: readers see only the data, and close() releases what was not used
+void FileWriter::preallocate(uint64_t end) {
+    if (!this->isPreallocate.load(std::memory_order_relaxed) || end <= this->allocated) {
+        return;
+    }
+    uint64_t next = std::max<uint64_t>(end, this->allocated + this->config.preallocateBytes);
+    if (fallocate(this->fd, FALLOC_FL_KEEP_SIZE, this->allocated, next - this->allocated) != 0) {
+        // e.g. vfat: the file grows write by write as before
+        this->isPreallocate.store(false);
+        return;
+    }
+    this->allocated = next;
+}
+
+// Start writeback of each syncBytes window as it completes and wait for the one before,
+// so at most two windows are dirty and the kernel never has a large backlog to flush.
+void FileWriter::startWriteback() {
+    if (this->mode.load() != FileWriteMode::BUFFERED || this->config.syncBytes == 0 ||
+        this->bufferOffset - this->syncedTo < this->config.syncBytes) {
+        return;
+    }
+    int64_t start = steadyNs();
+    if (this->syncedTo > this->waitFrom) {
+        sync_file_range(this->fd, this->waitFrom, this->syncedTo - this->waitFrom,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        // written out, so the pages are only taking memory from the frames
+        posix_fadvise(this->fd, this->waitFrom, this->syncedTo - this->waitFrom, POSIX_FADV_DONTNEED);
+        this->waitFrom = this->syncedTo;
+    }
+    sync_file_range(this->fd, this->syncedTo, this->bufferOffset - this->syncedTo, SYNC_FILE_RANGE_WRITE);
+    this->syncedTo = this->bufferOffset;
+    int64_t ns = steadyNs() - start;
+    this->writeLatency.record(ns);
+    this->syncCount.fetch_add(1, std::memory_order_relaxed);
+    if ((uint64_t)ns > this->maxWriteNs.load(std::memory_order_relaxed)) {
+        this->maxWriteNs.store(ns, std::memory_order_relaxed);
+    }
+}
+
+nlohmann::json FileWriter::getMetadata() const {
+    nlohmann::json j;
+    j["mode"] = fileWriteModeName(this->mode.load());
+    j["requestedMode"] = fileWriteModeName(this->config.mode);
+    j["blockBytes"] = this->config.blockBytes;
+    j["preallocate"] = this->isPreallocate.load();
+    j["bytes"] = this->size.load();
+    j["writes"] = this->writeCount.load();
+    j["syncs"] = this->syncCount.load();
+    j["maxWriteMs"] = this->maxWriteNs.load() / 1e6;
+    j["writeLatency"] = this->writeLatency.toJson();
+    return j;
+}
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cstdlib>
+#include "frame_buffer_pool.hpp"
+
+namespace {
+
+const size_t ALIGNMENT = 64;
+
+}
+
+FrameBufferPool::FrameBufferPool(size_t budgetBytes, int waitMs) {
+    this->budgetBytes = budgetBytes;
+    this->wait = std::chrono::milliseconds(waitMs);
+}
+
+FrameBufferPool::~FrameBufferPool() {
+    for (auto& entry : this->freeBuffers) {
+        for (uint8_t *data : entry.second) {
+            std::free(data);
+        }
+    }
+}
+
+uint8_t *FrameBufferPool::allocate(size_t size) {
+    // aligned for the SIMD converters, aligned_alloc wants a multiple of the alignment
+    size_t rounded = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    uint8_t *data = (uint8_t *)std::aligned_alloc(ALIGNMENT, rounded);
+    if (!data) {
+        throw std::bad_alloc();
+    }
+    this->allocatedBytes += size;
+    this->peakAllocatedBytes = std::max(this->peakAllocatedBytes, this->allocatedBytes);
+    return data;
+}
+
+// Free idle buffers of other sizes until size fits in the budget
+bool FrameBufferPool::evictFor(size_t size) {
+    for (auto it = this->freeBuffers.begin(); it != this->freeBuffers.end() && this->allocatedBytes + size > this->budgetBytes; ) {
+        while (!it->second.empty() && this->allocatedBytes + size > this->budgetBytes) {
+            std::free(it->second.back());
+            it->second.pop_back();
+            this->allocatedBytes -= it->first;
+        }
+        it = it->second.empty() ? this->freeBuffers.erase(it) : std::next(it);
+    }
+    return this->allocatedBytes + size <= this->budgetBytes;
+}
+
+std::shared_ptr<uint8_t> FrameBufferPool::acquire(size_t size) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->acquireCount++;
+    uint8_t *data = nullptr;
+    auto deadline = std::chrono::steady_clock::now() + this->wait;
+    bool isFirstTry = true;
+    while (true) {
+        auto it = this->freeBuffers.find(size);
+        if (it != this->freeBuffers.end() && !it->second.empty()) {
+            data = it->second.back();
+            it->second.pop_back();
+            if (isFirstTry) {
+                this->hitCount++;
+            }
+            break;
+        }
+        if (evictFor(size)) {
+            data = allocate(size);
+            break;
+        }
+        // over budget: wait for an in-flight buffer to come back
+        if (isFirstTry) {
+            this->waitCount++;
+            isFirstTry = false;
+        }
+        if (this->released.wait_until(lock, deadline) == std::cv_status::timeout) {
+            this->overBudgetCount++;
+            data = allocate(size);
+            break;
+        }
+    }
+    this->inUseBytes += size;
+    this->peakInUseBytes = std::max(this->peakInUseBytes, this->inUseBytes);
+
+    auto self = shared_from_this();
+    return std::shared_ptr<uint8_t>(data, [self, size](uint8_t *p) {
+        self->release(p, size);
+    });
+}
+
+void FrameBufferPool::release(uint8_t *data, size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->inUseBytes -= size;
+        if (this->allocatedBytes > this->budgetBytes) {
+            // shrink back after an over-budget allocation
+            std::free(data);
+            this->allocatedBytes -= size;
+        } else {
+            this->freeBuffers[size].push_back(data);
+        }
+    }
+    this->released.notify_all();
+}
+
+void FrameBufferPool::reserve(size_t size, int count) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto& buffers = this->freeBuffers[size];
+    for (int i = 0; i < count && this->allocatedBytes + size <= this->budgetBytes; i++) {
+        buffers.push_back(allocate(size));
+    }
+}
+
+nlohmann::json FrameBufferPool::getMetadata() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    nlohmann::json metadata;
+    metadata["budget [MB]"] = this->budgetBytes / 1048576.0;
+    metadata["peakAllocated [MB]"] = this->peakAllocatedBytes / 1048576.0;
+    metadata["peakInUse [MB]"] = this->peakInUseBytes / 1048576.0;
+    metadata["acquires"] = this->acquireCount;
+    metadata["hitRate"] = this->acquireCount > 0 ? (double)this->hitCount / this->acquireCount : 0.0;
+    metadata["waits"] = this->waitCount;
+    metadata["overBudget"] = this->overBudgetCount;
+    return metadata;
+}
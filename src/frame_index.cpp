@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "frame_index.hpp"
+
+namespace {
+
+// frames without a packet this long after they were added are written without one
+const size_t MAX_PENDING = 256;
+
+}
+
+FrameIndexWriter::~FrameIndexWriter() {
+    close();
+}
+
+bool FrameIndexWriter::open(const std::string& fileName, const FileWriterConfig& config) {
+    close();
+    if (!this->file.open(fileName, config)) {
+        return false;
+    }
+    FrameIndexHeader header;
+    this->file.write(&header, sizeof(header));
+    this->pending.clear();
+    this->firstPending = 0;
+    this->frameCount = 0;
+    this->lastKeyFrame = 0;
+    return true;
+}
+
+bool FrameIndexWriter::isOpened() const {
+    return this->file.isOpened();
+}
+
+void FrameIndexWriter::addFrame(uint64_t timeStampUs, uint32_t streamFrame, bool hasImage, bool isPacketExpected) {
+    if (!isOpened()) {
+        return;
+    }
+    Pending frame;
+    frame.record.timeStampUs = timeStampUs;
+    frame.record.offset = 0;
+    frame.record.size = 0;
+    frame.record.flags = hasImage ? FRAME_INDEX_IMAGE : 0;
+    frame.record.streamFrame = streamFrame;
+    frame.record.keyFrame = 0;
+    frame.isSettled = !isPacketExpected;
+    this->pending.push_back(frame);
+    this->frameCount++;
+    emitSettled(false);
+}
+
+uint32_t FrameIndexWriter::getLastFrame() const {
+    return this->frameCount > 0 ? this->frameCount - 1 : 0;
+}
+
+void FrameIndexWriter::setPacket(uint32_t frameNumber, uint64_t offset, uint32_t size, bool isKey) {
+    if (frameNumber < this->firstPending || frameNumber - this->firstPending >= this->pending.size()) {
+        return;
+    }
+    Pending& frame = this->pending[frameNumber - this->firstPending];
+    frame.record.offset = offset;
+    frame.record.size = size;
+    frame.record.flags |= FRAME_INDEX_PACKET | (isKey ? FRAME_INDEX_KEY : 0);
+    frame.isSettled = true;
+    emitSettled(false);
+}
+
+void FrameIndexWriter::emitSettled(bool isAll) {
+    while (!this->pending.empty() && (this->pending.front().isSettled || isAll || this->pending.size() > MAX_PENDING)) {
+        FrameIndexRecord& record = this->pending.front().record;
+        uint32_t frameNumber = this->firstPending;
+        // without packets every frame is its own seek point (images) or only the start is known (OpenCV)
+        if (record.flags & FRAME_INDEX_KEY) {
+            this->lastKeyFrame = frameNumber;
+        } else if (!(record.flags & FRAME_INDEX_PACKET) && (record.flags & FRAME_INDEX_IMAGE)) {
+            this->lastKeyFrame = frameNumber;
+        }
+        record.keyFrame = this->lastKeyFrame;
+        this->file.write(&record, sizeof(record));
+        this->pending.pop_front();
+        this->firstPending++;
+    }
+}
+
+void FrameIndexWriter::close() {
+    if (!isOpened()) {
+        return;
+    }
+    emitSettled(true);
+    this->file.close();
+}
+
+FrameIndexReader::~FrameIndexReader() {
+    close();
+}
+
+bool FrameIndexReader::open(const std::string& fileName) {
+    close();
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        this->errorMsg = "Failed to open file: " + fileName;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FrameIndexHeader)) {
+        ::close(fd);
+        this->errorMsg = "Not a frame index: " + fileName;
+        return false;
+    }
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        this->errorMsg = "Failed to map file: " + fileName;
+        return false;
+    }
+
+    FrameIndexHeader header;
+    FrameIndexHeader expected;
+    std::memcpy(&header, map, sizeof(header));
+    if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.recordSize != sizeof(FrameIndexRecord)) {
+        munmap(map, st.st_size);
+        this->errorMsg = "Not a frame index: " + fileName;
+        return false;
+    }
+    this->map = map;
+    this->mapSize = st.st_size;
+    this->records = (const FrameIndexRecord *)((const char *)map + sizeof(header));
+    // a file still being written can end in a partial record
+    this->count = (this->mapSize - sizeof(header)) / sizeof(FrameIndexRecord);
+    madvise(map, st.st_size, MADV_RANDOM);
+    return true;
+}
+
+void FrameIndexReader::close() {
+    if (this->map != nullptr) {
+        munmap(this->map, this->mapSize);
+    }
+    this->map = nullptr;
+    this->mapSize = 0;
+    this->records = nullptr;
+    this->count = 0;
+}
+
+size_t FrameIndexReader::size() const {
+    return this->count;
+}
+
+const FrameIndexRecord& FrameIndexReader::at(size_t frameNumber) const {
+    return this->records[frameNumber];
+}
+
+int64_t FrameIndexReader::findFrame(uint64_t timeStampUs) const {
+    auto end = this->records + this->count;
+    auto it = std::upper_bound(this->records, end, timeStampUs,
+                               [](uint64_t t, const FrameIndexRecord& record) { return t < record.timeStampUs; });
+    return (int64_t)(it - this->records) - 1;
+}
+
+int64_t FrameIndexReader::findNearestFrame(uint64_t timeStampUs) const {
+    if (this->count == 0) {
+        return -1;
+    }
+    int64_t before = findFrame(timeStampUs);
+    if (before < 0) {
+        return 0;
+    }
+    if ((size_t)before + 1 >= this->count) {
+        return before;
+    }
+    uint64_t toBefore = timeStampUs - this->records[before].timeStampUs;
+    uint64_t toAfter = this->records[before + 1].timeStampUs - timeStampUs;
+    return toAfter < toBefore ? before + 1 : before;
+}
+
+int64_t FrameIndexReader::findKeyFrame(size_t frameNumber) const {
+    if (frameNumber >= this->count) {
+        return -1;
+    }
+    return this->records[frameNumber].keyFrame;
+}
@@ -0,0 +1,282 @@
+#include <algorithm>
+#include "frame_source.hpp"
+
+OBFrameType frameTypeOf(OBSensorType sensorType) {
+    switch (sensorType) {
+        case OB_SENSOR_COLOR:
+            return OB_FRAME_COLOR;
+        case OB_SENSOR_DEPTH:
+            return OB_FRAME_DEPTH;
+        case OB_SENSOR_IR_LEFT:
+            return OB_FRAME_IR_LEFT;
+        case OB_SENSOR_IR_RIGHT:
+            return OB_FRAME_IR_RIGHT;
+        case OB_SENSOR_GYRO:
+            return OB_FRAME_GYRO;
+        case OB_SENSOR_ACCEL:
+            return OB_FRAME_ACCEL;
+        default:
+            return OB_FRAME_UNKNOWN;
+    }
+}
+
+std::shared_ptr<FrameSource> createFrameSource(const Settings& settings) {
+    if (settings.frameSource == "synthetic") {
+        std::string profileDir = settings.sourceDir.empty() ? settings.saveDir : settings.sourceDir;
+        return std::make_shared<SyntheticFrameSource>(profileDir, settings.sourceRealtime, settings.sourceRate);
+    } else if (settings.frameSource == "replay") {
+        return std::make_shared<ReplayFrameSource>(settings.sourceDir, settings.sourceRealtime);
+    }
+    return std::make_shared<OrbbecFrameSource>();
+}
+
+bool FrameSource::storeFrameCallback(FrameCallback callback) {
+    std::lock_guard<std::mutex> lock(this->frameCallbackMutex);
+    std::unique_ptr<FrameCallback> next = callback ? std::make_unique<FrameCallback>(callback) : nullptr;
+    this->frameCallback.store(next.get());
+    // a call that started before the swap may still be using the old callback
+    while (this->frameCallbacksInFlight.load() > 0) {
+        std::this_thread::yield();
+    }
+    this->frameCallbackOwner = std::move(next);
+    // stays in callback mode once chosen: a cleared callback just drops frames
+    if (callback) {
+        this->hasFrameCallback.store(true);
+    }
+    return true;
+}
+
+bool FrameSource::isCallbackMode() {
+    return this->hasFrameCallback.load();
+}
+
+void FrameSource::deliverFrame(std::shared_ptr<SourceFrame> frame) {
+    // counted before the load, so a setter that sees no call in flight also sees no old pointer in use
+    struct InFlight {
+        std::atomic<int>& count;
+        explicit InFlight(std::atomic<int>& count) : count(count) { this->count.fetch_add(1); }
+        ~InFlight() { this->count.fetch_sub(1); }
+    } inFlight(this->frameCallbacksInFlight);
+    FrameCallback *callback = this->frameCallback.load();
+    if (callback != nullptr) {
+        (*callback)(frame);
+    }
+}
+
+OrbbecFrameSource::OrbbecFrameSource() {
+    // Get connected device list
+    // Assert only one device is connected
+    auto devList = this->context.queryDeviceList();
+    if (devList->deviceCount() == 0) {
+        throw std::runtime_error("No device found!");
+    }
+    this->device = devList->getDevice(0);
+    this->pipe = std::make_shared<ob::Pipeline>(this->device);
+    this->config = std::make_shared<ob::Config>();
+}
+
+std::string OrbbecFrameSource::getName() {
+    return "orbbec";
+}
+
+bool OrbbecFrameSource::hasSensor(OBSensorType sensorType) {
+    return this->device->getSensorList()->getSensor(sensorType) != nullptr;
+}
+
+VideoProfileInfo OrbbecFrameSource::getVideoProfile(OBSensorType sensorType, int profileIdx) {
+    auto cached = this->profileCache.find({sensorType, profileIdx});
+    if (cached != this->profileCache.end()) {
+        return cached->second;
+    }
+    auto profile = this->pipe->getStreamProfileList(sensorType)->getProfile(profileIdx)->as<ob::VideoStreamProfile>();
+
+    VideoProfileInfo info;
+    info.format = profile->format();
+    info.width = profile->width();
+    info.height = profile->height();
+    info.fps = profile->fps();
+    info.intrinsic = profile->getIntrinsic();
+    info.distortion = profile->getDistortion();
+
+    if (sensorType == OB_SENSOR_COLOR) {
+        this->profileCache[{sensorType, profileIdx}] = info;
+        return info;
+    }
+    try {
+        auto colorProfile = this->pipe->getStreamProfileList(OB_SENSOR_COLOR)
+            ->getProfile(OB_PROFILE_DEFAULT)
+            ->as<ob::VideoStreamProfile>();
+        info.extrinsic = profile->getExtrinsicTo(colorProfile);
+        info.hasExtrinsic = true;
+    } catch (ob::Error &e) {
+        std::cerr << "Error: " << e.getMessage() << std::endl;
+    }
+    this->profileCache[{sensorType, profileIdx}] = info;
+    return info;
+}
+
+void OrbbecFrameSource::enableStream(OBSensorType sensorType, int profileIdx) {
+    // already part of the running pipeline (a later record on a warm device)
+    OBFrameType type = frameTypeOf(sensorType);
+    bool isEnabled = std::find(this->enabledTypes.begin(), this->enabledTypes.end(), type) != this->enabledTypes.end();
+    if (isEnabled && this->enabledProfileIdx[sensorType] == profileIdx) {
+        return;
+    }
+    auto profile = this->pipe->getStreamProfileList(sensorType)->getProfile(profileIdx);
+    this->config->enableStream(profile);
+    this->enabledProfileIdx[sensorType] = profileIdx;
+    if (!isEnabled) {
+        this->enabledTypes.push_back(type);
+        this->enabledProfiles.push_back({sensorType, profile});
+        return;
+    }
+
+    // the record asks for another profile than the one streaming: restart with it
+    std::cerr << "[WARN] Restarting sensor " << sensorType << " for profile " << profileIdx << std::endl;
+    for (auto &enabled : this->enabledProfiles) {
+        if (enabled.first == sensorType) {
+            enabled.second = profile;
+        }
+    }
+    if (!this->isStarted) {
+        return;
+    }
+    auto it = this->videoSensors.find(sensorType);
+    if (it != this->videoSensors.end()) {
+        it->second->stop();
+        startSensor(sensorType, profile);
+    } else {
+        this->pipe->stop();
+        this->pipe->start(this->config);
+    }
+}
+
+void OrbbecFrameSource::startImu(OBSensorType sensorType, int profileIdx, ImuCallback callback) {
+    auto sensor = this->device->getSensorList()->getSensor(sensorType);
+    auto profile = sensor->getStreamProfileList()->getProfile(profileIdx);
+    auto frameCallback = [sensorType, callback](std::shared_ptr<ob::Frame> frame) {
+        ImuSample sample;
+        sample.timeStamp = frame->timeStamp();
+        if (sensorType == OB_SENSOR_GYRO) {
+            auto gyroFrame = frame->as<ob::GyroFrame>();
+            if (gyroFrame == nullptr) {
+                return;
+            }
+            auto value = gyroFrame->value();
+            sample.temperature = gyroFrame->temperature();
+            sample.x = value.x;
+            sample.y = value.y;
+            sample.z = value.z;
+        } else {
+            auto accelFrame = frame->as<ob::AccelFrame>();
+            if (accelFrame == nullptr) {
+                return;
+            }
+            auto value = accelFrame->value();
+            sample.temperature = accelFrame->temperature();
+            sample.x = value.x;
+            sample.y = value.y;
+            sample.z = value.z;
+        }
+        callback(sample);
+    };
+    sensor->start(profile, frameCallback);
+    this->imuSensors[sensorType] = sensor;
+}
+
+void OrbbecFrameSource::stopImu(OBSensorType sensorType) {
+    auto it = this->imuSensors.find(sensorType);
+    if (it == this->imuSensors.end()) {
+        return;
+    }
+    try {
+        it->second->stop();
+    } catch (ob::Error &e) {
+        std::cerr << "Error: " << e.getMessage() << std::endl;
+    }
+    this->imuSensors.erase(it);
+}
+
+void OrbbecFrameSource::start() {
+    this->isStarted = true;
+    if (!isCallbackMode()) {
+        this->pipe->start(this->config);
+        return;
+    }
+    // each sensor delivers at its own rate, without waiting for a matching frameset
+    for (auto &enabled : this->enabledProfiles) {
+        startSensor(enabled.first, enabled.second);
+    }
+}
+
+void OrbbecFrameSource::startSensor(OBSensorType sensorType, std::shared_ptr<ob::StreamProfile> profile) {
+    OBFrameType type = frameTypeOf(sensorType);
+    auto sensor = this->device->getSensorList()->getSensor(sensorType);
+    sensor->start(profile, [this, type](std::shared_ptr<ob::Frame> frame) {
+        if (frame != nullptr) {
+            deliverFrame(wrapFrame(frame, type));
+        }
+    });
+    this->videoSensors[sensorType] = sensor;
+}
+
+void OrbbecFrameSource::stop() {
+    this->isStarted = false;
+    if (this->videoSensors.empty()) {
+        this->pipe->stop();
+        return;
+    }
+    for (auto &sensor : this->videoSensors) {
+        try {
+            sensor.second->stop();
+        } catch (ob::Error &e) {
+            std::cerr << "Error: " << e.getMessage() << std::endl;
+        }
+    }
+    this->videoSensors.clear();
+}
+
+bool OrbbecFrameSource::setFrameCallback(FrameCallback callback) {
+    return storeFrameCallback(callback);
+}
+
+std::shared_ptr<SourceFrameSet> OrbbecFrameSource::waitForFrames(uint32_t timeoutMs) {
+    auto frameset = this->pipe->waitForFrames(timeoutMs);
+    if (frameset == nullptr) {
+        return nullptr;
+    }
+
+    auto sourceFrameSet = std::make_shared<SourceFrameSet>();
+    for (auto type : this->enabledTypes) {
+        std::shared_ptr<ob::Frame> frame;
+        if (type == OB_FRAME_COLOR) {
+            frame = frameset->colorFrame();
+        } else if (type == OB_FRAME_DEPTH) {
+            frame = frameset->depthFrame();
+        } else {
+            frame = frameset->getFrame(type);
+        }
+        if (frame != nullptr) {
+            sourceFrameSet->frames.push_back(wrapFrame(frame, type));
+        }
+    }
+    return sourceFrameSet;
+}
+
+std::shared_ptr<SourceFrame> OrbbecFrameSource::wrapFrame(std::shared_ptr<ob::Frame> frame, OBFrameType type) {
+    auto sourceFrame = std::make_shared<SourceFrame>();
+    auto videoFrame = frame->as<ob::VideoFrame>();
+    sourceFrame->type = type;
+    sourceFrame->format = frame->format();
+    sourceFrame->width = videoFrame->width();
+    sourceFrame->height = videoFrame->height();
+    sourceFrame->timeStamp = frame->timeStamp();
+    sourceFrame->timeStampUs = frame->timeStampUs();
+    if (type == OB_FRAME_DEPTH) {
+        sourceFrame->valueScale = frame->as<ob::DepthFrame>()->getValueScale();
+    }
+    sourceFrame->data = static_cast<uint8_t *>(frame->data());
+    sourceFrame->dataSize = frame->dataSize();
+    sourceFrame->sdkFrame = frame;
+    return sourceFrame;
+}
@@ -0,0 +1,130 @@
+#include <ctime>
+#include <iostream>
+#include "gpio_manager.hpp"
+
+extern "C" {
+    #include <gpiod.h>
+    #include <stdlib.h>
+    #include <stdio.h>
+    #include <unistd.h>
+}
+
+namespace {
+
+// Event timestamps are CLOCK_MONOTONIC since Linux 5.7 and CLOCK_REALTIME before
+std::chrono::steady_clock::time_point toSteadyTime(const struct timespec& ts) {
+    auto now = std::chrono::steady_clock::now();
+    int64_t eventNs = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    int64_t monoNs = (int64_t)mono.tv_sec * 1000000000 + mono.tv_nsec;
+    int64_t realNs = (int64_t)real.tv_sec * 1000000000 + real.tv_nsec;
+    int64_t ageNs = monoNs - eventNs;
+    if (ageNs < 0 || ageNs > 3600LL * 1000000000) {
+        ageNs = realNs - eventNs;
+    }
+    if (ageNs < 0) {
+        ageNs = 0;
+    }
+    return now - std::chrono::nanoseconds(ageNs);
+}
+
+}
+
+LibgpiodBackend::LibgpiodBackend(const std::string& inputChip, int inputLine, const std::string& outputChip, int outputLine) {
+    // Open GPIO_PDU_C
+    this->chip_PDU_C = gpiod_chip_open_by_name(inputChip.c_str());
+    if (!this->chip_PDU_C) {
+        perror("Open chip failed");
+        exit(1);
+    }
+
+    this->line_PDU_C = gpiod_chip_get_line(this->chip_PDU_C, inputLine);
+    if (!this->line_PDU_C) {
+        perror("Get line failed");
+        gpiod_chip_close(this->chip_PDU_C);
+        exit(1);
+    }
+
+    // both edges, so level changes arrive as kernel-timestamped events
+    if (gpiod_line_request_both_edges_events(this->line_PDU_C, "gpio_manager") < 0) {
+        perror("Request line events failed");
+        gpiod_chip_close(this->chip_PDU_C);
+        exit(1);
+    }
+
+    // Open GPIO_camera
+    this->chip_camera = gpiod_chip_open_by_name(outputChip.c_str());
+    if (!this->chip_camera) {
+        perror("Open chip failed");
+        exit(1);
+    }
+
+    this->line_camera = gpiod_chip_get_line(this->chip_camera, outputLine);
+    if (!this->line_camera) {
+        perror("Get line failed");
+        gpiod_chip_close(this->chip_camera);
+        exit(1);
+    }
+
+    if (gpiod_line_request_output(this->line_camera, "gpio_manager", 0) < 0) {
+        perror("Request line as output failed");
+        gpiod_chip_close(this->chip_camera);
+        exit(1);
+    }
+}
+
+LibgpiodBackend::~LibgpiodBackend() {
+    gpiod_line_release(this->line_PDU_C);
+    gpiod_chip_close(this->chip_PDU_C);
+
+    gpiod_line_release(this->line_camera);
+    gpiod_chip_close(this->chip_camera);
+}
+
+std::string LibgpiodBackend::getName() {
+    return "libgpiod";
+}
+
+int LibgpiodBackend::readInput() {
+    int val = gpiod_line_get_value(this->line_PDU_C);
+    if (val < 0) {
+        perror("Read line input failed");
+    }
+    return val;
+}
+
+int LibgpiodBackend::waitEdge(int timeoutMs, GpioEdge& edge) {
+    struct timespec timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (long)(timeoutMs % 1000) * 1000000;
+    int ret = gpiod_line_event_wait(this->line_PDU_C, &timeout);
+    if (ret <= 0) {
+        return ret;
+    }
+    struct gpiod_line_event event;
+    if (gpiod_line_event_read(this->line_PDU_C, &event) < 0) {
+        perror("Read line event failed");
+        return -1;
+    }
+    edge.isRising = event.event_type == GPIOD_LINE_EVENT_RISING_EDGE;
+    edge.time = toSteadyTime(event.ts);
+    return 1;
+}
+
+void LibgpiodBackend::setOutput(bool value) {
+    if (gpiod_line_set_value(this->line_camera, value) < 0) {
+        perror("Set line output failed");
+    }
+}
+
+std::unique_ptr<GpioBackend> createGpioBackend(const Settings& settings) {
+    if (settings.gpioBackend == "fake") {
+        return std::make_unique<FakeGpioBackend>();
+    }
+    if (settings.gpioBackend != "libgpiod") {
+        std::cerr << "Unknown GPIO backend: " << settings.gpioBackend << ", using libgpiod" << std::endl;
+    }
+    return std::make_unique<LibgpiodBackend>(settings.gpioInputChip, settings.gpioInputLine, settings.gpioOutputChip, settings.gpioOutputLine);
+}
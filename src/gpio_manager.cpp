@@ -1,80 +1,153 @@
+#include <algorithm>
 #include "gpio_manager.hpp"
 
-GpioManager::GpioManager() {
-    // Open GPIO_PDU_C
-    this->chip_PDU_C = gpiod_chip_open_by_name(this->GPIO_PDU_C_CHIPNAME);
-    if (!this->chip_PDU_C) {
-        perror("Open chip failed");
-        exit(1);
-    }
+FakeGpioBackend::FakeGpioBackend(bool initialLevel) {
+    this->level = initialLevel;
+}
 
-    this->line_PDU_C = gpiod_chip_get_line(this->chip_PDU_C, this->GPIO_PDU_C_LINE_OFFSET);
-    if (!this->line_PDU_C) {
-        perror("Get line failed");
-        gpiod_chip_close(this->chip_PDU_C);
-        exit(1);
-    }
+std::string FakeGpioBackend::getName() {
+    return "fake";
+}
 
-    if (gpiod_line_request_input(this->line_PDU_C, "gpio_manager") < 0) {
-        perror("Request line as input failed");
-        gpiod_chip_close(this->chip_PDU_C);
-        exit(1);
-    }
+int FakeGpioBackend::readInput() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->level ? 1 : 0;
+}
 
-    // Open GPIO_camera
-    this->chip_camera = gpiod_chip_open_by_name(this->GPIO_camera_CHIPNAME);
-    if (!this->chip_camera) {
-        perror("Open chip failed");
-        exit(1);
+int FakeGpioBackend::waitEdge(int timeoutMs, GpioEdge& edge) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (!this->cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return !this->edges.empty(); })) {
+        return 0;
     }
+    edge = this->edges.front();
+    this->edges.pop_front();
+    return 1;
+}
 
-    this->line_camera = gpiod_chip_get_line(this->chip_camera, this->GPIO_camera_LINE_OFFSET);
-    if (!this->line_camera) {
-        perror("Get line failed");
-        gpiod_chip_close(this->chip_camera);
-        exit(1);
-    }
+void FakeGpioBackend::setOutput(bool value) {
+    this->output.store(value);
+}
 
-    if (gpiod_line_request_output(this->line_camera, "gpio_manager", 0) < 0) {
-        perror("Request line as output failed");
-        gpiod_chip_close(this->chip_camera);
-        exit(1);
+void FakeGpioBackend::setInput(bool level) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (level == this->level) {
+            return;
+        }
+        this->level = level;
+        GpioEdge edge;
+        edge.isRising = level;
+        edge.time = std::chrono::steady_clock::now();
+        this->edges.push_back(edge);
     }
+    this->cv.notify_all();
 }
 
-GpioManager::~GpioManager() {
-    gpiod_line_release(this->line_PDU_C);
-    gpiod_chip_close(this->chip_PDU_C);
+bool FakeGpioBackend::getOutput() {
+    return this->output.load();
+}
 
-    gpiod_line_release(this->line_camera);
-    gpiod_chip_close(this->chip_camera);
+GpioManager::GpioManager(std::unique_ptr<GpioBackend> backend, int debounceMs) {
+    this->backend = std::move(backend);
+    this->debounceMs = std::max(debounceMs, 0);
+    this->return_val = this->backend->readInput() == 1;
+    this->lastEdgeTime = std::chrono::steady_clock::now();
+    this->isRunning.store(true);
+    this->monitor = std::thread(&GpioManager::monitorLoop, this);
 }
 
-bool GpioManager::get_GPIO_PDU_C() {
-    int val = gpiod_line_get_value(this->line_PDU_C);
-    if (val < 0) {
-        perror("Read line input failed");
-        return this->return_val;
+GpioManager::~GpioManager() {
+    this->isRunning.store(false);
+    if (this->monitor.joinable()) {
+        this->monitor.join();
     }
+}
 
-    bool current_PDU_C_val = (val == 1);
-    if (current_PDU_C_val == last_PDU_C_val) {
-        PDU_C_continuous_count++;
-    } else {
-        last_PDU_C_val = current_PDU_C_val;
-        PDU_C_continuous_count = 0;
-    }
+bool GpioManager::get_GPIO_PDU_C() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->return_val;
+}
 
-    if (PDU_C_continuous_count >= PDU_C_continuous_threshold) {
-        this->return_val = current_PDU_C_val;
+bool GpioManager::wait_GPIO_PDU_C(bool level, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    auto isLevel = [this, level] { return this->return_val == level; };
+    if (timeoutMs < 0) {
+        this->cv.wait(lock, isLevel);
+        return true;
     }
+    return this->cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), isLevel);
+}
 
-    return this->return_val;
+std::future<bool> GpioManager::wait_GPIO_PDU_C_async(bool level, int timeoutMs) {
+    return std::async(std::launch::async, &GpioManager::wait_GPIO_PDU_C, this, level, timeoutMs);
+}
+
+std::chrono::steady_clock::time_point GpioManager::getLastEdgeTime() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->lastEdgeTime;
 }
 
 void GpioManager::set_GPIO_camera(bool value) {
-    if (gpiod_line_set_value(this->line_camera, value) < 0) {
-        perror("Set line output failed");
-    }
+    this->backend->setOutput(value);
+}
+
+GpioBackend *GpioManager::getBackend() {
+    return this->backend.get();
 }
 
+// A change is accepted once no edge has followed it for debounceMs and the line still
+// reads that level. Bounces that return to the accepted level cancel it; the first edge
+// of the burst is the trigger time.
+void GpioManager::monitorLoop() {
+    auto debounce = std::chrono::milliseconds(this->debounceMs);
+    bool stable = get_GPIO_PDU_C();
+    bool pending = stable;
+    bool hasPending = false;
+    std::chrono::steady_clock::time_point burstStart;
+    std::chrono::steady_clock::time_point deadline;
+    while (this->isRunning.load()) {
+        int timeoutMs = 100;
+        if (hasPending) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            timeoutMs = (int)std::max<int64_t>(std::min<int64_t>(remaining.count() + 1, 100), 0);
+        }
+
+        GpioEdge edge;
+        int ret = this->backend->waitEdge(timeoutMs, edge);
+        auto now = std::chrono::steady_clock::now();
+        if (ret <= 0) {
+            // no edge events, or a quiet line: sample the level, so a dropped edge is
+            // caught and nothing is accepted that the line does not read
+            int value = this->backend->readInput();
+            if (ret < 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            ret = 0;
+            if (value >= 0 && (value == 1) != pending) {
+                edge.isRising = value == 1;
+                edge.time = now;
+                ret = 1;
+            }
+        }
+        if (ret > 0) {
+            // a bounce back does not end the burst until the line has been quiet
+            if (!hasPending && now >= deadline) {
+                burstStart = edge.time;
+            }
+            pending = edge.isRising;
+            hasPending = pending != stable;
+            deadline = std::min(edge.time, now) + debounce;
+            continue;
+        }
+        if (hasPending && now >= deadline) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->return_val = pending;
+                this->lastEdgeTime = burstStart;
+            }
+            this->cv.notify_all();
+            stable = pending;
+            hasPending = false;
+        }
+    }
+}
@@ -0,0 +1,161 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include "image_encoder_pool.hpp"
+#include "thread_placement.hpp"
+#include "trace.hpp"
+
+ImageEncoderPool::ImageEncoderPool(int threads, int queueDepth) :
+    queue(queueDepth, DropPolicy::BLOCK) {
+    if (threads <= 0) {
+        threads = 1;
+    }
+    for (int i = 0; i < threads; i++) {
+        this->workers.emplace_back(&ImageEncoderPool::workerLoop, this, i);
+    }
+}
+
+ImageEncoderPool::~ImageEncoderPool() {
+    close();
+}
+
+int ImageEncoderPool::registerChannel(const std::string& name) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    int channel = (int)this->channels.size();
+    this->channels[channel].name = name;
+    return channel;
+}
+
+void ImageEncoderPool::submit(int channel, const std::string& fileName, const cv::Mat& image,
+                              const std::vector<int>& params, std::shared_ptr<void> owner) {
+    Job job;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        job.seq = this->channels[channel].nextSeq++;
+    }
+    job.channel = channel;
+    job.fileName = fileName;
+    job.image = image;
+    job.params = params;
+    job.owner = owner;
+    uint64_t seq = job.seq;
+    if (!this->queue.push(std::move(job))) {
+        // only after close(): count it as failed so flush() still returns
+        complete(channel, seq, Encoded{fileName, {}, false});
+    }
+}
+
+void ImageEncoderPool::submitEncoded(int channel, const std::string& fileName, std::vector<uint8_t> data) {
+    uint64_t seq;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        seq = this->channels[channel].nextSeq++;
+    }
+    complete(channel, seq, Encoded{fileName, std::move(data), true});
+}
+
+void ImageEncoderPool::workerLoop(int index) {
+    placeThread("imageEncoder", "imgenc_" + std::to_string(index));
+    Job job;
+    while (this->queue.pop(job)) {
+        Encoded encoded;
+        encoded.fileName = job.fileName;
+        std::string ext = std::filesystem::path(job.fileName).extension().string();
+        try {
+            TraceSpan span("imencode");
+            encoded.isOk = cv::imencode(ext, job.image, encoded.data, job.params);
+        } catch (std::exception &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            encoded.isOk = false;
+        }
+        job.image.release();
+        job.owner.reset();
+        complete(job.channel, job.seq, std::move(encoded));
+    }
+}
+
+void ImageEncoderPool::complete(int channel, uint64_t seq, Encoded encoded) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    Channel& ch = this->channels[channel];
+    if (seq != ch.nextWrite) {
+        ch.reordered++;
+    }
+    ch.ready.emplace(seq, std::move(encoded));
+    // one thread at a time writes the channel, always the lowest pending sequence
+    if (ch.isWriting) {
+        return;
+    }
+    ch.isWriting = true;
+    while (!ch.ready.empty() && ch.ready.begin()->first == ch.nextWrite) {
+        Encoded next = std::move(ch.ready.begin()->second);
+        ch.ready.erase(ch.ready.begin());
+        lock.unlock();
+
+        bool isOk = next.isOk;
+        if (isOk) {
+            TraceSpan span("imageFile");
+            std::ofstream ofs(next.fileName, std::ios::binary);
+            ofs.write((const char *)next.data.data(), next.data.size());
+            isOk = ofs.good();
+        }
+        if (!isOk) {
+            std::cerr << "Failed to write image: " << next.fileName << std::endl;
+        }
+
+        lock.lock();
+        ch.nextWrite++;
+        if (isOk) {
+            ch.written++;
+            ch.bytes += next.data.size();
+        } else {
+            ch.failed++;
+        }
+    }
+    ch.isWriting = false;
+    lock.unlock();
+    this->written.notify_all();
+}
+
+void ImageEncoderPool::flush(int channel) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    Channel& ch = this->channels[channel];
+    this->written.wait(lock, [&ch] { return ch.nextWrite == ch.nextSeq; });
+}
+
+void ImageEncoderPool::close() {
+    // queued jobs are still handed out after close, so nothing is lost
+    this->queue.close();
+    for (auto& worker : this->workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+int ImageEncoderPool::getThreadCount() const {
+    return (int)this->workers.size();
+}
+
+nlohmann::json ImageEncoderPool::getMetadata() {
+    nlohmann::json metadata;
+    metadata["threads"] = getThreadCount();
+    metadata["queueDepth"] = this->queue.capacity();
+    metadata["peakQueueSize"] = this->queue.getPeakCount();
+    return metadata;
+}
+
+uint64_t ImageEncoderPool::getChannelBytes(int channel) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->channels[channel].bytes;
+}
+
+nlohmann::json ImageEncoderPool::getChannelMetadata(int channel) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Channel& ch = this->channels[channel];
+    nlohmann::json metadata;
+    metadata["imagesWritten"] = ch.written;
+    metadata["imagesFailed"] = ch.failed;
+    metadata["imagesPending"] = ch.nextSeq - ch.nextWrite;
+    metadata["imagesReordered"] = ch.reordered;
+    return metadata;
+}
@@ -0,0 +1,314 @@
+#include <cstring>
+#include <algorithm>
+#include "mkv_writer.hpp"
+
+namespace {
+
+// EBML element IDs used below
+const uint32_t ID_EBML = 0x1A45DFA3;
+const uint32_t ID_EBML_VERSION = 0x4286;
+const uint32_t ID_EBML_READ_VERSION = 0x42F7;
+const uint32_t ID_EBML_MAX_ID_LENGTH = 0x42F2;
+const uint32_t ID_EBML_MAX_SIZE_LENGTH = 0x42F3;
+const uint32_t ID_DOC_TYPE = 0x4282;
+const uint32_t ID_DOC_TYPE_VERSION = 0x4287;
+const uint32_t ID_DOC_TYPE_READ_VERSION = 0x4285;
+const uint32_t ID_SEGMENT = 0x18538067;
+const uint32_t ID_SEEK_HEAD = 0x114D9B74;
+const uint32_t ID_SEEK = 0x4DBB;
+const uint32_t ID_SEEK_ID = 0x53AB;
+const uint32_t ID_SEEK_POSITION = 0x53AC;
+const uint32_t ID_INFO = 0x1549A966;
+const uint32_t ID_TIMESTAMP_SCALE = 0x2AD7B1;
+const uint32_t ID_DURATION = 0x4489;
+const uint32_t ID_MUXING_APP = 0x4D80;
+const uint32_t ID_WRITING_APP = 0x5741;
+const uint32_t ID_TRACKS = 0x1654AE6B;
+const uint32_t ID_TRACK_ENTRY = 0xAE;
+const uint32_t ID_TRACK_NUMBER = 0xD7;
+const uint32_t ID_TRACK_UID = 0x73C5;
+const uint32_t ID_TRACK_TYPE = 0x83;
+const uint32_t ID_FLAG_LACING = 0x9C;
+const uint32_t ID_CODEC_ID = 0x86;
+const uint32_t ID_DEFAULT_DURATION = 0x23E383;
+const uint32_t ID_VIDEO = 0xE0;
+const uint32_t ID_PIXEL_WIDTH = 0xB0;
+const uint32_t ID_PIXEL_HEIGHT = 0xBA;
+const uint32_t ID_CLUSTER = 0x1F43B675;
+const uint32_t ID_CLUSTER_TIMESTAMP = 0xE7;
+const uint32_t ID_SIMPLE_BLOCK = 0xA3;
+const uint32_t ID_CUES = 0x1C53BB6B;
+const uint32_t ID_CUE_POINT = 0xBB;
+const uint32_t ID_CUE_TIME = 0xB3;
+const uint32_t ID_CUE_TRACK_POSITIONS = 0xB7;
+const uint32_t ID_CUE_TRACK = 0xF7;
+const uint32_t ID_CUE_CLUSTER_POSITION = 0xF1;
+
+// A new cluster is started after this span, SimpleBlock offsets are int16
+const uint64_t CLUSTER_SPAN_MS = 1000;
+const uint64_t UNKNOWN_SIZE = 0x00FFFFFFFFFFFFFF;
+
+void putId(std::string& buf, uint32_t id) {
+    int bytes = id > 0xFFFFFF ? 4 : id > 0xFFFF ? 3 : id > 0xFF ? 2 : 1;
+    for (int i = bytes - 1; i >= 0; i--) {
+        buf.push_back((char)(id >> (8 * i)));
+    }
+}
+
+// width 0 picks the shortest encoding
+void putSize(std::string& buf, uint64_t size, int width = 0) {
+    if (width == 0) {
+        width = 1;
+        while (width < 8 && size >= (1ULL << (7 * width)) - 1) {
+            width++;
+        }
+    }
+    size |= 1ULL << (7 * width);
+    for (int i = width - 1; i >= 0; i--) {
+        buf.push_back((char)(size >> (8 * i)));
+    }
+}
+
+void putUintData(std::string& buf, uint64_t value, int width) {
+    for (int i = width - 1; i >= 0; i--) {
+        buf.push_back((char)(value >> (8 * i)));
+    }
+}
+
+void putUint(std::string& buf, uint32_t id, uint64_t value) {
+    int width = 1;
+    while (width < 8 && (value >> (8 * width)) != 0) {
+        width++;
+    }
+    putId(buf, id);
+    putSize(buf, width);
+    putUintData(buf, value, width);
+}
+
+void putString(std::string& buf, uint32_t id, const std::string& value) {
+    putId(buf, id);
+    putSize(buf, value.size());
+    buf += value;
+}
+
+void putMaster(std::string& buf, uint32_t id, const std::string& children) {
+    putId(buf, id);
+    putSize(buf, children.size());
+    buf += children;
+}
+
+}
+
+MkvWriter::~MkvWriter() {
+    release();
+}
+
+bool MkvWriter::open(const std::string& fileName, const std::string& codecId, int width, int height, float fps) {
+    release();
+    this->ofs.open(fileName, std::ios::binary | std::ios::trunc);
+    if (!this->ofs.is_open()) {
+        return false;
+    }
+    this->hasFirstTimeStamp = false;
+    this->isClusterOpen = false;
+    this->lastTime = 0;
+    this->frameCount = 0;
+    this->cues.clear();
+
+    // EBML header
+    std::string header;
+    std::string ebml;
+    putUint(ebml, ID_EBML_VERSION, 1);
+    putUint(ebml, ID_EBML_READ_VERSION, 1);
+    putUint(ebml, ID_EBML_MAX_ID_LENGTH, 4);
+    putUint(ebml, ID_EBML_MAX_SIZE_LENGTH, 8);
+    putString(ebml, ID_DOC_TYPE, "matroska");
+    putUint(ebml, ID_DOC_TYPE_VERSION, 4);
+    putUint(ebml, ID_DOC_TYPE_READ_VERSION, 2);
+    putMaster(header, ID_EBML, ebml);
+
+    // Segment size stays unknown until release()
+    putId(header, ID_SEGMENT);
+    putSize(header, UNKNOWN_SIZE, 8);
+    this->segmentDataPos = header.size();
+
+    std::string info;
+    putUint(info, ID_TIMESTAMP_SCALE, 1000000);
+    putId(info, ID_DURATION);
+    putSize(info, 8);
+    size_t durationOffset = info.size();
+    info.append(8, '\0');
+    putString(info, ID_MUXING_APP, "rover_recorder");
+    putString(info, ID_WRITING_APP, "rover_recorder");
+
+    std::string video;
+    putUint(video, ID_PIXEL_WIDTH, width);
+    putUint(video, ID_PIXEL_HEIGHT, height);
+    std::string track;
+    putUint(track, ID_TRACK_NUMBER, 1);
+    putUint(track, ID_TRACK_UID, 1);
+    putUint(track, ID_TRACK_TYPE, 1);
+    putUint(track, ID_FLAG_LACING, 0);
+    putString(track, ID_CODEC_ID, codecId);
+    if (fps > 0) {
+        putUint(track, ID_DEFAULT_DURATION, (uint64_t)(1e9 / fps));
+    }
+    putMaster(track, ID_VIDEO, video);
+    std::string trackEntry;
+    putMaster(trackEntry, ID_TRACK_ENTRY, track);
+
+    // Seek entries use a fixed width position, so the SeekHead length is known up front
+    auto seekEntry = [](uint32_t id, uint64_t pos) {
+        std::string idBuf;
+        putId(idBuf, id);
+        std::string seek;
+        putString(seek, ID_SEEK_ID, idBuf);
+        putId(seek, ID_SEEK_POSITION);
+        putSize(seek, 8);
+        putUintData(seek, pos, 8);
+        std::string element;
+        putMaster(element, ID_SEEK, seek);
+        return element;
+    };
+    std::string seekHeadProbe;
+    putMaster(seekHeadProbe, ID_SEEK_HEAD, seekEntry(ID_INFO, 0) + seekEntry(ID_TRACKS, 0) + seekEntry(ID_CUES, 0));
+    std::string infoElement;
+    putMaster(infoElement, ID_INFO, info);
+    uint64_t infoPos = seekHeadProbe.size();
+    uint64_t tracksPos = infoPos + infoElement.size();
+
+    // Cues position is the last field of the SeekHead
+    std::string seekHead;
+    putMaster(seekHead, ID_SEEK_HEAD, seekEntry(ID_INFO, infoPos) + seekEntry(ID_TRACKS, tracksPos) + seekEntry(ID_CUES, 0));
+    this->cuesSeekPos = this->segmentDataPos + seekHead.size() - 8;
+    this->durationPos = this->segmentDataPos + infoPos + (infoElement.size() - info.size()) + durationOffset;
+    header += seekHead;
+    header += infoElement;
+    putMaster(header, ID_TRACKS, trackEntry);
+
+    this->ofs.write(header.data(), header.size());
+    return this->ofs.good();
+}
+
+bool MkvWriter::isOpened() const {
+    return this->ofs.is_open();
+}
+
+uint64_t MkvWriter::getFrameCount() const {
+    return this->frameCount;
+}
+
+void MkvWriter::setFrameIndex(FrameIndexWriter *frameIndex) {
+    this->frameIndex = frameIndex;
+}
+
+bool MkvWriter::write(const uint8_t *data, size_t size, uint64_t timeStamp) {
+    if (!this->ofs.is_open()) {
+        return false;
+    }
+    if (!this->hasFirstTimeStamp) {
+        this->firstTimeStamp = timeStamp;
+        this->hasFirstTimeStamp = true;
+    }
+    // timestamps are relative to the first frame and never go backwards
+    uint64_t time = timeStamp > this->firstTimeStamp ? timeStamp - this->firstTimeStamp : 0;
+    time = std::max(time, this->lastTime);
+
+    if (!this->isClusterOpen || time - this->clusterTime >= CLUSTER_SPAN_MS) {
+        finishCluster();
+        startCluster(time);
+    }
+
+    std::string block;
+    putId(block, ID_SIMPLE_BLOCK);
+    putSize(block, size + 4);
+    putSize(block, 1);  // track number
+    putUintData(block, (uint16_t)(time - this->clusterTime), 2);
+    block.push_back((char)0x80);  // key frame
+    this->ofs.write(block.data(), block.size());
+    // the offset is that of the frame bytes, e.g. a JPEG that can be read without demuxing
+    if (this->frameIndex) {
+        this->frameIndex->setPacket(this->frameIndex->getLastFrame(), (uint64_t)this->ofs.tellp(), (uint32_t)size, true);
+    }
+    this->ofs.write((const char *)data, size);
+
+    this->lastTime = time;
+    this->frameCount++;
+    return this->ofs.good();
+}
+
+void MkvWriter::startCluster(uint64_t time) {
+    uint64_t pos = (uint64_t)this->ofs.tellp();
+    this->cues.push_back({time, pos - this->segmentDataPos});
+
+    std::string cluster;
+    putId(cluster, ID_CLUSTER);
+    this->clusterSizePos = pos + cluster.size();
+    putSize(cluster, UNKNOWN_SIZE, 8);
+    putUint(cluster, ID_CLUSTER_TIMESTAMP, time);
+    this->ofs.write(cluster.data(), cluster.size());
+
+    this->clusterTime = time;
+    this->isClusterOpen = true;
+}
+
+void MkvWriter::finishCluster() {
+    if (!this->isClusterOpen) {
+        return;
+    }
+    uint64_t end = (uint64_t)this->ofs.tellp();
+    uint64_t size = end - (this->clusterSizePos + 8);
+    this->ofs.seekp(this->clusterSizePos);
+    std::string sizeBuf;
+    putSize(sizeBuf, size, 8);
+    this->ofs.write(sizeBuf.data(), sizeBuf.size());
+    this->ofs.seekp(end);
+    this->isClusterOpen = false;
+}
+
+void MkvWriter::patchUint(uint64_t filePos, uint64_t value) {
+    uint64_t end = (uint64_t)this->ofs.tellp();
+    std::string buf;
+    putUintData(buf, value, 8);
+    this->ofs.seekp(filePos);
+    this->ofs.write(buf.data(), buf.size());
+    this->ofs.seekp(end);
+}
+
+void MkvWriter::release() {
+    if (!this->ofs.is_open()) {
+        return;
+    }
+    finishCluster();
+
+    // Cues let players seek without scanning every cluster
+    uint64_t cuesPos = (uint64_t)this->ofs.tellp() - this->segmentDataPos;
+    std::string cuePoints;
+    for (const auto& cue : this->cues) {
+        std::string positions;
+        putUint(positions, ID_CUE_TRACK, 1);
+        putUint(positions, ID_CUE_CLUSTER_POSITION, cue.clusterPos);
+        std::string point;
+        putUint(point, ID_CUE_TIME, cue.time);
+        putMaster(point, ID_CUE_TRACK_POSITIONS, positions);
+        putMaster(cuePoints, ID_CUE_POINT, point);
+    }
+    std::string cuesElement;
+    putMaster(cuesElement, ID_CUES, cuePoints);
+    this->ofs.write(cuesElement.data(), cuesElement.size());
+
+    uint64_t end = (uint64_t)this->ofs.tellp();
+    patchUint(this->cuesSeekPos, cuesPos);
+
+    // Duration is a big endian double in ms
+    double duration = (double)this->lastTime;
+    uint64_t durationBits;
+    std::memcpy(&durationBits, &duration, sizeof(durationBits));
+    patchUint(this->durationPos, durationBits);
+
+    std::string segmentSize;
+    putSize(segmentSize, end - this->segmentDataPos, 8);
+    this->ofs.seekp(this->segmentDataPos - 8);
+    this->ofs.write(segmentSize.data(), segmentSize.size());
+    this->ofs.close();
+}
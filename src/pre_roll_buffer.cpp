@@ -0,0 +1,242 @@
+#include "pre_roll_buffer.hpp"
+#include "color_convert.hpp"
+#include "thread_placement.hpp"
+#include "trace.hpp"
+
+namespace {
+
+// framesets waiting for the compression thread; past this the oldest is dropped so the
+// source's buffers are not held back
+const size_t MAX_PENDING = 16;
+
+// live framesets held behind the ring while it drains; past this push() waits for room
+const size_t MAX_LIVE = 16;
+
+}
+
+PreRollBuffer::PreRollBuffer(float seconds, size_t budgetBytes, int jpegQuality) {
+    this->seconds = seconds;
+    this->budgetBytes = budgetBytes;
+    this->jpegParams = {cv::IMWRITE_JPEG_QUALITY, jpegQuality};
+    // fastest zlib level: the ring is filled at the camera rate
+    this->pngParams = {cv::IMWRITE_PNG_COMPRESSION, 1};
+    this->compressThread = std::thread(&PreRollBuffer::compressLoop, this);
+}
+
+PreRollBuffer::~PreRollBuffer() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->isStopping = true;
+    }
+    this->pendingCv.notify_all();
+    this->liveCv.notify_all();
+    if (this->compressThread.joinable()) {
+        this->compressThread.join();
+    }
+}
+
+bool PreRollBuffer::push(const SourceFrameSet& frameset) {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        if (this->isTriggered) {
+            // once the compressed part is out no more is taken in, so the drain ends; the
+            // frameset then waits for the held ones to leave and goes after them
+            this->liveCv.wait(lock, [this] {
+                bool isBacklogOut = this->ring.empty() && !this->isCompressing;
+                return this->isClosed || this->isStopping || (!isBacklogOut && this->live.size() < MAX_LIVE);
+            });
+            if (this->isClosed || this->isStopping) {
+                return false;
+            }
+            this->live.push_back(frameset);
+            this->liveCount++;
+            return true;
+        }
+        if (this->isClosed) {
+            return false;
+        }
+        if (this->pending.size() >= MAX_PENDING) {
+            this->pending.pop_front();
+            this->pendingDropCount++;
+        }
+        this->pending.push_back(frameset);
+    }
+    this->pendingCv.notify_one();
+    return true;
+}
+
+void PreRollBuffer::compressLoop() {
+    placeThread("imageEncoder", "prerollCompress");
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->pendingCv.wait(lock, [this] { return this->isStopping || !this->pending.empty(); });
+        if (this->isStopping) {
+            return;
+        }
+        SourceFrameSet frameset = std::move(this->pending.front());
+        this->pending.pop_front();
+        this->isCompressing = true;
+        lock.unlock();
+
+        auto compressed = std::make_shared<SourceFrameSet>();
+        size_t size = 0;
+        uint64_t timeStamp = 0;
+        {
+            TraceSpan span("preRollCompress");
+            for (auto &frame : frameset.frames) {
+                auto copy = compress(*frame);
+                if (copy == nullptr) {
+                    continue;
+                }
+                size += copy->dataSize;
+                timeStamp = std::max(timeStamp, copy->timeStamp);
+                compressed->frames.push_back(copy);
+            }
+            frameset.frames.clear();
+        }
+
+        lock.lock();
+        this->isCompressing = false;
+        if (!compressed->frames.empty()) {
+            this->ring.push_back({compressed, size});
+            this->bytes += size;
+            this->pushCount++;
+            this->peakBytes = std::max(this->peakBytes, this->bytes);
+
+            // Keep the window in capture time and the ring under its budget
+            uint64_t windowMs = (uint64_t)(this->seconds * 1000);
+            while (this->ring.size() > 1) {
+                uint64_t oldest = 0;
+                for (auto &frame : this->ring.front().first->frames) {
+                    oldest = std::max(oldest, frame->timeStamp);
+                }
+                // entries from different sensors are not strictly in timestamp order
+                bool isInWindow = timeStamp <= oldest || timeStamp - oldest <= windowMs;
+                if (isInWindow && this->bytes <= this->budgetBytes) {
+                    break;
+                }
+                this->bytes -= this->ring.front().second;
+                this->ring.pop_front();
+                this->evictCount++;
+            }
+        }
+        this->ringCv.notify_all();
+    }
+}
+
+void PreRollBuffer::trigger() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->isTriggered = true;
+    this->heldCount = this->pending.size();
+    this->live = std::move(this->pending);
+    this->pending.clear();
+}
+
+bool PreRollBuffer::pop(std::shared_ptr<SourceFrameSet>& frameset, bool& isLive) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    // the frameset being compressed is older than anything held raw
+    this->ringCv.wait(lock, [this] { return !this->ring.empty() || !this->isCompressing; });
+    if (!this->ring.empty()) {
+        frameset = this->ring.front().first;
+        this->bytes -= this->ring.front().second;
+        this->ring.pop_front();
+        this->flushCount++;
+        isLive = false;
+        this->liveCv.notify_all();
+        return true;
+    }
+    if (!this->live.empty()) {
+        frameset = std::make_shared<SourceFrameSet>(std::move(this->live.front()));
+        this->live.pop_front();
+        isLive = this->heldCount == 0;
+        if (this->heldCount > 0) {
+            this->heldCount--;
+            this->flushCount++;
+        }
+        this->liveCv.notify_all();
+        return true;
+    }
+    // nothing held either, so every later frame goes straight to the caller
+    this->isClosed = true;
+    this->liveCv.notify_all();
+    return false;
+}
+
+nlohmann::json PreRollBuffer::getMetadata() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    nlohmann::json metadata;
+    metadata["seconds"] = this->seconds;
+    metadata["budgetMb"] = this->budgetBytes / 1048576.0;
+    metadata["peakMb"] = this->peakBytes / 1048576.0;
+    metadata["framesets"] = this->pushCount;
+    metadata["pendingDropped"] = this->pendingDropCount;
+    metadata["evicted"] = this->evictCount;
+    metadata["flushed"] = this->flushCount;
+    metadata["liveHeld"] = this->liveCount;
+    return metadata;
+}
+
+// Own copy of the frame, compressed; the SDK buffer is not held
+std::shared_ptr<SourceFrame> PreRollBuffer::compress(const SourceFrame& frame) {
+    auto copy = std::make_shared<SourceFrame>();
+    copy->type = frame.type;
+    copy->format = frame.format;
+    copy->width = frame.width;
+    copy->height = frame.height;
+    copy->timeStamp = frame.timeStamp;
+    copy->timeStampUs = frame.timeStampUs;
+    copy->valueScale = frame.valueScale;
+    copy->buffer = std::make_shared<std::vector<uint8_t>>();
+
+    size_t pixels = (size_t)frame.width * frame.height;
+    cv::Mat mat;
+    if (frame.format == OB_FORMAT_MJPEG) {
+        copy->buffer->assign(frame.data, frame.data + frame.dataSize);
+    } else if (frame.format == OB_FORMAT_YUYV || frame.format == OB_FORMAT_UYVY) {
+        this->bgrMat.create(frame.height, frame.width, CV_8UC3);
+        packedYuvToBgr(frame.data, frame.width * 2, this->bgrMat.data, (int)this->bgrMat.step,
+                       frame.width, frame.height, frame.format == OB_FORMAT_UYVY);
+        cv::imencode(".jpg", this->bgrMat, *copy->buffer, this->jpegParams);
+        copy->format = OB_FORMAT_MJPEG;
+    } else if (frame.format == OB_FORMAT_BGR || frame.format == OB_FORMAT_RGB) {
+        mat = cv::Mat(frame.height, frame.width, CV_8UC3, frame.data);
+        if (frame.format == OB_FORMAT_RGB) {
+            cv::cvtColor(mat, this->bgrMat, cv::COLOR_RGB2BGR);
+            mat = this->bgrMat;
+        }
+        cv::imencode(".jpg", mat, *copy->buffer, this->jpegParams);
+        copy->format = OB_FORMAT_MJPEG;
+    } else if (frame.dataSize >= pixels * 2 && frame.format != OB_FORMAT_Y8 && frame.format != OB_FORMAT_GRAY) {
+        // 16-bit depth or IR, lossless
+        cv::imencode(".png", cv::Mat(frame.height, frame.width, CV_16UC1, frame.data), *copy->buffer, this->pngParams);
+        copy->isPng = true;
+    } else if (frame.dataSize >= pixels) {
+        cv::imencode(".png", cv::Mat(frame.height, frame.width, CV_8UC1, frame.data), *copy->buffer, this->pngParams);
+        copy->isPng = true;
+    } else {
+        copy->buffer->assign(frame.data, frame.data + frame.dataSize);
+    }
+    if (copy->buffer->empty()) {
+        return nullptr;
+    }
+    copy->data = copy->buffer->data();
+    copy->dataSize = (uint32_t)copy->buffer->size();
+    return copy;
+}
+
+std::shared_ptr<SourceFrame> decodePreRollFrame(std::shared_ptr<SourceFrame> frame) {
+    if (!frame->isPng) {
+        return frame;
+    }
+    cv::Mat mat = cv::imdecode(cv::Mat(1, frame->dataSize, CV_8UC1, frame->data), cv::IMREAD_UNCHANGED);
+    if (mat.empty() || !mat.isContinuous()) {
+        return nullptr;
+    }
+    auto decoded = std::make_shared<SourceFrame>(*frame);
+    size_t size = mat.total() * mat.elemSize();
+    decoded->buffer = std::make_shared<std::vector<uint8_t>>(mat.data, mat.data + size);
+    decoded->data = decoded->buffer->data();
+    decoded->dataSize = (uint32_t)size;
+    decoded->isPng = false;
+    return decoded;
+}
@@ -0,0 +1,443 @@
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <nlohmann/json.hpp>
+#include "frame_source.hpp"
+
+namespace {
+
+// Timecode files are "timestamp [ms]" or "timestamp [ms],value scale" with a header line.
+// Lines that do not parse (e.g. one cut short by a power loss) are skipped.
+void loadTimecodes(const std::string& path, std::vector<uint64_t>& timeStamps, std::vector<float>& valueScales) {
+    std::ifstream ifs(path);
+    std::string line;
+    std::getline(ifs, line);
+    while (std::getline(ifs, line)) {
+        const char *begin = line.c_str();
+        char *end = nullptr;
+        uint64_t timeStamp = std::strtoull(begin, &end, 10);
+        if (end == begin || (*end != '\0' && *end != ',' && *end != '\r')) {
+            continue;
+        }
+        float valueScale = 1.0f;
+        if (*end == ',') {
+            begin = end + 1;
+            valueScale = std::strtof(begin, &end);
+            if (end == begin || (*end != '\0' && *end != '\r')) {
+                continue;
+            }
+        }
+        timeStamps.push_back(timeStamp);
+        valueScales.push_back(valueScale);
+    }
+}
+
+// Image files are named "<count>_<timestamp>ms<ext>"
+void loadImages(const std::string& dir, std::vector<std::string>& imagePaths, std::vector<uint64_t>& timeStamps) {
+    namespace fs = std::filesystem;
+    std::vector<std::pair<uint64_t, std::string>> images;
+    for (auto &entry : fs::directory_iterator(dir)) {
+        std::string name = entry.path().filename().string();
+        auto sep = name.find('_');
+        auto ms = name.find("ms", sep);
+        if (sep == std::string::npos || ms == std::string::npos) {
+            continue;
+        }
+        images.push_back({std::stoull(name.substr(0, sep)), entry.path().string()});
+    }
+    std::sort(images.begin(), images.end());
+    for (auto &image : images) {
+        std::string name = std::filesystem::path(image.second).filename().string();
+        auto sep = name.find('_');
+        auto ms = name.find("ms", sep);
+        imagePaths.push_back(image.second);
+        timeStamps.push_back(std::stoull(name.substr(sep + 1, ms - sep - 1)));
+    }
+}
+
+}
+
+ReplayFrameSource::ReplayFrameSource(const std::string& recordDir, bool isRealtime) :
+    queue(4, isRealtime ? DropPolicy::DROP_OLDEST : DropPolicy::BLOCK) {
+    namespace fs = std::filesystem;
+    this->recordDir = recordDir;
+    this->isRealtime = isRealtime;
+
+    std::string metadataPath = recordDir + "/metadata.json";
+    std::ifstream ifs(metadataPath);
+    if (!ifs.is_open()) {
+        throw std::runtime_error("Failed to open file: " + metadataPath);
+    }
+    nlohmann::json j;
+    ifs >> j;
+
+    for (auto &item : j.items()) {
+        auto &meta = item.value();
+        if (!meta.is_object() || !meta.contains("sensorType") || !meta.value("isEnable", false)) {
+            continue;
+        }
+        OBSensorType sensorType = meta["sensorType"];
+        std::string streamName = item.key();
+
+        if (sensorType == OB_SENSOR_GYRO || sensorType == OB_SENSOR_ACCEL) {
+            auto imu = std::make_unique<Imu>();
+            imu->csvPath = recordDir + "/" + fs::path(meta.value("imuName", streamName + ".csv")).filename().string();
+            this->imus[sensorType] = std::move(imu);
+            continue;
+        }
+
+        Stream &stream = this->streams[sensorType];
+        stream.sensorType = sensorType;
+        stream.profile.width = meta.value("width", 0);
+        stream.profile.height = meta.value("height", 0);
+        stream.profile.fps = meta.value("fps", 0.0f);
+        stream.profile.intrinsic.fx = meta.value("fx", 0.0f);
+        stream.profile.intrinsic.fy = meta.value("fy", 0.0f);
+        stream.profile.intrinsic.cx = meta.value("cx", 0.0f);
+        stream.profile.intrinsic.cy = meta.value("cy", 0.0f);
+        stream.profile.distortion = {meta.value("k1", 0.0f), meta.value("k2", 0.0f), meta.value("k3", 0.0f),
+                                     meta.value("k4", 0.0f), meta.value("k5", 0.0f), meta.value("k6", 0.0f),
+                                     meta.value("p1", 0.0f), meta.value("p2", 0.0f)};
+        if (meta.contains("r") && meta.contains("t") && sensorType != OB_SENSOR_COLOR) {
+            for (int i = 0; i < 9; i++) {
+                stream.profile.extrinsic.rot[i] = meta["r"][i];
+            }
+            for (int i = 0; i < 3; i++) {
+                stream.profile.extrinsic.trans[i] = meta["t"][i];
+            }
+            stream.profile.hasExtrinsic = true;
+        }
+        if (sensorType == OB_SENSOR_COLOR) {
+            stream.profile.format = OB_FORMAT_BGR;
+        } else if (sensorType == OB_SENSOR_DEPTH) {
+            stream.profile.format = OB_FORMAT_Y16;
+        } else {
+            stream.profile.format = OB_FORMAT_Y8;
+        }
+
+        // Prefer 16-bit depth images over the normalised 8-bit depth video
+        std::string imageDir = recordDir + "/" + streamName;
+        std::string imageFormat = meta.value("imageFormat", "");
+        // Segmented recordings list their files in order, older ones have a single pair
+        std::vector<std::string> videoPaths;
+        std::vector<std::string> timecodePaths;
+        if (meta.contains("segments")) {
+            for (auto &segment : meta["segments"]) {
+                videoPaths.push_back(recordDir + "/" + fs::path(segment.value("videoName", "")).filename().string());
+                timecodePaths.push_back(recordDir + "/" + fs::path(segment.value("timecodeName", "")).filename().string());
+            }
+        } else {
+            videoPaths.push_back(recordDir + "/" + fs::path(meta.value("videoName", "")).filename().string());
+            timecodePaths.push_back(recordDir + "/" + fs::path(meta.value("timecodeName", streamName + "_timecode.txt")).filename().string());
+        }
+        bool hasImages = meta.value("isSaveImage", false) && fs::exists(imageDir);
+        bool hasVideo = meta.value("isSaveVideo", false) && fs::is_regular_file(videoPaths.front());
+        bool isLosslessDepth = sensorType == OB_SENSOR_DEPTH && (imageFormat == ".png" || imageFormat == ".jp2");
+        if (hasImages && (isLosslessDepth || !hasVideo)) {
+            loadImages(imageDir, stream.imagePaths, stream.timeStamps);
+            stream.valueScales.assign(stream.timeStamps.size(), 1.0f);
+            std::vector<uint64_t> timeStamps;
+            std::vector<float> valueScales;
+            for (auto &timecodePath : timecodePaths) {
+                loadTimecodes(timecodePath, timeStamps, valueScales);
+            }
+            if (valueScales.size() == stream.valueScales.size()) {
+                stream.valueScales = valueScales;
+            }
+        } else if (hasVideo) {
+            stream.videoPaths = videoPaths;
+            for (auto &timecodePath : timecodePaths) {
+                loadTimecodes(timecodePath, stream.timeStamps, stream.valueScales);
+            }
+        } else {
+            std::cerr << "No replayable data for stream: " << streamName << std::endl;
+            this->streams.erase(sensorType);
+            continue;
+        }
+
+        // A side-by-side IR pair is split again; the right camera comes out of the same reads
+        if (meta.value("stereoLayout", "") == "sideBySide" && meta.contains("rightCamera")) {
+            stream.isStereo = true;
+            auto &camera = meta["rightCamera"];
+            Stream &right = this->streams[OB_SENSOR_IR_RIGHT];
+            right.sensorType = OB_SENSOR_IR_RIGHT;
+            right.profile = stream.profile;
+            right.profile.intrinsic.fx = camera.value("fx", 0.0f);
+            right.profile.intrinsic.fy = camera.value("fy", 0.0f);
+            right.profile.intrinsic.cx = camera.value("cx", 0.0f);
+            right.profile.intrinsic.cy = camera.value("cy", 0.0f);
+            right.profile.distortion = {camera.value("k1", 0.0f), camera.value("k2", 0.0f), camera.value("k3", 0.0f),
+                                        camera.value("k4", 0.0f), camera.value("k5", 0.0f), camera.value("k6", 0.0f),
+                                        camera.value("p1", 0.0f), camera.value("p2", 0.0f)};
+            right.profile.hasExtrinsic = camera.contains("r") && camera.contains("t");
+            if (right.profile.hasExtrinsic) {
+                for (int i = 0; i < 9; i++) {
+                    right.profile.extrinsic.rot[i] = camera["r"][i];
+                }
+                for (int i = 0; i < 3; i++) {
+                    right.profile.extrinsic.trans[i] = camera["t"][i];
+                }
+            }
+        }
+    }
+}
+
+ReplayFrameSource::~ReplayFrameSource() {
+    stop();
+}
+
+std::string ReplayFrameSource::getName() {
+    return "replay";
+}
+
+bool ReplayFrameSource::hasSensor(OBSensorType sensorType) {
+    return this->streams.count(sensorType) > 0 || this->imus.count(sensorType) > 0;
+}
+
+VideoProfileInfo ReplayFrameSource::getVideoProfile(OBSensorType sensorType, int profileIdx) {
+    return this->streams.at(sensorType).profile;
+}
+
+void ReplayFrameSource::enableStream(OBSensorType sensorType, int profileIdx) {
+    Stream &stream = this->streams.at(sensorType);
+    if (!stream.videoPaths.empty() && !stream.capture.open(stream.videoPaths.front())) {
+        throw std::runtime_error("Failed to open video: " + stream.videoPaths.front());
+    }
+    stream.isEnable = true;
+}
+
+void ReplayFrameSource::startImu(OBSensorType sensorType, int profileIdx, ImuCallback callback) {
+    Imu *imu = this->imus.at(sensorType).get();
+    imu->callback = callback;
+    if (this->running.load()) {
+        startImuThread(sensorType, imu);
+    }
+}
+
+void ReplayFrameSource::stopImu(OBSensorType sensorType) {
+    auto it = this->imus.find(sensorType);
+    if (it == this->imus.end()) {
+        return;
+    }
+    it->second->running.store(false);
+    if (it->second->thread.joinable()) {
+        it->second->thread.join();
+    }
+}
+
+void ReplayFrameSource::start() {
+    this->firstTimeStamp = UINT64_MAX;
+    for (auto &entry : this->streams) {
+        if (entry.second.isEnable && !entry.second.timeStamps.empty()) {
+            this->firstTimeStamp = std::min(this->firstTimeStamp, entry.second.timeStamps.front());
+        }
+    }
+    if (this->firstTimeStamp == UINT64_MAX) {
+        this->firstTimeStamp = 0;
+    }
+    this->startTime = std::chrono::steady_clock::now();
+    this->running.store(true);
+    this->replayer = std::thread(&ReplayFrameSource::replayLoop, this);
+    for (auto &entry : this->imus) {
+        if (entry.second->callback) {
+            startImuThread(entry.first, entry.second.get());
+        }
+    }
+}
+
+void ReplayFrameSource::stop() {
+    this->running.store(false);
+    this->queue.close();
+    if (this->replayer.joinable()) {
+        this->replayer.join();
+    }
+    for (auto &entry : this->imus) {
+        entry.second->running.store(false);
+        if (entry.second->thread.joinable()) {
+            entry.second->thread.join();
+        }
+    }
+}
+
+std::shared_ptr<SourceFrameSet> ReplayFrameSource::waitForFrames(uint32_t timeoutMs) {
+    std::shared_ptr<SourceFrameSet> frameset;
+    if (!this->queue.popFor(frameset, std::chrono::milliseconds(timeoutMs))) {
+        return nullptr;
+    }
+    return frameset;
+}
+
+bool ReplayFrameSource::isFinished() {
+    return this->finished.load() && this->queue.size() == 0;
+}
+
+void ReplayFrameSource::waitUntil(uint64_t timeStamp) {
+    if (!this->isRealtime || timeStamp < this->firstTimeStamp) {
+        return;
+    }
+    std::this_thread::sleep_until(this->startTime + std::chrono::milliseconds(timeStamp - this->firstTimeStamp));
+}
+
+std::shared_ptr<SourceFrame> ReplayFrameSource::readFrame(Stream& stream) {
+    cv::Mat mat;
+    if (!stream.imagePaths.empty()) {
+        mat = cv::imread(stream.imagePaths[stream.next], cv::IMREAD_UNCHANGED);
+    } else {
+        // continue in the next segment when one runs out
+        while (!stream.capture.read(mat) && stream.videoIdx + 1 < stream.videoPaths.size()) {
+            stream.videoIdx++;
+            stream.capture.open(stream.videoPaths[stream.videoIdx]);
+        }
+    }
+    if (mat.empty()) {
+        return nullptr;
+    }
+
+    // Bring the decoded image back to the format the camera would deliver
+    cv::Mat converted;
+    if (stream.profile.format == OB_FORMAT_BGR) {
+        if (mat.channels() == 1) {
+            cv::cvtColor(mat, converted, cv::COLOR_GRAY2BGR);
+        } else {
+            converted = mat;
+        }
+    } else {
+        if (mat.channels() == 3) {
+            cv::cvtColor(mat, converted, cv::COLOR_BGR2GRAY);
+        } else {
+            converted = mat;
+        }
+        // 8-bit depth video only holds the normalised preview
+        if (stream.profile.format == OB_FORMAT_Y16 && converted.type() != CV_16UC1) {
+            converted.convertTo(converted, CV_16UC1);
+        } else if (stream.profile.format == OB_FORMAT_Y8 && converted.type() != CV_8UC1) {
+            converted.convertTo(converted, CV_8UC1);
+        }
+    }
+    cv::Mat right;
+    if (stream.isStereo) {
+        int half = converted.cols / 2;
+        right = converted(cv::Rect(half, 0, half, converted.rows)).clone();
+        converted = converted(cv::Rect(0, 0, half, converted.rows));
+    }
+    if (!converted.isContinuous()) {
+        converted = converted.clone();
+    }
+
+    auto frame = std::make_shared<SourceFrame>();
+    frame->type = frameTypeOf(stream.sensorType);
+    frame->format = stream.profile.format;
+    frame->width = converted.cols;
+    frame->height = converted.rows;
+    frame->timeStamp = stream.timeStamps[stream.next];
+    frame->timeStampUs = frame->timeStamp * 1000;
+    frame->valueScale = stream.next < stream.valueScales.size() ? stream.valueScales[stream.next] : 1.0f;
+    size_t size = converted.total() * converted.elemSize();
+    frame->buffer = std::make_shared<std::vector<uint8_t>>(converted.data, converted.data + size);
+    frame->data = frame->buffer->data();
+    frame->dataSize = size;
+    if (stream.isStereo) {
+        auto pair = std::make_shared<SourceFrame>(*frame);
+        pair->type = OB_FRAME_IR_RIGHT;
+        size = right.total() * right.elemSize();
+        pair->buffer = std::make_shared<std::vector<uint8_t>>(right.data, right.data + size);
+        pair->data = pair->buffer->data();
+        pair->dataSize = size;
+        frame->pair = pair;
+    }
+    return frame;
+}
+
+void ReplayFrameSource::replayLoop() {
+    // frames closer than half of the shortest frame period go into one frameset
+    float maxFps = 0;
+    for (auto &entry : this->streams) {
+        if (entry.second.isEnable) {
+            maxFps = std::max(maxFps, entry.second.profile.fps);
+        }
+    }
+    uint64_t window = maxFps > 0 ? (uint64_t)(500 / maxFps) : 0;
+
+    while (this->running.load()) {
+        uint64_t due = UINT64_MAX;
+        for (auto &entry : this->streams) {
+            Stream &stream = entry.second;
+            if (stream.isEnable && stream.next < stream.timeStamps.size()) {
+                due = std::min(due, stream.timeStamps[stream.next]);
+            }
+        }
+        if (due == UINT64_MAX) {
+            break;
+        }
+        waitUntil(due);
+
+        auto frameset = std::make_shared<SourceFrameSet>();
+        for (auto &entry : this->streams) {
+            Stream &stream = entry.second;
+            if (!stream.isEnable || stream.next >= stream.timeStamps.size() || stream.timeStamps[stream.next] > due + window) {
+                continue;
+            }
+            auto frame = readFrame(stream);
+            if (frame == nullptr) {
+                // video shorter than its timecode file
+                stream.next = stream.timeStamps.size();
+                continue;
+            }
+            frameset->frames.push_back(frame);
+            if (frame->pair != nullptr) {
+                frameset->frames.push_back(frame->pair);
+                frame->pair = nullptr;
+            }
+            stream.next++;
+        }
+        if (!frameset->frames.empty()) {
+            this->queue.push(frameset);
+        }
+    }
+    this->finished.store(true);
+}
+
+void ReplayFrameSource::startImuThread(OBSensorType sensorType, Imu *imu) {
+    imu->running.store(true);
+    imu->thread = std::thread(&ReplayFrameSource::imuLoop, this, sensorType, imu);
+}
+
+void ReplayFrameSource::imuLoop(OBSensorType sensorType, Imu *imu) {
+    std::ifstream ifs(imu->csvPath, std::ios::binary);
+    if (!ifs.is_open()) {
+        std::cerr << "Failed to open file: " << imu->csvPath << std::endl;
+        return;
+    }
+
+    // Binary log written with imuFormat "binary"
+    if (std::filesystem::path(imu->csvPath).extension() == ".bin") {
+        ImuBinaryHeader header;
+        ifs.read((char *)&header, sizeof(header));
+        if (!ifs || std::string(header.magic) != "RRIMU" || header.recordSize != sizeof(ImuSample)) {
+            std::cerr << "Invalid IMU log: " << imu->csvPath << std::endl;
+            return;
+        }
+        ImuSample sample;
+        while (imu->running.load() && ifs.read((char *)&sample, sizeof(sample))) {
+            waitUntil(sample.timeStamp);
+            imu->callback(sample);
+        }
+        return;
+    }
+
+    std::string line;
+    std::getline(ifs, line);
+    while (imu->running.load() && std::getline(ifs, line)) {
+        ImuSample sample;
+        std::stringstream ss(line);
+        char sep;
+        ss >> sample.timeStamp >> sep >> sample.temperature >> sep >> sample.x >> sep >> sample.y >> sep >> sample.z;
+        if (ss.fail()) {
+            continue;
+        }
+        waitUntil(sample.timeStamp);
+        imu->callback(sample);
+    }
+}
@@ -0,0 +1,847 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <set>
+#include <tuple>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+#include "settings.hpp"
+#include "frame_source.hpp"
+#include "stream_manager.hpp"
+#include "stage_profiler.hpp"
+#include "color_convert.hpp"
+#include "gpio_manager.hpp"
+#include "file_writer.hpp"
+#include "chunk_log.hpp"
+#include "frame_index.hpp"
+
+// Drives the stream managers with synthetic frames and reports per-stage latency as JSON.
+//
+// rover_recorder_bench [--settings settings.json] [--profiles DIR] [--out DIR] [--frames N]
+//                      [--profile-idx 72,19] [--imu-seconds S] [--gpio-triggers N] [--file-mb N]
+//                      [--roundtrip-frames N] [--json report.json] [--keep]
+//
+// The report also compares the fused YUYV/UYVY to BGR kernel against the SDK two-filter path,
+// measures PDU_C edge to debounced trigger latency on the fake GPIO backend, times
+// std::ofstream against FileWriter writing the same data into --out, and reads synthetic
+// frames back from the chunk log and a frame index to check they match. The exit code is 1
+// if they do not.
+
+namespace {
+
+struct BenchOptions {
+    std::string settingsPath = "settings.json";
+    std::string profileDir = ".";
+    std::string outDir = "/tmp/rover_recorder_bench";
+    std::string jsonPath = "";
+    int frames = 60;
+    float imuSeconds = 2.0f;
+    int gpioTriggers = 20;
+    int fileMb = 256;
+    int roundTripFrames = 30;  // per stream
+    std::set<int> profileFilter;
+    bool isKeep = false;
+};
+
+std::string formatName(OBFormat format) {
+    switch (format) {
+        case OB_FORMAT_YUYV: return "YUYV";
+        case OB_FORMAT_UYVY: return "UYVY";
+        case OB_FORMAT_MJPG: return "MJPG";
+        case OB_FORMAT_RGB: return "RGB888";
+        case OB_FORMAT_BGR: return "BGR";
+        case OB_FORMAT_RGBA: return "RGBA";
+        case OB_FORMAT_BGRA: return "BGRA";
+        case OB_FORMAT_Y16: return "Y16";
+        case OB_FORMAT_Y12: return "Y12";
+        case OB_FORMAT_Y8: return "Y8";
+        default: return "UNKNOWN";
+    }
+}
+
+// Formats ImageStreamManager can record for each sensor
+bool isSupported(OBSensorType sensorType, OBFormat format) {
+    if (sensorType == OB_SENSOR_COLOR) {
+        return format == OB_FORMAT_MJPG || format == OB_FORMAT_YUYV || format == OB_FORMAT_UYVY || format == OB_FORMAT_RGB || format == OB_FORMAT_BGR;
+    } else if (sensorType == OB_SENSOR_DEPTH) {
+        return format == OB_FORMAT_Y16;
+    }
+    return format == OB_FORMAT_Y8;
+}
+
+BenchOptions parseArgs(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--settings" && hasValue) {
+            options.settingsPath = argv[++i];
+        } else if (arg == "--profiles" && hasValue) {
+            options.profileDir = argv[++i];
+        } else if (arg == "--out" && hasValue) {
+            options.outDir = argv[++i];
+        } else if (arg == "--json" && hasValue) {
+            options.jsonPath = argv[++i];
+        } else if (arg == "--frames" && hasValue) {
+            options.frames = std::stoi(argv[++i]);
+        } else if (arg == "--imu-seconds" && hasValue) {
+            options.imuSeconds = std::stof(argv[++i]);
+        } else if (arg == "--gpio-triggers" && hasValue) {
+            options.gpioTriggers = std::stoi(argv[++i]);
+        } else if (arg == "--file-mb" && hasValue) {
+            options.fileMb = std::stoi(argv[++i]);
+        } else if (arg == "--roundtrip-frames" && hasValue) {
+            options.roundTripFrames = std::stoi(argv[++i]);
+        } else if (arg == "--profile-idx" && hasValue) {
+            std::stringstream ss(argv[++i]);
+            std::string idx;
+            while (std::getline(ss, idx, ',')) {
+                options.profileFilter.insert(std::stoi(idx));
+            }
+        } else if (arg == "--keep") {
+            options.isKeep = true;
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            exit(1);
+        }
+    }
+    return options;
+}
+
+nlohmann::json benchImageStream(const BenchOptions& options, const Settings& settings, int i, int profileIdx) {
+    namespace fs = std::filesystem;
+    OBSensorType sensorType = settings.sensorTypes[i];
+    std::string streamName = settings.streamNames[i];
+
+    nlohmann::json result;
+    result["stream"] = streamName;
+    result["profileIdx"] = profileIdx;
+
+    auto source = std::make_shared<SyntheticFrameSource>(options.profileDir, false, 0);
+    VideoProfileInfo profile;
+    try {
+        profile = source->getVideoProfile(sensorType, profileIdx);
+    } catch (std::exception &e) {
+        result["skipped"] = e.what();
+        return result;
+    }
+    result["format"] = formatName(profile.format);
+    result["width"] = profile.width;
+    result["height"] = profile.height;
+    result["profileFps"] = profile.fps;
+    if (!isSupported(sensorType, profile.format)) {
+        result["skipped"] = "format not recorded by ImageStreamManager";
+        return result;
+    }
+
+    std::string runDir = options.outDir + "/" + streamName + "_" + std::to_string(profileIdx);
+    fs::create_directories(runDir);
+
+    auto profiler = std::make_shared<StageProfiler>();
+    std::shared_ptr<ImageEncoderPool> imagePool;
+    std::shared_ptr<FrameBufferPool> bufferPool;
+    if (settings.imageEncoderThreads > 0 && settings.isSaveImage[i]) {
+        imagePool = std::make_shared<ImageEncoderPool>(settings.imageEncoderThreads, settings.imageQueueDepth);
+    }
+    if (settings.bufferBudgetMb > 0) {
+        bufferPool = std::make_shared<FrameBufferPool>((size_t)settings.bufferBudgetMb << 20, settings.bufferWaitMs);
+    }
+    ImageStreamConfig config;
+    config.isSaveVideo = settings.isSaveVideo[i];
+    config.isSaveImage = settings.isSaveImage[i];
+    config.containerFormat = settings.containerFormats[i];
+    config.codec = settings.codecs[i];
+    config.imageFormat = settings.imageFormats[i];
+    config.compressionParams = settings.compressionParams[i];
+    config.queueDepth = settings.queueDepths[i];
+    config.dropPolicy = DropPolicy::BLOCK;  // measure every frame
+    config.isMjpegPassthrough = settings.mjpegPassthrough;
+    config.depthPreview = settings.depthPreview;
+    config.encoder = settings.videoEncoders[i];
+    config.timecode = settings.timecode;
+    config.segmentSeconds = settings.segmentSeconds;
+    config.segmentMb = settings.segmentMb;
+    {
+        ImageStreamManager manager(source, sensorType, streamName, runDir, profileIdx, config);
+        manager.setProfiler(profiler);
+        manager.setImageEncoderPool(imagePool);
+        manager.setBufferPool(bufferPool);
+        double periodUs = 1e6 / (profile.fps > 0 ? profile.fps : 30);
+        for (int n = 0; n < options.frames; n++) {
+            auto frameset = std::make_shared<SourceFrameSet>();
+            frameset->frames.push_back(source->makeFrame(sensorType, profileIdx, n, (uint64_t)(n * periodUs)));
+            manager.processFrameset(frameset);
+        }
+        manager.close();
+    }
+
+    nlohmann::json report = profiler->toJson();
+    result.update(report);
+    result["realtime"] = report["fps"].get<double>() >= profile.fps;
+    if (bufferPool) {
+        result["bufferPool"] = bufferPool->getMetadata();
+    }
+
+    if (!options.isKeep) {
+        fs::remove_all(runDir);
+    }
+    return result;
+}
+
+nlohmann::json summarize(std::vector<int64_t> samples) {
+    std::sort(samples.begin(), samples.end());
+    return {
+        {"p50 [ms]", samples[samples.size() / 2] / 1e6},
+        {"p99 [ms]", samples[(size_t)(0.99 * (samples.size() - 1) + 0.5)] / 1e6},
+        {"max [ms]", samples.back() / 1e6},
+    };
+}
+
+// Old path (YUYV -> RGB888 -> BGR with two FormatConvertFilter passes) against the fused kernel
+nlohmann::json benchColorConvert(const BenchOptions& options, OBFormat format, int width, int height, const std::vector<uint8_t>& yuv) {
+    bool isUyvy = format == OB_FORMAT_UYVY;
+    int iterations = std::max(options.frames, 1);
+    std::vector<int64_t> twoFilter, fused, fusedScalar;
+    cv::Mat bgr(height, width, CV_8UC3);
+
+    ob::FormatConvertFilter filter;
+    auto sdkFrame = ob::FrameHelper::createFrame(OB_FRAME_COLOR, format, width, height, width * 2);
+    std::memcpy(sdkFrame->data(), yuv.data(), std::min<size_t>(yuv.size(), sdkFrame->dataSize()));
+
+    for (int n = 0; n < iterations; n++) {
+        int64_t t0 = StageProfiler::now();
+        filter.setFormatConvertType(isUyvy ? FORMAT_UYVY_TO_RGB888 : FORMAT_YUYV_TO_RGB888);
+        auto rgbFrame = filter.process(sdkFrame);
+        filter.setFormatConvertType(FORMAT_RGB888_TO_BGR);
+        auto bgrFrame = filter.process(rgbFrame);
+        int64_t t1 = StageProfiler::now();
+        packedYuvToBgr(yuv.data(), width * 2, bgr.data, (int)bgr.step, width, height, isUyvy);
+        int64_t t2 = StageProfiler::now();
+        packedYuvToBgr(CONVERT_SCALAR, yuv.data(), width * 2, bgr.data, (int)bgr.step, width, height, isUyvy);
+        int64_t t3 = StageProfiler::now();
+        twoFilter.push_back(t1 - t0);
+        fused.push_back(t2 - t1);
+        fusedScalar.push_back(t3 - t2);
+    }
+
+    nlohmann::json result;
+    result["format"] = formatName(format);
+    result["width"] = width;
+    result["height"] = height;
+    result["backend"] = colorConvertBackendName(bestColorConvertBackend());
+    result["twoFilter"] = summarize(twoFilter);
+    result["fused"] = summarize(fused);
+    result["fusedScalar"] = summarize(fusedScalar);
+    result["speedup"] = result["twoFilter"]["p50 [ms]"].get<double>() / std::max(result["fused"]["p50 [ms]"].get<double>(), 1e-9);
+    return result;
+}
+
+// Bouncy PDU_C edges on the fake backend: time from the first edge until a waiter is woken
+nlohmann::json benchGpioTrigger(const BenchOptions& options, const Settings& settings) {
+    auto backend = std::make_unique<FakeGpioBackend>(false);
+    FakeGpioBackend *fake = backend.get();
+    GpioManager gpioManager(std::move(backend), settings.gpioDebounceMs);
+    std::vector<int64_t> latency, edgeError;
+    for (int n = 0; n < options.gpioTriggers; n++) {
+        bool level = n % 2 == 0;
+        auto waiter = gpioManager.wait_GPIO_PDU_C_async(level, settings.gpioDebounceMs + 1000);
+        auto edgeTime = std::chrono::steady_clock::now();
+        for (int bounce = 0; bounce < 3; bounce++) {
+            fake->setInput(level);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            fake->setInput(!level);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        fake->setInput(level);
+        if (!waiter.get()) {
+            std::cerr << "[BENCH] gpio trigger timed out" << std::endl;
+            continue;
+        }
+        auto wakeTime = std::chrono::steady_clock::now();
+        latency.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(wakeTime - edgeTime).count());
+        edgeError.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(gpioManager.getLastEdgeTime() - edgeTime).count());
+    }
+
+    nlohmann::json result;
+    result["backend"] = gpioManager.getBackend()->getName();
+    result["debounceMs"] = settings.gpioDebounceMs;
+    result["triggers"] = latency.size();
+    if (!latency.empty()) {
+        result["edgeToWake"] = summarize(latency);
+        result["edgeTimeError"] = summarize(edgeError);
+    }
+    return result;
+}
+
+// The same records through std::ofstream (the old timecode and IMU path) and FileWriter in each
+// mode. Every path is flushed once per MiB as the writers flush on their time budget; the final
+// fdatasync is timed apart, since page cache writes only look fast until the data has to land.
+nlohmann::json benchFileWrite(const BenchOptions& options, const Settings& settings, size_t recordBytes) {
+    namespace fs = std::filesystem;
+    fs::create_directories(options.outDir);
+    std::string path = options.outDir + "/file_write.bin";
+    const size_t FLUSH_BYTES = 1 << 20;
+    size_t count = std::max<size_t>(((size_t)options.fileMb << 20) / recordBytes, 1);
+    std::vector<uint8_t> record(recordBytes, 0x5a);
+
+    nlohmann::json result;
+    result["recordBytes"] = recordBytes;
+    result["records"] = count;
+    for (const std::string mode : {"ofstream", "buffered", "direct"}) {
+        std::vector<int64_t> latency;
+        latency.reserve(count);
+        // frame-sized records are the chunk log's load
+        FileWriterConfig config = settings.chunkLogWriter;
+        config.mode = parseFileWriteMode(mode);
+        std::ofstream ofs;
+        FileWriter writer;
+        if (mode == "ofstream") {
+            ofs.open(path, std::ios::binary | std::ios::trunc);
+        } else if (!writer.open(path, config)) {
+            std::cerr << "[BENCH] " << writer.errorMsg << std::endl;
+            continue;
+        }
+
+        int64_t start = StageProfiler::now();
+        size_t unflushed = 0;
+        for (size_t n = 0; n < count; n++) {
+            int64_t t0 = StageProfiler::now();
+            if (mode == "ofstream") {
+                ofs.write((const char *)record.data(), record.size());
+            } else {
+                writer.write(record.data(), record.size());
+            }
+            unflushed += recordBytes;
+            if (unflushed >= FLUSH_BYTES) {
+                if (mode == "ofstream") {
+                    ofs.flush();
+                } else {
+                    writer.flush();
+                }
+                unflushed = 0;
+            }
+            latency.push_back(StageProfiler::now() - t0);
+        }
+        if (mode == "ofstream") {
+            ofs.close();
+        } else {
+            writer.close();
+        }
+        int64_t written = StageProfiler::now();
+        int fd = ::open(path.c_str(), O_WRONLY);
+        if (fd >= 0) {
+            fdatasync(fd);
+            ::close(fd);
+        }
+        int64_t synced = StageProfiler::now();
+
+        nlohmann::json entry = summarize(latency);
+        entry["effectiveMode"] = mode == "ofstream" ? mode : fileWriteModeName(writer.getMode());
+        entry["writeSeconds"] = (written - start) / 1e9;
+        entry["syncMs"] = (synced - written) / 1e6;
+        entry["MBps"] = (double)count * recordBytes / (1 << 20) / std::max((synced - start) / 1e9, 1e-9);
+        if (mode != "ofstream") {
+            entry["fileWriter"] = writer.getMetadata();
+        }
+        result[mode] = entry;
+        fs::remove(path);
+    }
+    return result;
+}
+
+// FNV-1a, so records can be compared without keeping the frames
+uint64_t hashBytes(const uint8_t *data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+struct RoundTripRecord {
+    uint16_t channel;
+    uint64_t timeStampUs;
+    uint32_t size;
+    uint64_t hash;
+};
+
+// Empty if actual is expected record for record, else the first difference
+std::string compareRecords(const std::vector<RoundTripRecord>& expected, const std::vector<RoundTripRecord>& actual) {
+    for (size_t n = 0; n < std::min(expected.size(), actual.size()); n++) {
+        const RoundTripRecord& e = expected[n];
+        const RoundTripRecord& a = actual[n];
+        if (e.channel != a.channel || e.timeStampUs != a.timeStampUs || e.size != a.size || e.hash != a.hash) {
+            return "record " + std::to_string(n) + " differs (channel " + std::to_string(a.channel) + ", " + std::to_string(a.timeStampUs) + " us)";
+        }
+    }
+    if (expected.size() != actual.size()) {
+        return std::to_string(actual.size()) + " records instead of " + std::to_string(expected.size());
+    }
+    return "";
+}
+
+// Synthetic frames of every image stream and a JSON channel go into a chunk log, which is read
+// back whole, by time range, and from a copy cut inside its last chunk with no index or trailer
+nlohmann::json benchChunkLogRoundTrip(const BenchOptions& options, const Settings& settings, FileWriteMode mode) {
+    namespace fs = std::filesystem;
+    fs::create_directories(options.outDir);
+    std::string path = options.outDir + "/roundtrip_" + fileWriteModeName(mode) + ".rrlog";
+    std::string cutPath = path + ".cut";
+    std::vector<std::string> errors;
+    auto check = [&errors](const std::string& error, const std::string& what) {
+        if (!error.empty()) {
+            errors.push_back(what + ": " + error);
+        }
+    };
+
+    nlohmann::json result;
+    result["mode"] = fileWriteModeName(mode);
+    std::vector<RoundTripRecord> written;
+    size_t channelCount = 0;
+    {
+        FileWriterConfig config = settings.chunkLogWriter;
+        config.mode = mode;
+        ChunkLogWriter writer;
+        if (!writer.open(path, parseChunkCompression(settings.chunkCompression), (size_t)settings.chunkKb << 10, config)) {
+            result["ok"] = false;
+            result["errors"] = {"Failed to open " + path};
+            return result;
+        }
+        SyntheticFrameSource source(options.profileDir, false, 0);
+        std::vector<std::pair<int, uint16_t>> streams;
+        for (int i = 0; i < settings.sensorTypes.size(); i++) {
+            OBSensorType sensorType = settings.sensorTypes[i];
+            if (sensorType == OB_SENSOR_GYRO || sensorType == OB_SENSOR_ACCEL) {
+                continue;
+            }
+            nlohmann::json info = {{"stream", settings.streamNames[i]}, {"profileIdx", settings.profileIdx[i]}};
+            streams.push_back({i, writer.addChannel(settings.streamNames[i], "rover.frame", info)});
+        }
+        uint16_t jsonChannel = writer.addChannel("metadata", "json", nlohmann::json::object());
+        channelCount = streams.size() + 1;
+
+        for (int n = 0; n < options.roundTripFrames; n++) {
+            for (auto &stream : streams) {
+                std::shared_ptr<SourceFrame> frame;
+                try {
+                    frame = source.makeFrame(settings.sensorTypes[stream.first], settings.profileIdx[stream.first], n, (uint64_t)n * 33333);
+                } catch (std::exception &e) {
+                    errors.push_back(settings.streamNames[stream.first] + ": " + e.what());
+                    continue;
+                }
+                ChunkLogFrameHeader header;
+                header.frameType = frame->type;
+                header.format = frame->format;
+                header.width = frame->width;
+                header.height = frame->height;
+                header.valueScale = frame->valueScale;
+                header.dataSize = frame->dataSize;
+                uint64_t timeStampUs = frame->timeStampUs > 0 ? frame->timeStampUs : frame->timeStamp * 1000;
+                writer.write(stream.second, timeStampUs, &header, sizeof(header), frame->data, frame->dataSize);
+                std::vector<uint8_t> payload((uint8_t *)&header, (uint8_t *)&header + sizeof(header));
+                payload.insert(payload.end(), frame->data, frame->data + frame->dataSize);
+                written.push_back({stream.second, timeStampUs, (uint32_t)payload.size(), hashBytes(payload.data(), payload.size())});
+            }
+            if (n % 10 == 0) {
+                std::string text = nlohmann::json({{"frame", n}}).dump();
+                uint64_t timeStampUs = writer.getLastTimeStampUs();
+                writer.write(jsonChannel, timeStampUs, text.data(), text.size());
+                written.push_back({jsonChannel, timeStampUs, (uint32_t)text.size(), hashBytes((const uint8_t *)text.data(), text.size())});
+            }
+        }
+        writer.close();
+    }
+    result["records"] = written.size();
+    result["bytes"] = fs::file_size(path);
+
+    auto readAll = [](ChunkLogReader& reader, uint64_t startUs, uint64_t endUs, std::vector<RoundTripRecord>& records) {
+        return reader.read(startUs, endUs, [&records](const ChunkLogRecord& record) {
+            records.push_back({record.channel, record.timeStampUs, record.size, hashBytes(record.data, record.size)});
+        });
+    };
+
+    // closed file: through the trailer and index
+    ChunkLogReader reader;
+    std::vector<ChunkLogIndexEntry> chunks;
+    if (!reader.open(path)) {
+        errors.push_back(reader.errorMsg);
+    } else {
+        chunks = reader.getChunks();
+        result["chunks"] = chunks.size();
+        if (reader.getChannels().size() != channelCount) {
+            errors.push_back("closed: " + std::to_string(reader.getChannels().size()) + " channels instead of " + std::to_string(channelCount));
+        }
+        if (reader.getSummary().empty()) {
+            errors.push_back("closed: no summary");
+        }
+        std::vector<RoundTripRecord> records;
+        if (!readAll(reader, 0, UINT64_MAX, records)) {
+            errors.push_back("closed: " + reader.errorMsg);
+        }
+        check(compareRecords(written, records), "closed");
+
+        // a time range only returns the records inside it
+        if (!written.empty()) {
+            uint64_t startUs = written[written.size() / 3].timeStampUs;
+            uint64_t endUs = written[written.size() * 2 / 3].timeStampUs;
+            std::vector<RoundTripRecord> expected;
+            for (auto &record : written) {
+                if (record.timeStampUs >= startUs && record.timeStampUs <= endUs) {
+                    expected.push_back(record);
+                }
+            }
+            records.clear();
+            if (!readAll(reader, startUs, endUs, records)) {
+                errors.push_back("range: " + reader.errorMsg);
+            }
+            check(compareRecords(expected, records), "range");
+        }
+    }
+
+    // cut inside the last chunk: index, summary and trailer are gone, the whole chunks before it remain
+    if (!chunks.empty()) {
+        const ChunkLogIndexEntry& last = chunks.back();
+        uint64_t cutSize = last.offset + last.length / 2;
+        size_t kept = 0;
+        for (auto &chunk : chunks) {
+            if (chunk.offset + chunk.length <= cutSize) {
+                kept += chunk.recordCount;
+            }
+        }
+        fs::copy_file(path, cutPath, fs::copy_options::overwrite_existing);
+        fs::resize_file(cutPath, cutSize);
+        ChunkLogReader cutReader;
+        std::vector<RoundTripRecord> records;
+        if (!cutReader.open(cutPath)) {
+            errors.push_back("cut: " + cutReader.errorMsg);
+        } else {
+            if (!cutReader.getSummary().empty()) {
+                errors.push_back("cut: summary read from a file without one");
+            }
+            if (cutReader.getChannels().size() != channelCount) {
+                errors.push_back("cut: " + std::to_string(cutReader.getChannels().size()) + " channels instead of " + std::to_string(channelCount));
+            }
+            if (!readAll(cutReader, 0, UINT64_MAX, records)) {
+                errors.push_back("cut: " + cutReader.errorMsg);
+            }
+            std::vector<RoundTripRecord> expected(written.begin(), written.begin() + std::min(kept, written.size()));
+            check(compareRecords(expected, records), "cut");
+        }
+        result["cutRecords"] = records.size();
+    }
+
+    if (!options.isKeep) {
+        fs::remove(path);
+        fs::remove(cutPath);
+    }
+    result["ok"] = errors.empty();
+    result["errors"] = errors;
+    for (auto &error : errors) {
+        std::cerr << "[BENCH] chunk log round trip: " << error << std::endl;
+    }
+    return result;
+}
+
+// A frame index for synthetic frames, with packets reported out of order as B-frames do and
+// some frames without one, read back record by record, through the lookups, and from a copy
+// cut inside a record
+nlohmann::json benchFrameIndexRoundTrip(const BenchOptions& options, const Settings& settings, FileWriteMode mode) {
+    namespace fs = std::filesystem;
+    fs::create_directories(options.outDir);
+    std::string path = options.outDir + "/roundtrip_" + fileWriteModeName(mode) + "_frames.idx";
+    std::string cutPath = path + ".cut";
+    const uint32_t GOP = 10;
+    std::vector<std::string> errors;
+    auto fail = [&errors](const std::string& what, size_t n) {
+        // the first few are enough to find it
+        if (errors.size() < 20) {
+            errors.push_back(what + " at frame " + std::to_string(n));
+        }
+    };
+
+    nlohmann::json result;
+    result["mode"] = fileWriteModeName(mode);
+    int stream = -1;
+    for (int i = 0; i < settings.sensorTypes.size() && stream < 0; i++) {
+        if (settings.sensorTypes[i] != OB_SENSOR_GYRO && settings.sensorTypes[i] != OB_SENSOR_ACCEL) {
+            stream = i;
+        }
+    }
+    if (stream < 0) {
+        result["ok"] = true;
+        result["records"] = 0;
+        return result;
+    }
+
+    // what the reader has to return for each frame
+    std::vector<FrameIndexRecord> expected;
+    {
+        FileWriterConfig config = settings.fileWriter;
+        config.mode = mode;
+        FrameIndexWriter writer;
+        if (!writer.open(path, config)) {
+            result["ok"] = false;
+            result["errors"] = {"Failed to open " + path};
+            return result;
+        }
+        SyntheticFrameSource source(options.profileDir, false, 0);
+        uint64_t offset = 0;
+        uint32_t keyFrame = 0;
+        int64_t deferred = -1;
+        for (int n = 0; n < options.roundTripFrames; n++) {
+            std::shared_ptr<SourceFrame> frame;
+            try {
+                frame = source.makeFrame(settings.sensorTypes[stream], settings.profileIdx[stream], n, (uint64_t)n * 33333);
+            } catch (std::exception &e) {
+                errors.push_back(settings.streamNames[stream] + ": " + e.what());
+                break;
+            }
+            FrameIndexRecord record = {};
+            record.timeStampUs = frame->timeStampUs > 0 ? frame->timeStampUs : frame->timeStamp * 1000;
+            record.streamFrame = n;
+            bool hasImage = n % 3 == 0;
+            bool hasPacket = n % 7 != 6;  // the rest are dropped by the encoder
+            record.flags = hasImage ? FRAME_INDEX_IMAGE : 0;
+            if (hasPacket) {
+                record.offset = offset;
+                record.size = frame->dataSize / 8 + n;
+                record.flags |= FRAME_INDEX_PACKET | (n % GOP == 0 ? FRAME_INDEX_KEY : 0);
+                offset += record.size;
+            }
+            // decoding starts at the last key frame; a frame with only an image is its own start
+            if ((record.flags & FRAME_INDEX_KEY) || (!hasPacket && hasImage)) {
+                keyFrame = n;
+            }
+            record.keyFrame = keyFrame;
+            expected.push_back(record);
+
+            writer.addFrame(record.timeStampUs, n, hasImage, hasPacket);
+            if (!hasPacket) {
+                continue;
+            }
+            // even frames wait for the next one, as a B-frame's reference comes out first
+            if (deferred < 0 && n % 2 == 0) {
+                deferred = n;
+                continue;
+            }
+            writer.setPacket(n, record.offset, record.size, record.flags & FRAME_INDEX_KEY);
+            if (deferred >= 0) {
+                const FrameIndexRecord& held = expected[deferred];
+                writer.setPacket(deferred, held.offset, held.size, held.flags & FRAME_INDEX_KEY);
+                deferred = -1;
+            }
+        }
+        if (deferred >= 0) {
+            const FrameIndexRecord& held = expected[deferred];
+            writer.setPacket(deferred, held.offset, held.size, held.flags & FRAME_INDEX_KEY);
+        }
+        writer.close();
+    }
+    result["records"] = expected.size();
+
+    auto compare = [&](const FrameIndexReader& reader, size_t count, const std::string& what) {
+        if (reader.size() != count) {
+            errors.push_back(what + ": " + std::to_string(reader.size()) + " records instead of " + std::to_string(count));
+            return;
+        }
+        for (size_t n = 0; n < count; n++) {
+            if (std::memcmp(&reader.at(n), &expected[n], sizeof(FrameIndexRecord)) != 0) {
+                fail(what + ": record differs", n);
+            }
+        }
+    };
+
+    FrameIndexReader reader;
+    if (!reader.open(path)) {
+        errors.push_back(reader.errorMsg);
+    } else {
+        compare(reader, expected.size(), "closed");
+        for (size_t n = 0; n < expected.size() && reader.size() == expected.size(); n++) {
+            uint64_t timeStampUs = expected[n].timeStampUs;
+            if (reader.findFrame(timeStampUs) != (int64_t)n) {
+                fail("findFrame", n);
+            }
+            bool hasNext = n + 1 < expected.size();
+            uint64_t gapUs = hasNext ? expected[n + 1].timeStampUs - timeStampUs : 0;
+            if (hasNext && gapUs > 1 && reader.findFrame(timeStampUs + gapUs - 1) != (int64_t)n) {
+                fail("findFrame between frames", n);
+            }
+            if (hasNext && gapUs > 4 && reader.findNearestFrame(timeStampUs + gapUs * 3 / 4) != (int64_t)n + 1) {
+                fail("findNearestFrame", n);
+            }
+            if (reader.findKeyFrame(n) != expected[n].keyFrame) {
+                fail("findKeyFrame", n);
+            }
+        }
+        if (!expected.empty() && expected[0].timeStampUs > 0 && reader.findFrame(expected[0].timeStampUs - 1) != -1) {
+            errors.push_back("findFrame before the first frame");
+        }
+        if (reader.findKeyFrame(expected.size()) != -1) {
+            errors.push_back("findKeyFrame past the last frame");
+        }
+        reader.close();
+    }
+
+    // a file still being written can end inside a record: only the whole ones count
+    if (expected.size() > 1) {
+        size_t kept = expected.size() / 2;
+        fs::copy_file(path, cutPath, fs::copy_options::overwrite_existing);
+        fs::resize_file(cutPath, sizeof(FrameIndexHeader) + kept * sizeof(FrameIndexRecord) + sizeof(FrameIndexRecord) / 2);
+        FrameIndexReader cutReader;
+        if (!cutReader.open(cutPath)) {
+            errors.push_back("cut: " + cutReader.errorMsg);
+        } else {
+            compare(cutReader, kept, "cut");
+        }
+    }
+
+    if (!options.isKeep) {
+        fs::remove(path);
+        fs::remove(cutPath);
+    }
+    result["ok"] = errors.empty();
+    result["errors"] = errors;
+    for (auto &error : errors) {
+        std::cerr << "[BENCH] frame index round trip: " << error << std::endl;
+    }
+    return result;
+}
+
+nlohmann::json benchImuStream(const BenchOptions& options, const Settings& settings, int i) {
+    namespace fs = std::filesystem;
+    OBSensorType sensorType = settings.sensorTypes[i];
+    std::string streamName = settings.streamNames[i];
+    std::string runDir = options.outDir + "/" + streamName;
+    fs::create_directories(runDir);
+
+    auto source = std::make_shared<SyntheticFrameSource>(options.profileDir, true, 0);
+    auto profiler = std::make_shared<StageProfiler>();
+    {
+        ImuStreamManager manager(source, sensorType, streamName, runDir, settings.profileIdx[i], settings.imuFormat, settings.imuRingSize, 0);
+        manager.setProfiler(profiler);
+        source->start();
+        std::this_thread::sleep_for(std::chrono::milliseconds((int)(options.imuSeconds * 1000)));
+        manager.close();
+        source->stop();
+    }
+
+    nlohmann::json result;
+    result["stream"] = streamName;
+    result.update(profiler->toJson());
+    if (!options.isKeep) {
+        fs::remove_all(runDir);
+    }
+    return result;
+}
+
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options = parseArgs(argc, argv);
+    Settings settings = loadSettings(options.settingsPath);
+
+    nlohmann::json report;
+    report["settings"] = options.settingsPath;
+    report["framesPerProfile"] = options.frames;
+    report["streams"] = nlohmann::json::array();
+
+    for (int i = 0; i < settings.sensorTypes.size(); i++) {
+        OBSensorType sensorType = settings.sensorTypes[i];
+        if (sensorType == OB_SENSOR_GYRO || sensorType == OB_SENSOR_ACCEL) {
+            std::cerr << "[BENCH] " << settings.streamNames[i] << std::endl;
+            report["streams"].push_back(benchImuStream(options, settings, i));
+            continue;
+        }
+
+        // every listed profile for color and depth, the configured one for IR
+        std::vector<int> profileIdx;
+        if (sensorType == OB_SENSOR_COLOR || sensorType == OB_SENSOR_DEPTH) {
+            SyntheticFrameSource source(options.profileDir, false, 0);
+            for (int idx = 0; ; idx++) {
+                try {
+                    source.getVideoProfile(sensorType, idx);
+                } catch (std::exception &e) {
+                    break;
+                }
+                if (options.profileFilter.empty() || options.profileFilter.count(idx)) {
+                    profileIdx.push_back(idx);
+                }
+            }
+        } else {
+            profileIdx.push_back(settings.profileIdx[i]);
+        }
+
+        for (int idx : profileIdx) {
+            std::cerr << "[BENCH] " << settings.streamNames[i] << " profile " << idx << std::endl;
+            report["streams"].push_back(benchImageStream(options, settings, i, idx));
+        }
+    }
+
+    // one entry per distinct packed YUV resolution
+    report["colorConvert"] = nlohmann::json::array();
+    SyntheticFrameSource source(options.profileDir, false, 0);
+    std::set<std::tuple<int, int, int>> converted;
+    for (int idx = 0; ; idx++) {
+        VideoProfileInfo profile;
+        try {
+            profile = source.getVideoProfile(OB_SENSOR_COLOR, idx);
+        } catch (std::exception &e) {
+            break;
+        }
+        bool isPackedYuv = profile.format == OB_FORMAT_YUYV || profile.format == OB_FORMAT_UYVY;
+        auto key = std::make_tuple((int)profile.format, profile.width, profile.height);
+        if (!isPackedYuv || converted.count(key) || (!options.profileFilter.empty() && !options.profileFilter.count(idx))) {
+            continue;
+        }
+        converted.insert(key);
+        std::cerr << "[BENCH] color convert " << profile.width << "x" << profile.height << std::endl;
+        auto frame = source.makeFrame(OB_SENSOR_COLOR, idx, 0, 0);
+        report["colorConvert"].push_back(benchColorConvert(options, profile.format, profile.width, profile.height, *frame->buffer));
+    }
+
+    if (options.gpioTriggers > 0) {
+        std::cerr << "[BENCH] gpio trigger" << std::endl;
+        report["gpioTrigger"] = benchGpioTrigger(options, settings);
+    }
+
+    // timecode-sized lines and raw depth frames
+    if (options.fileMb > 0) {
+        report["fileWrite"] = nlohmann::json::array();
+        for (size_t recordBytes : {(size_t)32, (size_t)640 * 480 * 2}) {
+            std::cerr << "[BENCH] file write " << recordBytes << " B records" << std::endl;
+            report["fileWrite"].push_back(benchFileWrite(options, settings, recordBytes));
+        }
+    }
+
+    // what the readers get back has to be what was written
+    bool isRoundTripOk = true;
+    if (options.roundTripFrames > 0) {
+        report["chunkLogRoundTrip"] = nlohmann::json::array();
+        for (FileWriteMode mode : {FileWriteMode::BUFFERED, FileWriteMode::DIRECT}) {
+            std::cerr << "[BENCH] chunk log round trip (" << fileWriteModeName(mode) << ")" << std::endl;
+            nlohmann::json entry = benchChunkLogRoundTrip(options, settings, mode);
+            isRoundTripOk = isRoundTripOk && entry["ok"].get<bool>();
+            report["chunkLogRoundTrip"].push_back(entry);
+        }
+        report["frameIndexRoundTrip"] = nlohmann::json::array();
+        for (FileWriteMode mode : {FileWriteMode::BUFFERED, FileWriteMode::DIRECT}) {
+            std::cerr << "[BENCH] frame index round trip (" << fileWriteModeName(mode) << ")" << std::endl;
+            nlohmann::json entry = benchFrameIndexRoundTrip(options, settings, mode);
+            isRoundTripOk = isRoundTripOk && entry["ok"].get<bool>();
+            report["frameIndexRoundTrip"].push_back(entry);
+        }
+    }
+
+    if (options.jsonPath.empty()) {
+        std::cout << report.dump(4) << std::endl;
+    } else {
+        std::ofstream ofs(options.jsonPath);
+        ofs << report.dump(4) << std::endl;
+        std::cerr << "Save report: " << options.jsonPath << std::endl;
+    }
+    return isRoundTripOk ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#include "session_runner.hpp"
+
+SessionRunner::SessionRunner(Settings settings) {
+    this->settings = settings;
+    this->recordCount = settings.recordCount;
+
+    // Open the frame source once for every record
+    try {
+        this->source = createFrameSource(settings);
+    } catch (ob::Error &e) {
+        std::cerr << "Error: " << e.getMessage() << std::endl;
+        exit(1);
+    } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        exit(1);
+    }
+}
+
+SessionRunner::~SessionRunner() {
+    stop();
+    wait();
+    this->armed.reset();
+    if (this->isSourceStarted) {
+        this->source->stop();
+    }
+}
+
+void SessionRunner::arm() {
+    if (this->armed) {
+        return;
+    }
+    auto armStart = std::chrono::steady_clock::now();
+    this->settings.recordCount = this->recordCount;
+    this->armed = std::make_unique<DataRecorder>(this->settings, this->source);
+
+    // The pipeline starts once the first record has enabled its streams, then stays up
+    if (!this->isSourceStarted) {
+        this->source->start();
+        this->isSourceStarted = true;
+    }
+    auto armMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - armStart).count();
+    std::cout << "[INFO][Record #" << this->recordCount << "] Armed in " << armMs << " ms" << std::endl;
+}
+
+void SessionRunner::start() {
+    start(std::chrono::steady_clock::now());
+}
+
+void SessionRunner::start(std::chrono::steady_clock::time_point triggerTime) {
+    if (this->active) {
+        return;
+    }
+    arm();
+    this->active = std::make_unique<Session>();
+    this->active->recorder = std::move(this->armed);
+    this->active->recorder->setTriggerTime(triggerTime);
+    this->active->thread = std::thread(&DataRecorder::startProcess, this->active->recorder.get());
+}
+
+void SessionRunner::stop() {
+    if (!this->active) {
+        return;
+    }
+    this->active->recorder->stopProcess();
+    this->active->recorder->waitCaptureStopped();
+
+    // One record finalising at a time; the previous one has had a whole record to finish
+    wait();
+    this->finishing = std::move(this->active);
+    this->recordCount++;
+}
+
+void SessionRunner::wait() {
+    if (!this->finishing) {
+        return;
+    }
+    if (this->finishing->thread.joinable()) {
+        this->finishing->thread.join();
+    }
+    this->finishing.reset();
+}
+
+int SessionRunner::getRecordCount() {
+    return this->recordCount;
+}
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include "opencv2/opencv.hpp"
+#include "settings.hpp"
+
+Settings loadSettings(const std::string& settingsPath) {
+    std::ifstream ifs(settingsPath);
+    if (!ifs.is_open()) {
+        Settings settings = {
+            {OB_SENSOR_COLOR, OB_SENSOR_DEPTH, OB_SENSOR_IR_RIGHT, OB_SENSOR_IR_LEFT, OB_SENSOR_GYRO, OB_SENSOR_ACCEL},
+            {"color", "depth", "ir_right", "ir_left", "gyro", "accel"},
+            {true, false, true, true, false, false},
+            {false, true, false, false, false, false},
+            {72, 19, 19, 19, OB_PROFILE_DEFAULT, OB_PROFILE_DEFAULT},
+            {".mp4", ".mp4", ".mp4", ".mp4", "", ""},
+            {cv::VideoWriter::fourcc('X', '2', '6', '4'), cv::VideoWriter::fourcc('X', '2', '6', '4'), cv::VideoWriter::fourcc('X', '2', '6', '4'), cv::VideoWriter::fourcc('X', '2', '6', '4'), 0, 0},
+            {".jpg", ".png", ".jpg", ".jpg", "", ""},
+            {{cv::IMWRITE_JPEG_QUALITY, 100}, {cv::IMWRITE_PNG_COMPRESSION, 0}, {cv::IMWRITE_JPEG_QUALITY, 100}, {cv::IMWRITE_JPEG_QUALITY, 100}, {}, {}},
+            -1.0,
+            "/home/rock/camera_test/rover_recorder",
+            0,
+            {},
+            {8, 8, 8, 8, 8, 8},
+            {DropPolicy::DROP_OLDEST, DropPolicy::DROP_OLDEST, DropPolicy::DROP_OLDEST, DropPolicy::DROP_OLDEST, DropPolicy::DROP_OLDEST, DropPolicy::DROP_OLDEST},
+        };
+        settings.videoEncoders.resize(settings.sensorTypes.size());
+        return settings;
+    } else {
+        nlohmann::json j;
+        ifs >> j;
+
+        std::vector<OBSensorType> sensorTypes;
+        std::vector<std::string> streamNames;
+        std::vector<bool> isSaveVideo;
+        std::vector<bool> isSaveImage;
+        std::vector<int> profileIdx;
+        std::vector<std::string> containerFormats;
+        std::vector<int> codecs;
+        std::vector<std::string> imageFormats;
+        std::vector<std::vector<int>> compressionParams;
+        std::vector<int> queueDepths;
+        std::vector<DropPolicy> dropPolicies;
+        std::vector<VideoEncoderConfig> videoEncoders;
+        float videoLength;
+        std::string saveDir;
+
+        for (int i = 0; i < j["sensorTypes"].size(); i++) {
+            OBSensorType sensorType = j["sensorTypes"][i];
+            switch (sensorType) {
+                case OB_SENSOR_COLOR:
+                    sensorTypes.push_back(OB_SENSOR_COLOR);
+                    streamNames.push_back("color");
+                    break;
+                case OB_SENSOR_DEPTH:
+                    sensorTypes.push_back(OB_SENSOR_DEPTH);
+                    streamNames.push_back("depth");
+                    break;
+                case OB_SENSOR_IR_RIGHT:
+                    sensorTypes.push_back(OB_SENSOR_IR_RIGHT);
+                    streamNames.push_back("ir_right");
+                    break;
+                case OB_SENSOR_IR_LEFT:
+                    sensorTypes.push_back(OB_SENSOR_IR_LEFT);
+                    streamNames.push_back("ir_left");
+                    break;
+                case OB_SENSOR_GYRO:
+                    sensorTypes.push_back(OB_SENSOR_GYRO);
+                    streamNames.push_back("gyro");
+                    break;
+                case OB_SENSOR_ACCEL:
+                    sensorTypes.push_back(OB_SENSOR_ACCEL);
+                    streamNames.push_back("accel");
+                    break;
+            }
+
+            isSaveVideo.push_back(j["isSaveVideo"][i]);
+            isSaveImage.push_back(j["isSaveImage"][i]);
+            profileIdx.push_back(j["profileIdx"][i]);
+
+            containerFormats.push_back(j["containerFormats"][i]);
+            if (containerFormats[i] == ".mp4") {
+                codecs.push_back(cv::VideoWriter::fourcc('X', '2', '6', '4'));
+            } else if (containerFormats[i] == ".avi") {
+                codecs.push_back(cv::VideoWriter::fourcc('M', 'J', 'P', 'G'));
+            } else {
+                codecs.push_back(0);
+            }
+            imageFormats.push_back(j["imageFormats"][i]);
+            if (imageFormats[i] == ".jpg") {
+                int quality = j["jpgQuality"];
+                compressionParams.push_back({cv::IMWRITE_JPEG_QUALITY, quality});
+            } else if (imageFormats[i] == ".jp2") {
+                int quality = j["jp2Quality"];
+                compressionParams.push_back({cv::IMWRITE_JPEG2000_COMPRESSION_X1000, quality});
+            } else if (imageFormats[i] == ".png") {
+                int quality = j["pngQuality"];
+                compressionParams.push_back({cv::IMWRITE_PNG_COMPRESSION, quality});
+            } else {
+                compressionParams.push_back({});
+            }
+
+            // writer queue is optional in settings.json
+            if (j.contains("queueDepths")) {
+                queueDepths.push_back(j["queueDepths"][i]);
+            } else {
+                queueDepths.push_back(8);
+            }
+            if (j.contains("dropPolicies")) {
+                dropPolicies.push_back(parseDropPolicy(j["dropPolicies"][i]));
+            } else {
+                dropPolicies.push_back(DropPolicy::DROP_OLDEST);
+            }
+
+            // an encoder is a name, or an object with the name and its per-stream options
+            VideoEncoderConfig encoder;
+            encoder.threads = j.value("encoderThreads", 0);
+            if (j.contains("videoEncoders")) {
+                const auto& entry = j["videoEncoders"][i];
+                if (entry.is_object()) {
+                    encoder.encoder = entry.value("encoder", encoder.encoder);
+                    encoder.threads = entry.value("threads", encoder.threads);
+                    encoder.preset = entry.value("preset", encoder.preset);
+                    encoder.tune = entry.value("tune", encoder.tune);
+                    encoder.crf = entry.value("crf", encoder.crf);
+                    encoder.gop = entry.value("gop", encoder.gop);
+                    encoder.pixelFormat = entry.value("pixelFormat", encoder.pixelFormat);
+                } else {
+                    encoder.encoder = entry;
+                }
+            }
+            videoEncoders.push_back(encoder);
+        }
+        videoLength = j["videoLength"];
+        saveDir = j["saveDir"];
+
+        Settings settings = {
+            sensorTypes,
+            streamNames,
+            isSaveVideo,
+            isSaveImage,
+            profileIdx,
+            containerFormats,
+            codecs,
+            imageFormats,
+            compressionParams,
+            videoLength,
+            saveDir,
+            0,
+            videoEncoders,
+            queueDepths,
+            dropPolicies,
+        };
+        settings.frameSource = j.value("frameSource", settings.frameSource);
+        settings.sourceDir = j.value("sourceDir", settings.sourceDir);
+        settings.sourceRealtime = j.value("sourceRealtime", settings.sourceRealtime);
+        settings.sourceRate = j.value("sourceRate", settings.sourceRate);
+        settings.imageEncoderThreads = j.value("imageEncoderThreads", settings.imageEncoderThreads);
+        settings.imageQueueDepth = j.value("imageQueueDepth", settings.imageQueueDepth);
+        settings.imuFormat = j.value("imuFormat", settings.imuFormat);
+        settings.imuRingSize = j.value("imuRingSize", settings.imuRingSize);
+        settings.timecode.isIndex = j.value("timecodeIndex", settings.timecode.isIndex);
+        settings.timecode.isFrameIndex = j.value("frameIndex", settings.timecode.isFrameIndex);
+        settings.timecode.flushIntervalMs = j.value("timecodeFlushMs", settings.timecode.flushIntervalMs);
+        settings.bufferBudgetMb = j.value("bufferBudgetMb", settings.bufferBudgetMb);
+        settings.bufferWaitMs = j.value("bufferWaitMs", settings.bufferWaitMs);
+        settings.mjpegPassthrough = j.value("mjpegPassthrough", settings.mjpegPassthrough);
+        settings.depthPreview.mode = parseDepthPreviewMode(j.value("depthPreviewMode", "auto"));
+        if (j.contains("depthRangeMm")) {
+            settings.depthPreview.minMm = j["depthRangeMm"][0];
+            settings.depthPreview.maxMm = j["depthRangeMm"][1];
+        }
+        settings.depthPreview.colormap = j.value("depthColormap", settings.depthPreview.colormap);
+        settings.segmentSeconds = j.value("segmentSeconds", settings.segmentSeconds);
+        settings.segmentMb = j.value("segmentMb", settings.segmentMb);
+        settings.gpioBackend = j.value("gpioBackend", settings.gpioBackend);
+        settings.gpioInputChip = j.value("gpioInputChip", settings.gpioInputChip);
+        settings.gpioInputLine = j.value("gpioInputLine", settings.gpioInputLine);
+        settings.gpioOutputChip = j.value("gpioOutputChip", settings.gpioOutputChip);
+        settings.gpioOutputLine = j.value("gpioOutputLine", settings.gpioOutputLine);
+        settings.gpioDebounceMs = j.value("gpioDebounceMs", settings.gpioDebounceMs);
+        settings.preRollSeconds = j.value("preRollSeconds", settings.preRollSeconds);
+        settings.preRollMb = j.value("preRollMb", settings.preRollMb);
+        settings.preRollJpegQuality = j.value("preRollJpegQuality", settings.preRollJpegQuality);
+        settings.stereoIr = j.value("stereoIr", settings.stereoIr);
+        settings.statsIntervalMs = j.value("statsIntervalMs", settings.statsIntervalMs);
+        settings.statsPromPath = j.value("statsPromPath", settings.statsPromPath);
+        settings.trace = j.value("trace", settings.trace);
+        settings.traceBufferEvents = j.value("traceBufferEvents", settings.traceBufferEvents);
+        settings.ingestMode = j.value("ingestMode", settings.ingestMode);
+        settings.recordFormat = j.value("recordFormat", settings.recordFormat);
+        settings.chunkCompression = j.value("chunkCompression", settings.chunkCompression);
+        settings.chunkKb = j.value("chunkKb", settings.chunkKb);
+        if (j.contains("backpressure")) {
+            const auto& entry = j["backpressure"];
+            BackpressureConfig& config = settings.backpressure;
+            config.isEnable = entry.value("enable", config.isEnable);
+            // unknown step names are left out rather than read as some other step
+            auto parseSteps = [](const nlohmann::json& names, const std::string& where, std::vector<DegradeStep>& steps) {
+                for (const auto& name : names) {
+                    DegradeStep step;
+                    if (parseDegradeStep(name.get<std::string>(), step)) {
+                        steps.push_back(step);
+                    } else {
+                        std::cerr << "[WARN] Unknown backpressure step " << name << " in " << where << ", ignored" << std::endl;
+                    }
+                }
+            };
+            if (entry.contains("ladder")) {
+                config.ladder.clear();
+                parseSteps(entry["ladder"], "ladder", config.ladder);
+            }
+            if (entry.contains("streams")) {
+                for (auto &item : entry["streams"].items()) {
+                    parseSteps(item.value(), item.key(), config.streams[item.key()]);
+                }
+            }
+            config.queueHigh = entry.value("queueHigh", config.queueHigh);
+            config.queueLow = entry.value("queueLow", config.queueLow);
+            config.latencyHighMs = entry.value("latencyHighMs", config.latencyHighMs);
+            config.latencyLowMs = entry.value("latencyLowMs", config.latencyLowMs);
+            config.escalateMs = entry.value("escalateMs", config.escalateMs);
+            config.recoverMs = entry.value("recoverMs", config.recoverMs);
+            config.jpegQuality = entry.value("jpegQuality", config.jpegQuality);
+            config.decimation = std::max(1, entry.value("decimation", config.decimation));
+        }
+        auto parseFileWriter = [](const nlohmann::json& entry, FileWriterConfig& config) {
+            config.mode = parseFileWriteMode(entry.value("mode", fileWriteModeName(config.mode)));
+            config.blockBytes = (size_t)entry.value("blockKb", (int)(config.blockBytes >> 10)) << 10;
+            config.preallocateBytes = (size_t)entry.value("preallocateKb", (int)(config.preallocateBytes >> 10)) << 10;
+            config.syncBytes = (size_t)entry.value("syncKb", (int)(config.syncBytes >> 10)) << 10;
+        };
+        if (j.contains("fileWriter")) {
+            parseFileWriter(j["fileWriter"], settings.fileWriter);
+        }
+        settings.chunkLogWriter.mode = settings.fileWriter.mode;
+        if (j.contains("chunkLogWriter")) {
+            parseFileWriter(j["chunkLogWriter"], settings.chunkLogWriter);
+        }
+        // timecodes and frame indexes are opened with the stream's TimecodeConfig
+        settings.timecode.fileWriter = settings.fileWriter;
+        if (j.contains("threads")) {
+            for (auto &item : j["threads"].items()) {
+                ThreadConfig config;
+                config.cpus = item.value().value("cpus", std::vector<int>());
+                config.fifoPriority = item.value().value("fifoPriority", 0);
+                settings.threads[item.key()] = config;
+            }
+        }
+
+        return settings;
+    }
+}
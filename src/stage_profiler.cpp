@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <time.h>
+#include "stage_profiler.hpp"
+
+namespace {
+
+const char *STAGE_NAMES[STAGE_COUNT] = {"convert", "normalize", "encode", "imwrite", "timecode"};
+
+double percentileMs(const std::vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[idx] / 1e6;
+}
+
+}
+
+const char *stageName(ProfileStage stage) {
+    return stage < STAGE_COUNT ? STAGE_NAMES[stage] : "stage";
+}
+
+int64_t StageProfiler::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t StageProfiler::threadCpuTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void StageProfiler::record(ProfileStage stage, int64_t ns) {
+    this->samples[stage].push_back(ns);
+}
+
+void StageProfiler::addFrame(int64_t startNs, int64_t endNs) {
+    if (this->frameCount == 0) {
+        this->firstStart = startNs;
+    }
+    this->lastEnd = endNs;
+    this->frameCount++;
+}
+
+void StageProfiler::addCpuTime(int64_t ns) {
+    this->cpuTime += ns;
+}
+
+nlohmann::json StageProfiler::toJson() {
+    nlohmann::json j;
+    double wallSec = (this->lastEnd - this->firstStart) / 1e9;
+    j["frames"] = this->frameCount;
+    j["wallTime [s]"] = wallSec;
+    j["fps"] = wallSec > 0 ? this->frameCount / wallSec : 0;
+    j["cpu [%]"] = wallSec > 0 ? 100.0 * this->cpuTime / 1e9 / wallSec : 0;
+
+    nlohmann::json stages;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (this->samples[i].empty()) {
+            continue;
+        }
+        std::vector<int64_t> sorted = this->samples[i];
+        std::sort(sorted.begin(), sorted.end());
+        stages[STAGE_NAMES[i]] = {
+            {"count", sorted.size()},
+            {"p50 [ms]", percentileMs(sorted, 0.50)},
+            {"p99 [ms]", percentileMs(sorted, 0.99)},
+            {"max [ms]", sorted.back() / 1e6},
+        };
+    }
+    j["stages"] = stages;
+    return j;
+}
@@ -1,16 +1,15 @@
 #include "stream_manager.hpp"
+#include "color_convert.hpp"
 
-StreamManager::StreamManager(std::shared_ptr<ob::Pipeline> pipe,
-                             std::shared_ptr<ob::Device> device,
-                             std::shared_ptr<ob::Config> config,
+StreamManager::StreamManager(std::shared_ptr<FrameSource> source,
                              OBSensorType sensorType,
                              const std::string& streamName,
                              const std::string& saveDir,
                              int profileIdx) {
+    this->source = source;
     try {
         // Check if sensor type is available
-        auto sensor = device->getSensorList()->getSensor(sensorType);
-        if (!sensor) {
+        if (!source->hasSensor(sensorType)) {
             std::cerr << "Sensor type: " << sensorType << " not found" << std::endl;
             this->errorMsg += "Sensor type: " + std::to_string(sensorType) + " not found";
             this->isEnable = false;
@@ -63,37 +62,64 @@ nlohmann::json StreamManager::getMetadata() {
     }
 }
 
+void StreamManager::setProfiler(std::shared_ptr<StageProfiler> profiler) {
+    this->profiler = profiler;
+}
+
+const StreamStats& StreamManager::getStats() {
+    return this->stats;
+}
+
 inline void StreamManager::close() {
     return;
 }
 
-inline void StreamManager::processFrameset(std::shared_ptr<ob::FrameSet> frameset) {
+void StreamManager::stopCapture() {
+    return;
+}
+
+int StreamManager::getSegmentCount() {
+    return 0;
+}
+
+void StreamManager::processPreRoll(std::shared_ptr<SourceFrameSet> frameset) {
+    return;
+}
+
+void StreamManager::endPreRoll() {
+    return;
+}
+
+inline void StreamManager::processFrameset(std::shared_ptr<SourceFrameSet> frameset) {
+    return;
+}
+
+void StreamManager::processFrame(std::shared_ptr<SourceFrame> frame) {
     return;
 }
 
-ImageStreamManager::ImageStreamManager(std::shared_ptr<ob::Pipeline> pipe,
-                                       std::shared_ptr<ob::Device> device,
-                                       std::shared_ptr<ob::Config> config,
+ImageStreamManager::ImageStreamManager(std::shared_ptr<FrameSource> source,
                                        OBSensorType sensorType,
                                        const std::string& streamName,
                                        const std::string& saveDir,
                                        int profileIdx,
-                                       bool isSaveVideo,
-                                       bool isSaveImage,
-                                       const std::string& containerFormat,
-                                       int codec,
-                                       const std::string& imageFormat,
-                                       std::vector<int> compressionParams) :
-    StreamManager(pipe, device, config, sensorType, streamName, saveDir, profileIdx) {
+                                       const ImageStreamConfig& config,
+                                       std::shared_ptr<ChunkLogWriter> chunkLog) :
+    StreamManager(source, sensorType, streamName, saveDir, profileIdx) {
+    this->queueDepth = config.queueDepth;
+    this->dropPolicy = config.dropPolicy;
     if (!this->isEnable) {
         return;
     }
-    this->isSaveVideo = isSaveVideo;
-    this->isSaveImage = isSaveImage;
-    this->containerFormat = containerFormat;
-    this->codec = codec;
-    this->imageFormat = imageFormat;
-    this->compressionParams = compressionParams;
+    // the chunk log replaces the stream's video, timecode and image files
+    this->chunkLog = chunkLog;
+    this->isSaveVideo = config.isSaveVideo && !chunkLog;
+    this->isSaveImage = config.isSaveImage && !chunkLog;
+    this->containerFormat = config.containerFormat;
+    this->codec = config.codec;
+    this->imageFormat = config.imageFormat;
+    this->compressionParams = config.compressionParams;
+    this->encoderConfig = config.encoder;
     // Check if sensor type is valid
     if (sensorType != OB_SENSOR_COLOR && sensorType != OB_SENSOR_DEPTH && sensorType != OB_SENSOR_IR_LEFT && sensorType != OB_SENSOR_IR_RIGHT) {
         std::cerr << "Invalid sensor type for ImageStreamManager" << std::endl;
@@ -104,47 +130,113 @@ ImageStreamManager::ImageStreamManager(std::shared_ptr<ob::Pipeline> pipe,
 
     try {
         // Enable stream
-        auto profiles = pipe->getStreamProfileList(sensorType);
-        auto profile = profiles->getProfile(profileIdx);
-        auto videoProfile = profile->as<ob::VideoStreamProfile>();
+        auto videoProfile = source->getVideoProfile(sensorType, profileIdx);
         bool isColor = false;
         if (sensorType == OB_SENSOR_COLOR) {
             isColor = true;
         }
-        config->enableStream(videoProfile);
+        source->enableStream(sensorType, profileIdx);
         this->isEnable = true;
 
-        // Store color profile
-        try {
-            colorProfile = pipe->getStreamProfileList(OB_SENSOR_COLOR)
-                ->getProfile(OB_PROFILE_DEFAULT)
-                ->as<ob::VideoStreamProfile>();
-            this->colorProfile = colorProfile;
-        } catch (ob::Error &e) {
-            std::cerr << "Color profile not found" << std::endl;
-            this->errorMsg += "Color profile not found";
-        }
-
         // Set camera parameters
         setCameraParams(videoProfile, isColor);
+        this->videoWidth = this->width;
+        this->stats.setExpectedFps(this->fps);
+
+        // Stereo IR: this stream also takes the right camera and writes both into one video
+        if (config.isStereo) {
+            if (sensorType != OB_SENSOR_IR_LEFT || !source->hasSensor(OB_SENSOR_IR_RIGHT)) {
+                std::cerr << "Stereo IR needs both IR sensors" << std::endl;
+                this->errorMsg += "Stereo IR needs both IR sensors";
+                this->isEnable = false;
+                return;
+            }
+            auto rightProfile = source->getVideoProfile(OB_SENSOR_IR_RIGHT, profileIdx);
+            if (rightProfile.width != videoProfile.width || rightProfile.height != videoProfile.height) {
+                std::cerr << "IR left and right profiles differ in size" << std::endl;
+                this->errorMsg += "IR left and right profiles differ in size";
+                this->isEnable = false;
+                return;
+            }
+            source->enableStream(OB_SENSOR_IR_RIGHT, profileIdx);
+            this->isStereo = true;
+            this->videoWidth = this->width * 2;
+
+            // right half calibration, extrinsic to color as for the left camera
+            this->rightCamera["fx"] = rightProfile.intrinsic.fx;
+            this->rightCamera["fy"] = rightProfile.intrinsic.fy;
+            this->rightCamera["cx"] = rightProfile.intrinsic.cx;
+            this->rightCamera["cy"] = rightProfile.intrinsic.cy;
+            this->rightCamera["k1"] = rightProfile.distortion.k1;
+            this->rightCamera["k2"] = rightProfile.distortion.k2;
+            this->rightCamera["k3"] = rightProfile.distortion.k3;
+            this->rightCamera["k4"] = rightProfile.distortion.k4;
+            this->rightCamera["k5"] = rightProfile.distortion.k5;
+            this->rightCamera["k6"] = rightProfile.distortion.k6;
+            this->rightCamera["p1"] = rightProfile.distortion.p1;
+            this->rightCamera["p2"] = rightProfile.distortion.p2;
+            if (rightProfile.hasExtrinsic) {
+                this->rightCamera["r"] = std::vector<float>(rightProfile.extrinsic.rot, rightProfile.extrinsic.rot + 9);
+                this->rightCamera["t"] = std::vector<float>(rightProfile.extrinsic.trans, rightProfile.extrinsic.trans + 3);
+            }
+        }
 
-        // Open timecode writer
-        this->timecodeName = saveDir + "/" + streamName + "_timecode.txt";
-        this->timecodeWriter.open(this->timecodeName);
-        if (this->timecodeWriter.is_open()) {
-            if (sensorType == OB_SENSOR_DEPTH) {
-                this->timecodeWriter << "timestamp [ms],value scale" << std::endl;
+        // Depth preview can be a colormap, which needs a color video
+        bool isColorVideo = isColor;
+        if (sensorType == OB_SENSOR_DEPTH) {
+            this->depthPreview = DepthPreview(config.depthPreview);
+            isColorVideo = this->depthPreview.isColor();
+        }
+
+        // MJPEG frames are stored without decoding: Matroska video and raw .jpg images
+        if (config.isMjpegPassthrough && videoProfile.format == OB_FORMAT_MJPEG) {
+            this->isMjpegPassthrough = true;
+            this->containerFormat = ".mkv";
+            this->codec = cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+            this->imageFormat = ".jpg";
+        }
+        this->isColorVideo = isColorVideo;
+        this->isAvVideo = !this->isMjpegPassthrough && this->encoderConfig.encoder != "opencv";
+        if (this->isAvVideo && this->encoderConfig.encoder == "ffv1") {
+            this->containerFormat = ".mkv";
+        }
+        // Depth goes in as raw 16-bit to ffv1, which keeps the measurement; lossy encoders
+        // get the 8-bit preview, as with OpenCV.
+        // Color goes in as the camera's YUV when it has one, without a BGR round trip.
+        if (sensorType == OB_SENSOR_DEPTH) {
+            this->isRawDepthVideo = this->isAvVideo && this->encoderConfig.encoder == "ffv1";
+            if (this->isRawDepthVideo) {
+                this->videoPixelFormat = VideoPixelFormat::GRAY16;
             } else {
-                this->timecodeWriter << "timestamp [ms]" << std::endl;
+                this->videoPixelFormat = isColorVideo ? VideoPixelFormat::BGR24 : VideoPixelFormat::GRAY8;
+            }
+        } else if (sensorType == OB_SENSOR_COLOR) {
+            if (videoProfile.format == OB_FORMAT_YUYV) {
+                this->videoPixelFormat = VideoPixelFormat::YUYV422;
+            } else if (videoProfile.format == OB_FORMAT_UYVY) {
+                this->videoPixelFormat = VideoPixelFormat::UYVY422;
+            } else if (videoProfile.format == OB_FORMAT_NV12) {
+                this->videoPixelFormat = VideoPixelFormat::NV12;
+            } else {
+                this->videoPixelFormat = VideoPixelFormat::BGR24;
             }
         }
 
-        // Open video writer
-        if (this->isSaveVideo) {
-            this->videoName = saveDir + "/" + streamName + this->containerFormat;
-            float fps = videoProfile->fps();
-            cv::Size frameSize(videoProfile->width(), videoProfile->height());
-            this->videoWriter.open(this->videoName, this->codec, fps, frameSize, isColor);
+        // Open the first segment, and prepare the next one when recordings are split
+        this->timecodeConfig = config.timecode;
+        this->segmentSeconds = config.segmentSeconds;
+        this->segmentMb = config.segmentMb;
+        this->isSegmented = this->isSaveVideo && (this->segmentSeconds > 0 || this->segmentMb > 0);
+        if (!this->chunkLog) {
+            this->segment = openSegment(0);
+            this->errorMsg += this->segment->errorMsg;
+            this->videoName = this->segment->videoName;
+            this->timecodeName = this->segment->timecodeName;
+            this->timecodeIndexName = this->segment->timecodeIndexName;
+        }
+        if (this->isSegmented) {
+            this->segments.push_back(this->segment->getMetadata());
+            this->nextSegment = std::async(std::launch::async, &ImageStreamManager::openSegment, this, 1);
         }
 
         // Create image directory
@@ -163,6 +255,14 @@ ImageStreamManager::ImageStreamManager(std::shared_ptr<ob::Pipeline> pipe,
                 std::cout << "Directory already exists: " << imageDir << std::endl;
             }
         }
+
+        if (this->chunkLog) {
+            this->chunkChannel = this->chunkLog->addChannel(streamName, "rover.frame", getMetadata());
+        }
+
+        // Start writer thread
+        this->frameQueue = std::make_unique<FrameQueue<std::shared_ptr<SourceFrame>>>(this->queueDepth, this->dropPolicy);
+        this->worker = std::thread(&ImageStreamManager::workerLoop, this);
     } catch (ob::Error &e) {
         std::cerr << "Error: " << e.getMessage() << std::endl;
         this->errorMsg += e.getMessage();
@@ -175,159 +275,730 @@ ImageStreamManager::ImageStreamManager(std::shared_ptr<ob::Pipeline> pipe,
     }
 }
 
-inline void ImageStreamManager::processFrameset(std::shared_ptr<ob::FrameSet> frameset) {
-    if (!this->isEnable) {
+ImageStreamManager::~ImageStreamManager() {
+    close();
+}
+
+// Open the timecode and video writers of one segment. Runs on a background thread for
+// every segment after the first, so it only reads settings fixed in the constructor.
+std::unique_ptr<ImageStreamManager::Segment> ImageStreamManager::openSegment(int index) {
+    auto segment = std::make_unique<Segment>();
+    segment->index = index;
+    std::string baseName = this->saveDir + "/" + this->streamName;
+    if (this->isSegmented) {
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), "_%03d", index);
+        baseName += suffix;
+    }
+
+    // Open timecode writer
+    segment->timecodeName = baseName + "_timecode.txt";
+    if (this->timecodeConfig.isIndex) {
+        segment->timecodeIndexName = baseName + "_timecode.idx";
+    }
+    std::string timecodeHeader = this->sensorType == OB_SENSOR_DEPTH ? "timestamp [ms],value scale" : "timestamp [ms]";
+    if (!segment->timecodeWriter.open(segment->timecodeName, timecodeHeader, segment->timecodeIndexName, this->timecodeConfig)) {
+        std::cerr << "Failed to open file: " << segment->timecodeName << std::endl;
+        segment->errorMsg += "Failed to open file: " + segment->timecodeName;
+    }
+    if (this->timecodeConfig.isFrameIndex) {
+        segment->frameIndexName = baseName + "_frames.idx";
+        if (!segment->frameIndex.open(segment->frameIndexName, this->timecodeConfig.fileWriter)) {
+            std::cerr << "Failed to open file: " << segment->frameIndexName << std::endl;
+            segment->errorMsg += "Failed to open file: " + segment->frameIndexName;
+            segment->frameIndexName.clear();
+        }
+    }
+
+    // Open video writer
+    if (!this->isSaveVideo) {
+        return segment;
+    }
+    segment->videoName = baseName + this->containerFormat;
+    if (this->isMjpegPassthrough) {
+        if (!segment->mkvWriter.open(segment->videoName, "V_MJPEG", this->width, this->height, this->fps)) {
+            std::cerr << "Failed to open video: " << segment->videoName << std::endl;
+            segment->errorMsg += "Failed to open video: " + segment->videoName;
+        }
+    } else if (this->isAvVideo) {
+        std::map<std::string, std::string> codecOptions;
+        if (this->encoderConfig.encoder == "ffv1") {
+            // intra only with sliced coding: every frame is a seek point and slices encode in parallel
+            codecOptions = {{"level", "3"}, {"g", "1"}, {"slices", "16"}, {"slicecrc", "1"}};
+        }
+        if (!this->encoderConfig.preset.empty()) {
+            codecOptions["preset"] = this->encoderConfig.preset;
+        }
+        if (!this->encoderConfig.tune.empty()) {
+            codecOptions["tune"] = this->encoderConfig.tune;
+        }
+        if (this->encoderConfig.crf >= 0) {
+            codecOptions["crf"] = std::to_string(this->encoderConfig.crf);
+        }
+        if (this->encoderConfig.gop > 0) {
+            codecOptions["g"] = std::to_string(this->encoderConfig.gop);
+        }
+        if (!segment->avWriter.open(segment->videoName, this->encoderConfig.encoder, this->videoWidth, this->height,
+                                    this->videoPixelFormat, this->fps, this->encoderConfig.threads, codecOptions,
+                                    this->encoderConfig.pixelFormat)) {
+            segment->errorMsg += segment->avWriter.getError();
+        }
+    } else {
+        segment->videoWriter.open(segment->videoName, this->codec, this->fps, cv::Size(this->videoWidth, this->height), this->isColorVideo);
+    }
+    if (segment->frameIndex.isOpened()) {
+        segment->mkvWriter.setFrameIndex(&segment->frameIndex);
+        segment->avWriter.setFrameIndex(&segment->frameIndex);
+    }
+    return segment;
+}
+
+// Account a frame to the current segment, switching to the prepared one when it is full
+inline void ImageStreamManager::updateSegment(uint64_t timeStamp) {
+    if (this->isSegmented && !this->isRollFailed && this->segment->frameCount > 0 && isSegmentFull(timeStamp)) {
+        rollSegment();
+    }
+    if (this->segment->frameCount == 0) {
+        this->segment->firstTimeStamp = timeStamp;
+        for (const std::string& name : {this->segment->videoName, this->segment->timecodeName, this->segment->timecodeIndexName, this->segment->frameIndexName}) {
+            if (!name.empty()) {
+                this->outputFiles.push_back(name);
+            }
+        }
+    }
+    // files grow in the background (encoder buffers, timecode flushes), so sizes are sampled
+    if (timeStamp > this->bytesCheckTimeStamp && timeStamp - this->bytesCheckTimeStamp >= 500) {
+        this->bytesCheckTimeStamp = timeStamp;
+        updateBytesWritten();
+    }
+    this->segment->lastTimeStamp = timeStamp;
+    this->segment->frameCount++;
+}
+
+// Called once per frame, after updateSegment() and before the frame goes to the video writer
+inline void ImageStreamManager::indexFrame(const SourceFrame& frame) {
+    if (!this->segment->frameIndex.isOpened()) {
         return;
     }
+    // OpenCV's writer does not tell where a frame went
+    bool isPacketExpected = this->isSaveVideo && (this->segment->avWriter.isOpened() || this->segment->mkvWriter.isOpened());
+    uint64_t timeStampUs = frame.timeStampUs > 0 ? frame.timeStampUs : frame.timeStamp * 1000;
+    this->segment->frameIndex.addFrame(timeStampUs, (uint32_t)this->count, this->isImageFrame, isPacketExpected);
+}
 
-    switch (this->sensorType) {
-        case OB_SENSOR_COLOR:
-            processColorFrame(frameset);
-            break;
-        case OB_SENSOR_DEPTH:
-            processDepthFrame(frameset);
-            break;
-        case OB_SENSOR_IR_LEFT:
-            processIrFrame(frameset);
-            break;
-        case OB_SENSOR_IR_RIGHT:
-            processIrFrame(frameset);
-            break;
+inline bool ImageStreamManager::isSegmentFull(uint64_t timeStamp) {
+    if (this->segmentSeconds > 0 && timeStamp > this->segment->firstTimeStamp &&
+        timeStamp - this->segment->firstTimeStamp >= (uint64_t)(this->segmentSeconds * 1000)) {
+        return true;
+    }
+    // encoders buffer internally, so the file size is only sampled twice a second
+    if (this->segmentMb > 0 && timeStamp > this->sizeCheckTimeStamp && timeStamp - this->sizeCheckTimeStamp >= 500) {
+        this->sizeCheckTimeStamp = timeStamp;
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(this->segment->videoName, ec);
+        return !ec && size >= ((uintmax_t)this->segmentMb << 20);
+    }
+    return false;
+}
+
+void ImageStreamManager::rollSegment() {
+    TraceSpan span("rollSegment");
+    // Normally ready long ago; open in place if the previous open is still missing
+    std::unique_ptr<Segment> next;
+    try {
+        next = this->nextSegment.valid() ? this->nextSegment.get() : openSegment(this->segment->index + 1);
+    } catch (std::exception &e) {
+        // keep writing the current segment rather than losing frames
+        std::cerr << "Error: " << e.what() << std::endl;
+        this->errorMsg += e.what();
+        this->isRollFailed = true;
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->segmentMutex);
+        this->segments.back() = this->segment->getMetadata();
+        this->segments.push_back(next->getMetadata());
+        this->errorMsg += next->errorMsg;
+    }
+
+    // Encoder flush and file finalisation happen off the worker thread
+    if (this->closingSegment.valid()) {
+        this->closingSegment.wait();
+    }
+    this->closingSegment = std::async(std::launch::async, [previous = std::move(this->segment)]() {
+        previous->release();
+    });
+    this->segment = std::move(next);
+    this->sizeCheckTimeStamp = 0;
+    this->nextSegment = std::async(std::launch::async, &ImageStreamManager::openSegment, this, this->segment->index + 1);
+}
+
+void ImageStreamManager::Segment::release() {
+    if (this->videoWriter.isOpened()) {
+        this->videoWriter.release();
+    }
+    this->mkvWriter.release();
+    this->avWriter.release();
+    this->timecodeWriter.close();
+    // after the writers, whose last packets still come out on release
+    this->frameIndex.close();
+}
+
+nlohmann::json ImageStreamManager::Segment::getMetadata() const {
+    nlohmann::json metadata;
+    metadata["index"] = this->index;
+    metadata["videoName"] = this->videoName;
+    metadata["timecodeName"] = this->timecodeName;
+    if (!this->timecodeIndexName.empty()) {
+        metadata["timecodeIndexName"] = this->timecodeIndexName;
+    }
+    if (!this->frameIndexName.empty()) {
+        metadata["frameIndexName"] = this->frameIndexName;
+    }
+    metadata["timecodeWriter"] = this->timecodeWriter.getMetadata();
+    metadata["frameCount"] = this->frameCount;
+    metadata["firstTimeStamp"] = this->firstTimeStamp;
+    metadata["lastTimeStamp"] = this->lastTimeStamp;
+    return metadata;
+}
+
+int ImageStreamManager::getSegmentCount() {
+    std::lock_guard<std::mutex> lock(this->segmentMutex);
+    return (int)this->segments.size();
+}
+
+// Runs on the capture thread: only pick the frame out and hand it to the worker
+inline void ImageStreamManager::processFrameset(std::shared_ptr<SourceFrameSet> frameset) {
+    if (!this->isEnable || !this->frameQueue) {
+        return;
+    }
+
+    auto frame = pickFrame(*frameset);
+    if (frame == nullptr) {
+        return;
     }
+    queueFrame(frame, false);
 }
 
-inline void ImageStreamManager::processColorFrame(std::shared_ptr<ob::FrameSet> frameset) {
-    auto colorFrame = frameset->colorFrame();
-    if (colorFrame == nullptr) {
+void ImageStreamManager::processFrame(std::shared_ptr<SourceFrame> frame) {
+    if (!this->isEnable || !this->frameQueue) {
         return;
     }
+    if (this->isStereo) {
+        pairFrame(frame, false);
+    } else if (frame->type == frameTypeOf((OBSensorType)this->sensorType)) {
+        queueFrame(frame, false);
+    }
+}
 
-    // Convert color frame to BGR format
-    if (colorFrame->format() != OB_FORMAT_RGB) {
-        if (colorFrame->format() == OB_FORMAT_MJPEG) {
-            this->filter.setFormatConvertType(FORMAT_MJPEG_TO_RGB888);
-        } else if (colorFrame->format() == OB_FORMAT_UYVY) {
-            this->filter.setFormatConvertType(FORMAT_UYVY_TO_RGB888);
-        } else if (colorFrame->format() == OB_FORMAT_YUYV) {
-            this->filter.setFormatConvertType(FORMAT_YUYV_TO_RGB888);
+// Callback ingestion: left and right IR frames arrive one by one and leave as one stereo pair
+void ImageStreamManager::pairFrame(std::shared_ptr<SourceFrame> frame, bool isBacklog) {
+    if (frame->type != OB_FRAME_IR_LEFT && frame->type != OB_FRAME_IR_RIGHT) {
+        return;
+    }
+
+    // the two IR sensors expose together, so a pair shares its timestamp within half a frame period
+    std::shared_ptr<SourceFrame> pair;
+    {
+        std::lock_guard<std::mutex> lock(this->stereoMutex);
+        bool isLeft = frame->type == OB_FRAME_IR_LEFT;
+        auto &mine = isLeft ? this->pendingLeft : this->pendingRight;
+        auto &other = isLeft ? this->pendingRight : this->pendingLeft;
+        double toleranceMs = this->fps > 0 ? 500.0 / this->fps : 5.0;
+        if (other != nullptr && std::fabs((double)frame->timeStamp - (double)other->timeStamp) <= toleranceMs) {
+            SourceFrameSet frameset;
+            frameset.frames.push_back(frame);
+            frameset.frames.push_back(other);
+            other = nullptr;
+            pair = pickFrame(frameset);
         } else {
-            std::cerr << "Color format is not supported!" << std::endl;
-            return;
+            // the previous frame on this side never found its partner
+            if (mine != nullptr) {
+                this->unpairedCount++;
+            }
+            mine = frame;
         }
-        colorFrame = this->filter.process(colorFrame)->as<ob::ColorFrame>();
     }
-    this->filter.setFormatConvertType(FORMAT_RGB888_TO_BGR);
-    colorFrame = this->filter.process(colorFrame)->as<ob::ColorFrame>();
-    cv::Mat colorMat(this->height, this->width, CV_8UC3, colorFrame->data());
+    if (pair != nullptr) {
+        queueFrame(pair, isBacklog);
+    }
+}
 
-    this->timecodeWriter << colorFrame->timeStamp() << std::endl;
+inline void ImageStreamManager::queueFrame(std::shared_ptr<SourceFrame> frame, bool isBacklog) {
+    this->stats.onReceived(frame->timeStamp);
+    frame->queuedNs = StageProfiler::now();
+    frame->isBacklog = isBacklog;
+    bool isQueued = isBacklog ? this->frameQueue->push(frame, DropPolicy::BLOCK) : this->frameQueue->push(frame);
+    this->stats.onQueued(!isQueued, this->frameQueue->size());
+}
 
-    if (this->isSaveVideo && this->videoWriter.isOpened()) {
-        this->videoWriter.write(colorMat);
+// Runs on the pre-roll flusher: the whole ring goes to the worker, waiting for room instead of dropping
+void ImageStreamManager::processPreRoll(std::shared_ptr<SourceFrameSet> frameset) {
+    if (!this->isEnable || !this->frameQueue) {
+        return;
     }
 
-    if (this->isSaveImage) {
-        std::string imageName = this->saveDir + "/" + this->streamName + "/" + std::to_string(this->count) + "_" + std::to_string(colorFrame->timeStamp()) + "ms" + this->imageFormat;
-        cv::imwrite(imageName, colorMat, this->compressionParams);
+    // callback ingestion holds one frame per entry
+    if (this->isStereo && frameset->frames.size() == 1) {
+        pairFrame(frameset->frames[0], true);
+        return;
+    }
+    auto frame = pickFrame(*frameset);
+    if (frame == nullptr) {
+        return;
     }
+    queueFrame(frame, true);
+}
 
-    this->count++;
+// A stereo pair travels as the left frame holding the right one, so both reach the worker together
+inline std::shared_ptr<SourceFrame> ImageStreamManager::pickFrame(const SourceFrameSet& frameset) {
+    auto frame = frameset.getFrame(frameTypeOf((OBSensorType)this->sensorType));
+    if (frame == nullptr || !this->isStereo) {
+        return frame;
+    }
+    auto right = frameset.getFrame(OB_FRAME_IR_RIGHT);
+    if (right == nullptr || right->width != frame->width || right->height != frame->height) {
+        this->unpairedCount++;
+        return nullptr;
+    }
+    auto pair = std::make_shared<SourceFrame>(*frame);
+    pair->pair = right;
+    return pair;
+}
+
+void ImageStreamManager::workerLoop() {
+    placeThread("encoder", this->streamName);
+    int64_t cpuStart = StageProfiler::threadCpuTime();
+    std::shared_ptr<SourceFrame> frame;
+    while (this->frameQueue->pop(frame)) {
+        int64_t frameStart = this->profiler ? StageProfiler::now() : 0;
+        // Under load, drop what the ladder says before any pixel work
+        this->activeSteps = this->backpressure ? this->backpressure->getActiveSteps(this->degradeSteps) : 0;
+        if (this->activeSteps & DEGRADE_DECIMATE) {
+            if (this->decimateCount++ % this->backpressure->getConfig().decimation != 0) {
+                this->decimatedFrames++;
+                if (!frame->isBacklog) {
+                    reportLoad(StageProfiler::now() - frame->queuedNs);
+                }
+                frame.reset();
+                continue;
+            }
+        } else {
+            this->decimateCount = 0;
+        }
+        this->isImageFrame = this->isSaveImage && !(this->activeSteps & DEGRADE_SKIP_IMAGES);
+        if (this->isSaveImage && !this->isImageFrame) {
+            this->skippedImages++;
+        }
+        // Pre-roll depth and IR arrive as PNG
+        frame = decodePreRollFrame(frame);
+        if (frame != nullptr && frame->pair != nullptr) {
+            frame->pair = decodePreRollFrame(frame->pair);
+            if (frame->pair == nullptr) {
+                frame = nullptr;
+            }
+        }
+        if (frame == nullptr) {
+            std::cerr << "Failed to decode pre-roll frame" << std::endl;
+            continue;
+        }
+        if (this->chunkLog) {
+            writeChunkFrame(frame);
+        } else {
+            switch (this->sensorType) {
+                case OB_SENSOR_COLOR:
+                    processColorFrame(frame);
+                    break;
+                case OB_SENSOR_DEPTH:
+                    processDepthFrame(frame);
+                    break;
+                case OB_SENSOR_IR_LEFT:
+                case OB_SENSOR_IR_RIGHT:
+                    processIrFrame(frame);
+                    break;
+            }
+        }
+        int64_t latencyNs = StageProfiler::now() - frame->queuedNs;
+        this->stats.onWritten(latencyNs);
+        if (!frame->isBacklog) {
+            reportLoad(latencyNs);
+        }
+        frame.reset();
+        if (this->profiler) {
+            this->profiler->addFrame(frameStart, StageProfiler::now());
+        }
+    }
+    if (this->profiler) {
+        this->profiler->addCpuTime(StageProfiler::threadCpuTime() - cpuStart);
+    }
 }
 
-inline void ImageStreamManager::processDepthFrame(std::shared_ptr<ob::FrameSet> frameset) {
-    auto depthFrame = frameset->depthFrame();
-    if (depthFrame == nullptr) {
+inline void ImageStreamManager::reportLoad(int64_t latencyNs) {
+    if (!this->backpressure) {
+        return;
+    }
+    float queueFill = this->queueDepth > 0 ? (float)this->frameQueue->size() / this->queueDepth : 0;
+    this->backpressure->report(this->backpressureStream, queueFill, latencyNs);
+}
+
+// Chunk log: pixels as the camera delivered them, a stereo pair as two records with the same timestamp
+void ImageStreamManager::writeChunkFrame(std::shared_ptr<SourceFrame> frame) {
+    TraceSpan span("writeChunkFrame");
+    StageTimer timer(this->profiler.get(), STAGE_ENCODE);
+    for (auto &part : {frame, frame->pair}) {
+        if (part == nullptr) {
+            continue;
+        }
+        ChunkLogFrameHeader header;
+        header.frameType = part->type;
+        header.format = part->format;
+        header.width = part->width;
+        header.height = part->height;
+        header.valueScale = part->valueScale;
+        header.dataSize = part->dataSize;
+        uint64_t timeStampUs = part->timeStampUs > 0 ? part->timeStampUs : part->timeStamp * 1000;
+        this->chunkLog->write(this->chunkChannel, timeStampUs, &header, sizeof(header), part->data, part->dataSize);
+        this->imageBytes += sizeof(header) + part->dataSize;
+    }
+    this->stats.setBytesWritten(this->imageBytes);
+}
+
+inline void ImageStreamManager::processColorFrame(std::shared_ptr<SourceFrame> colorFrame) {
+    TraceSpan span("processColorFrame");
+    if (this->isMjpegPassthrough && colorFrame->format == OB_FORMAT_MJPEG) {
+        processMjpegFrame(colorFrame);
+        return;
+    }
+    StageTimer timer(this->profiler.get(), STAGE_CONVERT);
+    // A libav encoder takes the camera's YUV as it is, BGR is then only made for images
+    bool isYuvFrame = colorFrame->format == OB_FORMAT_YUYV || colorFrame->format == OB_FORMAT_UYVY || colorFrame->format == OB_FORMAT_NV12;
+    bool isYuvVideo = this->isSaveVideo && this->isAvVideo && isYuvFrame;
+    bool isBgrNeeded = this->isImageFrame || (this->isSaveVideo && !isYuvVideo);
+    cv::Mat colorMat;
+    if (!isBgrNeeded) {
+        // nothing to convert
+    } else if (colorFrame->format == OB_FORMAT_BGR) {
+        colorMat = cv::Mat(this->height, this->width, CV_8UC3, colorFrame->data);
+    } else if (colorFrame->format == OB_FORMAT_YUYV || colorFrame->format == OB_FORMAT_UYVY) {
+        // Single pass from packed YUV into the reused BGR buffer
+        this->bgrMat.create(this->height, this->width, CV_8UC3);
+        packedYuvToBgr(colorFrame->data, this->width * 2, this->bgrMat.data, (int)this->bgrMat.step,
+                       this->width, this->height, colorFrame->format == OB_FORMAT_UYVY);
+        colorMat = this->bgrMat;
+    } else if (colorFrame->format == OB_FORMAT_NV12) {
+        cv::cvtColor(cv::Mat(this->height * 3 / 2, this->width, CV_8UC1, colorFrame->data), this->bgrMat, cv::COLOR_YUV2BGR_NV12);
+        colorMat = this->bgrMat;
+    } else if (colorFrame->format == OB_FORMAT_MJPEG) {
+        cv::imdecode(cv::Mat(1, colorFrame->dataSize, CV_8UC1, colorFrame->data), cv::IMREAD_COLOR, &this->bgrMat);
+        colorMat = this->bgrMat;
+    } else if (colorFrame->format == OB_FORMAT_RGB) {
+        cv::cvtColor(cv::Mat(this->height, this->width, CV_8UC3, colorFrame->data), this->bgrMat, cv::COLOR_RGB2BGR);
+        colorMat = this->bgrMat;
+    } else {
+        std::cerr << "Color format is not supported!" << std::endl;
+        return;
+    }
+    if (isBgrNeeded && colorMat.empty()) {
+        std::cerr << "Failed to decode color frame" << std::endl;
         return;
     }
 
-    float valueScale = depthFrame->getValueScale();
-    cv::Mat depthMat(this->height, this->width, CV_16UC1, depthFrame->data());
-    cv::Mat depthMat8;
+    timer.next(STAGE_TIMECODE);
+    updateSegment(colorFrame->timeStamp);
+    this->segment->timecodeWriter.write(colorFrame->timeStamp, colorFrame->timeStampUs);
+    indexFrame(*colorFrame);
+    timer.stop();
 
-    if (this->isSaveVideo || (this->imageFormat != ".jp2" && this->imageFormat != ".png")) {
-        double min, max;
-        cv::minMaxLoc(depthMat, &min, &max);
-        depthMat.convertTo(depthMat8, CV_8UC1, 255.0 / (max - min));
+    if (this->isSaveVideo && isVideoOpened()) {
+        timer.next(STAGE_ENCODE);
+        if (isYuvVideo) {
+            VideoPixelFormat format = VideoPixelFormat::NV12;
+            int stride = this->width;
+            if (colorFrame->format != OB_FORMAT_NV12) {
+                format = colorFrame->format == OB_FORMAT_UYVY ? VideoPixelFormat::UYVY422 : VideoPixelFormat::YUYV422;
+                stride = this->width * 2;
+            }
+            int64_t encodeStart = StageProfiler::now();
+            this->segment->avWriter.write(colorFrame->data, stride, format, colorFrame->timeStamp);
+            this->stats.recordEncode(StageProfiler::now() - encodeStart);
+        } else {
+            writeVideo(colorMat, colorFrame->timeStamp);
+        }
+        timer.stop();
     }
 
-    this->timecodeWriter << depthFrame->timeStamp() << "," << valueScale << std::endl;
+    if (this->isImageFrame) {
+        timer.next(STAGE_IMWRITE);
+        std::string imageName = this->saveDir + "/" + this->streamName + "/" + std::to_string(this->count) + "_" + std::to_string(colorFrame->timeStamp) + "ms" + this->imageFormat;
+        writeImage(imageName, colorMat, colorFrame);
+    }
 
-    if (this->isSaveVideo && this->videoWriter.isOpened()) {
-        this->videoWriter.write(depthMat8);
+    this->count++;
+}
+
+// Write the camera's JPEG bytes as they are, no pixel work
+inline void ImageStreamManager::processMjpegFrame(std::shared_ptr<SourceFrame> colorFrame) {
+    TraceSpan span("processMjpegFrame");
+    StageTimer timer(this->profiler.get(), STAGE_TIMECODE);
+    updateSegment(colorFrame->timeStamp);
+    this->segment->timecodeWriter.write(colorFrame->timeStamp, colorFrame->timeStampUs);
+    indexFrame(*colorFrame);
+    timer.stop();
+
+    if (this->isSaveVideo && this->segment->mkvWriter.isOpened()) {
+        timer.next(STAGE_ENCODE);
+        int64_t encodeStart = StageProfiler::now();
+        this->segment->mkvWriter.write(colorFrame->data, colorFrame->dataSize, colorFrame->timeStamp);
+        this->stats.recordEncode(StageProfiler::now() - encodeStart);
+        timer.stop();
     }
 
-    if (this->isSaveImage) {
-        std::string imageName = this->saveDir + "/" + this->streamName + "/" + std::to_string(this->count) + "_" + std::to_string(depthFrame->timeStamp()) + "ms" + this->imageFormat;
-        if (this->imageFormat == ".jp2" || this->imageFormat == ".png") {
-            cv::imwrite(imageName, depthMat, this->compressionParams);
+    if (this->isImageFrame) {
+        timer.next(STAGE_IMWRITE);
+        std::string imageName = this->saveDir + "/" + this->streamName + "/" + std::to_string(this->count) + "_" + std::to_string(colorFrame->timeStamp) + "ms" + this->imageFormat;
+        if (this->imagePool) {
+            this->imagePool->submitEncoded(this->imageChannel, imageName,
+                                           std::vector<uint8_t>(colorFrame->data, colorFrame->data + colorFrame->dataSize));
         } else {
-            cv::imwrite(imageName, depthMat8, this->compressionParams);
+            std::ofstream imageWriter(imageName, std::ios::binary);
+            imageWriter.write((const char *)colorFrame->data, colorFrame->dataSize);
+            if (imageWriter.good()) {
+                this->imageBytes += colorFrame->dataSize;
+            } else {
+                std::cerr << "Failed to write image: " << imageName << std::endl;
+                this->failedImages++;
+            }
         }
     }
 
     this->count++;
 }
 
-inline void ImageStreamManager::processIrFrame(std::shared_ptr<ob::FrameSet> frameset) {
-    std::shared_ptr<ob::Frame> irFrame;
-    if (this->sensorType == OB_SENSOR_IR_LEFT) {
-        irFrame = frameset->getFrame(OB_FRAME_IR_LEFT);
-    } else if (this->sensorType == OB_SENSOR_IR_RIGHT) {
-        irFrame = frameset->getFrame(OB_FRAME_IR_RIGHT);
+inline void ImageStreamManager::processDepthFrame(std::shared_ptr<SourceFrame> depthFrame) {
+    TraceSpan span("processDepthFrame");
+    StageTimer timer(this->profiler.get(), STAGE_NORMALIZE);
+    float valueScale = depthFrame->valueScale;
+    cv::Mat depthMat(this->height, this->width, CV_16UC1, depthFrame->data);
+
+    bool isRawVideo = this->isRawDepthVideo;
+    if ((this->isSaveVideo && !isRawVideo) || (this->isImageFrame && this->imageFormat != ".jp2" && this->imageFormat != ".png")) {
+        this->depthPreview.convert(depthMat, valueScale, this->depthMat8);
     }
 
-    cv::Mat irMat(this->height, this->width, CV_8UC1, irFrame->data());
+    timer.next(STAGE_TIMECODE);
+    updateSegment(depthFrame->timeStamp);
+    this->segment->timecodeWriter.write(depthFrame->timeStamp, depthFrame->timeStampUs, valueScale);
+    indexFrame(*depthFrame);
+    timer.stop();
 
-    this->timecodeWriter << irFrame->timeStamp() << std::endl;
+    if (this->isSaveVideo && isVideoOpened()) {
+        timer.next(STAGE_ENCODE);
+        writeVideo(isRawVideo ? depthMat : this->depthMat8, depthFrame->timeStamp);
+        timer.stop();
+    }
 
-    if (this->isSaveVideo && this->videoWriter.isOpened()) {
-        this->videoWriter.write(irMat);
+    if (this->isImageFrame) {
+        timer.next(STAGE_IMWRITE);
+        std::string imageName = this->saveDir + "/" + this->streamName + "/" + std::to_string(this->count) + "_" + std::to_string(depthFrame->timeStamp) + "ms" + this->imageFormat;
+        if (this->imageFormat == ".jp2" || this->imageFormat == ".png") {
+            writeImage(imageName, depthMat, depthFrame);
+        } else {
+            writeImage(imageName, this->depthMat8, depthFrame);
+        }
     }
 
-    if (this->isSaveImage) {
-        std::string imageName = this->saveDir + "/" + this->streamName + "/" + std::to_string(this->count) + "_" + std::to_string(irFrame->timeStamp()) + "ms" + this->imageFormat;
-        cv::imwrite(imageName, irMat, this->compressionParams);
+    this->count++;
+}
+
+inline void ImageStreamManager::processIrFrame(std::shared_ptr<SourceFrame> irFrame) {
+    TraceSpan span("processIrFrame");
+    StageTimer timer(this->profiler.get());
+    cv::Mat irMat(this->height, this->width, CV_8UC1, irFrame->data);
+    if (irFrame->pair != nullptr) {
+        // side by side, left | right, so one encoder and one timecode cover the pair
+        timer.next(STAGE_CONVERT);
+        this->stereoMat.create(this->height, this->width * 2, CV_8UC1);
+        cv::Mat leftHalf = this->stereoMat(cv::Rect(0, 0, this->width, this->height));
+        cv::Mat rightHalf = this->stereoMat(cv::Rect(this->width, 0, this->width, this->height));
+        irMat.copyTo(leftHalf);
+        cv::Mat(this->height, this->width, CV_8UC1, irFrame->pair->data).copyTo(rightHalf);
+        irMat = this->stereoMat;
+    }
+
+    timer.next(STAGE_TIMECODE);
+    updateSegment(irFrame->timeStamp);
+    this->segment->timecodeWriter.write(irFrame->timeStamp, irFrame->timeStampUs);
+    indexFrame(*irFrame);
+    timer.stop();
+
+    if (this->isSaveVideo && isVideoOpened()) {
+        timer.next(STAGE_ENCODE);
+        writeVideo(irMat, irFrame->timeStamp);
+        timer.stop();
+    }
+
+    if (this->isImageFrame) {
+        timer.next(STAGE_IMWRITE);
+        std::string imageName = this->saveDir + "/" + this->streamName + "/" + std::to_string(this->count) + "_" + std::to_string(irFrame->timeStamp) + "ms" + this->imageFormat;
+        writeImage(imageName, irMat, irFrame);
     }
 
     this->count++;
 }
 
+void ImageStreamManager::updateBytesWritten() {
+    uint64_t bytes = this->imageBytes;
+    if (this->imagePool) {
+        bytes += this->imagePool->getChannelBytes(this->imageChannel);
+    }
+    for (const std::string& name : this->outputFiles) {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(name, ec);
+        bytes += ec ? 0 : size;
+    }
+    this->stats.setBytesWritten(bytes);
+}
+
+inline bool ImageStreamManager::isVideoOpened() {
+    return this->segment->videoWriter.isOpened() || this->segment->avWriter.isOpened();
+}
+
+// Hand a frame to whichever video backend is open
+inline void ImageStreamManager::writeVideo(const cv::Mat& mat, uint64_t timeStamp) {
+    int64_t encodeStart = StageProfiler::now();
+    if (this->segment->avWriter.isOpened()) {
+        // color Mats are BGR whatever the writer was opened with (e.g. decoded pre-roll)
+        VideoPixelFormat format = mat.channels() == 3 ? VideoPixelFormat::BGR24 : this->videoPixelFormat;
+        this->segment->avWriter.write(mat.data, (int)mat.step, format, timeStamp);
+    } else {
+        this->segment->videoWriter.write(mat);
+    }
+    this->stats.recordEncode(StageProfiler::now() - encodeStart);
+}
+
+// Encode on the pool when there is one. Mats that wrap the frame keep the frame alive,
+// reused buffers are copied.
+inline void ImageStreamManager::writeImage(const std::string& imageName, const cv::Mat& mat, std::shared_ptr<SourceFrame> frame) {
+    bool isDegraded = (this->activeSteps & DEGRADE_JPEG_QUALITY) && !this->degradedParams.empty();
+    const std::vector<int>& params = isDegraded ? this->degradedParams : this->compressionParams;
+    if (isDegraded) {
+        this->degradedImages++;
+    }
+    if (!this->imagePool) {
+        cv::imwrite(imageName, mat, params);
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(imageName, ec);
+        this->imageBytes += ec ? 0 : size;
+        return;
+    }
+    bool isFrameData = mat.data >= frame->data && mat.data < frame->data + frame->dataSize;
+    if (isFrameData) {
+        this->imagePool->submit(this->imageChannel, imageName, mat, params, frame);
+    } else if (this->bufferPool) {
+        auto buffer = this->bufferPool->acquire(mat.total() * mat.elemSize());
+        cv::Mat copy(mat.rows, mat.cols, mat.type(), buffer.get());
+        mat.copyTo(copy);
+        this->imagePool->submit(this->imageChannel, imageName, copy, params, buffer);
+    } else {
+        this->imagePool->submit(this->imageChannel, imageName, mat.clone(), params);
+    }
+}
+
+void ImageStreamManager::setBufferPool(std::shared_ptr<FrameBufferPool> pool) {
+    this->bufferPool = pool;
+    if (!pool || !this->isEnable || !this->isSaveImage) {
+        return;
+    }
+    // Only converted images are copied; raw depth and IR keep their frame instead
+    size_t imageBytes = 0;
+    if (this->sensorType == OB_SENSOR_COLOR) {
+        imageBytes = (size_t)this->width * this->height * 3;
+    } else if (this->sensorType == OB_SENSOR_DEPTH && this->imageFormat != ".jp2" && this->imageFormat != ".png") {
+        imageBytes = (size_t)this->width * this->height * (this->depthPreview.isColor() ? 3 : 1);
+    }
+    if (imageBytes > 0) {
+        pool->reserve(imageBytes, 2);
+    }
+}
+
+void ImageStreamManager::setBackpressure(std::shared_ptr<BackpressureController> controller) {
+    if (!controller || !this->isEnable) {
+        return;
+    }
+    this->backpressure = controller;
+    this->backpressureStream = controller->registerStream(this->streamName);
+    this->degradeSteps = controller->getStreamSteps(this->streamName);
+    // only JPEG has a quality to give up; other formats keep their parameters
+    if (this->compressionParams.size() == 2 && this->compressionParams[0] == cv::IMWRITE_JPEG_QUALITY) {
+        this->degradedParams = {cv::IMWRITE_JPEG_QUALITY, std::min(this->compressionParams[1], controller->getConfig().jpegQuality)};
+    }
+}
+
+void ImageStreamManager::setImageEncoderPool(std::shared_ptr<ImageEncoderPool> pool) {
+    this->imagePool = pool;
+    if (pool) {
+        this->imageChannel = pool->registerChannel(this->streamName);
+    }
+}
+
 void ImageStreamManager::close() {
-    if (this->videoWriter.isOpened()) {
-        this->videoWriter.release();
+    // Drain queued frames before releasing the writers
+    if (this->frameQueue) {
+        this->frameQueue->close();
+    }
+    if (this->worker.joinable()) {
+        this->worker.join();
+    }
+    if (this->imagePool) {
+        this->imagePool->flush(this->imageChannel);
     }
-    if (this->timecodeWriter.is_open()) {
-        this->timecodeWriter.close();
+    if (this->closingSegment.valid()) {
+        this->closingSegment.wait();
     }
+    if (this->segment) {
+        this->segment->release();
+        std::lock_guard<std::mutex> lock(this->segmentMutex);
+        if (this->isSegmented) {
+            this->segments.back() = this->segment->getMetadata();
+        }
+    }
+    // The prepared segment never got a frame, so its files are removed again
+    if (this->nextSegment.valid()) {
+        auto unused = this->nextSegment.get();
+        unused->release();
+        std::error_code ec;
+        std::filesystem::remove(unused->videoName, ec);
+        std::filesystem::remove(unused->timecodeName, ec);
+        if (!unused->timecodeIndexName.empty()) {
+            std::filesystem::remove(unused->timecodeIndexName, ec);
+        }
+        if (!unused->frameIndexName.empty()) {
+            std::filesystem::remove(unused->frameIndexName, ec);
+        }
+    }
+    updateBytesWritten();
 }
 
-void ImageStreamManager::setCameraParams(std::shared_ptr<ob::VideoStreamProfile> profile, bool isColor) {
-    auto intrinsics = profile->getIntrinsic();
-    auto distortion = profile->getDistortion();
+void ImageStreamManager::setCameraParams(const VideoProfileInfo& profile, bool isColor) {
+    auto intrinsics = profile.intrinsic;
+    auto distortion = profile.distortion;
     std::vector<float> r;
     std::vector<float> t;
-    if (isColor) {
+    if (isColor || !profile.hasExtrinsic) {
         r = {1, 0, 0, 0, 1, 0, 0, 0, 1};
         t = {0, 0, 0};
     } else {
-        try {
-            auto extrinsics = profile->getExtrinsicTo(this->colorProfile);
-            for (int i = 0; i < 9; i++) {
-                r.push_back(extrinsics.rot[i]);
-            }
-            for (int i = 0; i < 3; i++) {
-                t.push_back(extrinsics.trans[i]);
-            }
-        } catch (ob::Error &e) {
-            std::cerr << "Error: " << e.getMessage() << std::endl;
-            r = {1, 0, 0, 0, 1, 0, 0, 0, 1};
-            t = {0, 0, 0};
+        for (int i = 0; i < 9; i++) {
+            r.push_back(profile.extrinsic.rot[i]);
+        }
+        for (int i = 0; i < 3; i++) {
+            t.push_back(profile.extrinsic.trans[i]);
         }
     }
 
-    this->fps = profile->fps();
-    this->width = profile->width();
-    this->height = profile->height();
+    this->fps = profile.fps;
+    this->width = profile.width;
+    this->height = profile.height;
     this->fx = intrinsics.fx;
     this->fy = intrinsics.fy;
     this->cx = intrinsics.cx;
@@ -355,6 +1026,59 @@ nlohmann::json ImageStreamManager::getMetadata() {
     metadata["codec"] = this->codec;
     metadata["imageFormat"] = this->imageFormat;
     metadata["compressionParams"] = this->compressionParams;
+    metadata["mjpegPassthrough"] = this->isMjpegPassthrough;
+    if (this->imagePool) {
+        metadata.update(this->imagePool->getChannelMetadata(this->imageChannel));
+    } else if (this->isMjpegPassthrough) {
+        metadata["imagesFailed"] = this->failedImages.load();
+    }
+    metadata["videoEncoder"] = this->encoderConfig.encoder;
+    metadata["encoderThreads"] = this->encoderConfig.threads;
+    if (this->isAvVideo) {
+        metadata["encoderPreset"] = this->encoderConfig.preset;
+        metadata["encoderTune"] = this->encoderConfig.tune;
+        metadata["encoderCrf"] = this->encoderConfig.crf;
+        metadata["encoderGop"] = this->encoderConfig.gop;
+        metadata["videoPixelFormat"] = videoPixelFormatName(this->videoPixelFormat);
+        if (this->segment) {
+            metadata["encoderPixelFormat"] = this->segment->avWriter.getEncoderPixelFormat();
+        }
+    }
+    if (this->sensorType == OB_SENSOR_DEPTH) {
+        const DepthPreviewConfig& preview = this->depthPreview.getConfig();
+        metadata["depthPreviewMode"] = depthPreviewModeName(preview.mode);
+        metadata["depthRangeMm"] = {preview.minMm, preview.maxMm};
+        metadata["depthColormap"] = preview.colormap;
+        metadata["rawDepthVideo"] = this->isRawDepthVideo;
+    }
+    if (this->isStereo) {
+        metadata["stereoLayout"] = "sideBySide";
+        metadata["videoWidth"] = this->videoWidth;
+        metadata["rightCamera"] = this->rightCamera;
+        metadata["unpairedFrames"] = this->unpairedCount;
+    }
+    if (this->chunkLog) {
+        metadata["chunkLogChannel"] = this->chunkChannel;
+    }
+    if (this->backpressure) {
+        std::vector<std::string> steps;
+        for (DegradeStep step : {DEGRADE_SKIP_IMAGES, DEGRADE_JPEG_QUALITY, DEGRADE_DECIMATE}) {
+            if (this->degradeSteps & step) {
+                steps.push_back(degradeStepName(step));
+            }
+        }
+        metadata["degradeSteps"] = steps;
+        metadata["skippedImages"] = this->skippedImages.load();
+        metadata["degradedImages"] = this->degradedImages.load();
+        metadata["decimatedFrames"] = this->decimatedFrames.load();
+    }
+    metadata["queueDepth"] = this->queueDepth;
+    metadata["dropPolicy"] = dropPolicyName(this->dropPolicy);
+    metadata["stats"] = this->stats.toJson();
+    if (this->frameQueue) {
+        metadata["droppedFrames"] = this->frameQueue->getDropCount();
+        metadata["peakQueueSize"] = this->frameQueue->getPeakCount();
+    }
 
     if (!this->isEnable) {
         metadata["isEnable"] = false;
@@ -365,6 +1089,21 @@ nlohmann::json ImageStreamManager::getMetadata() {
         metadata["isEnable"] = true;
         metadata["videoName"] = this->videoName;
         metadata["timecodeName"] = this->timecodeName;
+        if (!this->timecodeIndexName.empty()) {
+            metadata["timecodeIndexName"] = this->timecodeIndexName;
+        }
+        if (this->segment && !this->segment->frameIndexName.empty()) {
+            metadata["frameIndexName"] = this->segment->frameIndexName;
+        }
+        if (this->segment && !this->isSegmented) {
+            metadata["timecodeWriter"] = this->segment->timecodeWriter.getMetadata();
+        }
+        if (this->isSegmented) {
+            std::lock_guard<std::mutex> lock(this->segmentMutex);
+            metadata["segmentSeconds"] = this->segmentSeconds;
+            metadata["segmentMb"] = this->segmentMb;
+            metadata["segments"] = this->segments;
+        }
         metadata["fps"] = this->fps;
         metadata["width"] = this->width;
         metadata["height"] = this->height;
@@ -386,14 +1125,22 @@ nlohmann::json ImageStreamManager::getMetadata() {
     }
 }
 
-ImuStreamManager::ImuStreamManager(std::shared_ptr<ob::Pipeline> pipe,
-                                   std::shared_ptr<ob::Device> device,
-                                   std::shared_ptr<ob::Config> config,
+ImuStreamManager::ImuStreamManager(std::shared_ptr<FrameSource> source,
                                    OBSensorType sensorType,
                                    const std::string& streamName,
                                    const std::string& saveDir,
-                                   int profileIdx) :
-    StreamManager(pipe, device, config, sensorType, streamName, saveDir, profileIdx) {
+                                   int profileIdx,
+                                   const std::string& imuFormat,
+                                   int ringSize,
+                                   float preRollSeconds,
+                                   const FileWriterConfig& fileWriterConfig,
+                                   std::shared_ptr<ChunkLogWriter> chunkLog) :
+    StreamManager(source, sensorType, streamName, saveDir, profileIdx) {
+    this->imuFormat = imuFormat == "binary" ? "binary" : "csv";
+    this->chunkLog = chunkLog;
+    if (chunkLog) {
+        this->imuFormat = "chunklog";
+    }
     if (!this->isEnable) {
         return;
     }
@@ -407,23 +1154,55 @@ ImuStreamManager::ImuStreamManager(std::shared_ptr<ob::Pipeline> pipe,
 
     try {
         // Open imu writer
-        this->imuName = saveDir + "/" + streamName + ".csv";
-        this->imuWriter.open(this->imuName);
-        if (this->imuWriter.is_open()) {
+        if (this->chunkLog) {
+            nlohmann::json info;
+            info["sensorType"] = sensorType;
+            info["profileIdx"] = profileIdx;
+            info["recordSize"] = sizeof(ImuSample);
+            this->chunkChannel = this->chunkLog->addChannel(streamName, "rover.imu", info);
+        } else if (this->imuFormat == "binary") {
+            this->imuName = saveDir + "/" + streamName + ".bin";
+            if (!this->imuWriter.open(this->imuName, fileWriterConfig)) {
+                std::cerr << this->imuWriter.errorMsg << std::endl;
+                this->errorMsg += this->imuWriter.errorMsg;
+            }
+            ImuBinaryHeader header;
+            header.sensorType = sensorType;
+            this->imuWriter.write(&header, sizeof(header));
+        } else {
+            this->imuName = saveDir + "/" + streamName + ".csv";
+            if (!this->imuWriter.open(this->imuName, fileWriterConfig)) {
+                std::cerr << this->imuWriter.errorMsg << std::endl;
+                this->errorMsg += this->imuWriter.errorMsg;
+            }
+            std::string header;
             if (sensorType == OB_SENSOR_GYRO) {
-                this->imuWriter << "timestamp [ms],temperature [C],gyro.x [rad/s],gyro.y [rad/s],gyro.z [rad/s]" << std::endl;
+                header = "timestamp [ms],temperature [C],gyro.x [rad/s],gyro.y [rad/s],gyro.z [rad/s]\n";
             } else if (sensorType == OB_SENSOR_ACCEL) {
-                this->imuWriter << "timestamp [ms],temperature [C],accel.x [m/s^2],accel.y [m/s^2],accel.z [m/s^2]" << std::endl;
+                header = "timestamp [ms],temperature [C],accel.x [m/s^2],accel.y [m/s^2],accel.z [m/s^2]\n";
             }
+            this->imuWriter.write(header.data(), header.size());
         }
 
+        // Start writer thread before samples arrive; with pre-roll it holds them until the trigger
+        this->holdWindowMs = (uint64_t)(preRollSeconds * 1000);
+        this->isHolding.store(preRollSeconds > 0);
+        this->ring = std::make_unique<SpscRing<ImuSample>>(ringSize);
+        this->isWriting.store(true);
+        this->writer = std::thread(&ImuStreamManager::writerLoop, this);
+
         // Set callback
-        auto sensor = device->getSensorList()->getSensor(sensorType);
-        auto profile = sensor->getStreamProfileList()->getProfile(profileIdx);
-        auto callback = [this](std::shared_ptr<ob::Frame> frame) {
-            imuCallback(frame);
+        // the SDK owns the callback thread, so it is placed on its first sample
+        auto callback = [this](const ImuSample& sample) {
+            thread_local bool isPlaced = false;
+            if (!isPlaced) {
+                placeThread("imuCallback", this->streamName + "_cb");
+                isPlaced = true;
+            }
+            imuCallback(sample);
         };
-        sensor->start(profile, callback);
+        source->startImu(sensorType, profileIdx, callback);
+        this->isImuStarted = true;
         this->isEnable = true;
     } catch (ob::Error &e) {
         std::cerr << "Error: " << e.getMessage() << std::endl;
@@ -437,36 +1216,128 @@ ImuStreamManager::ImuStreamManager(std::shared_ptr<ob::Pipeline> pipe,
     }
 }
 
-inline void ImuStreamManager::processFrameset(std::shared_ptr<ob::FrameSet> frameset) {
+ImuStreamManager::~ImuStreamManager() {
+    close();
+}
+
+inline void ImuStreamManager::processFrameset(std::shared_ptr<SourceFrameSet> frameset) {
     return;
 }
 
 void ImuStreamManager::close() {
-    if (this->imuWriter.is_open()) {
-        this->imuWriter.close();
+    // Stop the callback first, then let the writer drain what is left
+    if (!this->writer.joinable()) {
+        return;
     }
+    stopCapture();
+    this->isWriting.store(false);
+    this->writer.join();
+    this->imuWriter.close();
 }
 
-inline void ImuStreamManager::imuCallback(std::shared_ptr<ob::Frame> frame) {
-    if (!this->isEnable) {
-        return;
+void ImuStreamManager::stopCapture() {
+    if (this->isImuStarted) {
+        this->source->stopImu((OBSensorType)this->sensorType);
+        this->isImuStarted = false;
     }
-    if (!this->imuWriter.is_open()) {
+}
+
+void ImuStreamManager::endPreRoll() {
+    this->isHolding.store(false);
+}
+
+// Runs on the SDK sensor thread: no formatting, no I/O, no locks
+inline void ImuStreamManager::imuCallback(const ImuSample& sample) {
+    if (!this->ring) {
         return;
     }
+    TraceSpan span("imuCallback");
+    int64_t start = this->profiler ? StageProfiler::now() : 0;
+    this->stats.onReceived(sample.timeStamp);
+    if (!this->ring->push(sample)) {
+        this->stats.onDropped();
+    }
+    if (this->profiler) {
+        this->profiler->addFrame(start, StageProfiler::now());
+    }
+}
+
+void ImuStreamManager::writerLoop() {
+    placeThread("imu", this->streamName);
+    int64_t cpuStart = StageProfiler::threadCpuTime();
+    std::vector<ImuSample> batch(256);
+    std::string text;
+    char line[128];
+    bool isBinary = this->imuFormat == "binary";
+    bool isChunkLog = this->chunkLog != nullptr;
+    std::deque<ImuSample> held;
+    auto lastFlush = std::chrono::steady_clock::now();
+    while (true) {
+        // checked before draining, so the last pass sees every pushed sample
+        bool isLast = !this->isWriting.load();
+        size_t count;
 
-    if (this->sensorType == OB_SENSOR_GYRO) {
-        auto gyroFrame = frame->as<ob::GyroFrame>();
-        if (gyroFrame != nullptr) {
-            auto value = gyroFrame->value();
-            this->imuWriter << frame->timeStamp() << "," << gyroFrame->temperature() << "," << value.x << "," << value.y << "," << value.z << std::endl;
+        // Before the trigger samples are only kept for the pre-roll window
+        if (this->isHolding.load()) {
+            while ((count = this->ring->popBatch(batch.data(), batch.size())) > 0) {
+                held.insert(held.end(), batch.begin(), batch.begin() + count);
+            }
+            while (!held.empty() && held.back().timeStamp - held.front().timeStamp > this->holdWindowMs) {
+                held.pop_front();
+            }
+            if (isLast) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            continue;
+        }
+        // After it, the held samples go out ahead of the live ones
+        while (true) {
+            if (!held.empty()) {
+                count = std::min(held.size(), batch.size());
+                std::copy(held.begin(), held.begin() + count, batch.begin());
+                held.erase(held.begin(), held.begin() + count);
+                this->preRollSamples += count;
+            } else if ((count = this->ring->popBatch(batch.data(), batch.size())) == 0) {
+                break;
+            }
+            StageTimer timer(this->profiler.get(), STAGE_TIMECODE);
+            int64_t writeStart = StageProfiler::now();
+            if (isChunkLog) {
+                // one record per sample, so time-range reads can pick single samples
+                for (size_t i = 0; i < count; i++) {
+                    this->chunkLog->write(this->chunkChannel, batch[i].timeStamp * 1000, &batch[i], sizeof(ImuSample));
+                }
+                this->bytesWritten += count * sizeof(ImuSample);
+            } else if (isBinary) {
+                this->imuWriter.write(batch.data(), count * sizeof(ImuSample));
+                this->bytesWritten += count * sizeof(ImuSample);
+            } else {
+                text.clear();
+                for (size_t i = 0; i < count; i++) {
+                    const ImuSample& s = batch[i];
+                    int n = snprintf(line, sizeof(line), "%llu,%g,%g,%g,%g\n", (unsigned long long)s.timeStamp, s.temperature, s.x, s.y, s.z);
+                    text.append(line, n);
+                }
+                this->imuWriter.write(text.data(), text.size());
+                this->bytesWritten += text.size();
+            }
+            this->samplesWritten += count;
+            this->stats.onWritten(StageProfiler::now() - writeStart, count);
+            this->stats.setBytesWritten(this->bytesWritten);
+        }
+        // samples reach the file a block at a time, and at least once a second
+        if (std::chrono::steady_clock::now() - lastFlush >= std::chrono::seconds(1)) {
+            this->imuWriter.flush();
+            lastFlush = std::chrono::steady_clock::now();
         }
-    } else if (this->sensorType == OB_SENSOR_ACCEL) {
-        auto accelFrame = frame->as<ob::AccelFrame>();
-        if (accelFrame != nullptr) {
-            auto value = accelFrame->value();
-            this->imuWriter << frame->timeStamp() << "," << accelFrame->temperature() << "," << value.x << "," << value.y << "," << value.z << std::endl;
+        if (isLast) {
+            break;
         }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    if (this->profiler) {
+        this->profiler->addCpuTime(StageProfiler::threadCpuTime() - cpuStart);
     }
 }
 
@@ -484,6 +1355,21 @@ nlohmann::json ImuStreamManager::getMetadata() {
     else {
         metadata["isEnable"] = true;
         metadata["imuName"] = this->imuName;
+        metadata["imuFormat"] = this->imuFormat;
+        if (this->chunkLog) {
+            metadata["chunkLogChannel"] = this->chunkChannel;
+        } else {
+            metadata["imuWriter"] = this->imuWriter.getMetadata();
+        }
+        if (this->ring) {
+            metadata["imuRingSize"] = this->ring->capacity();
+            metadata["overflowCount"] = this->ring->getOverflowCount();
+        }
+        if (!this->writer.joinable()) {
+            metadata["samplesWritten"] = this->samplesWritten;
+            metadata["stats"] = this->stats.toJson();
+            metadata["preRollSamples"] = this->preRollSamples;
+        }
         return metadata;
     }
 }
@@ -0,0 +1,198 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include "stream_stats.hpp"
+
+namespace {
+
+// upper bounds of all but the last (+Inf) bucket [us]
+const int64_t BUCKET_BOUNDS_US[LatencyHistogram::BUCKET_COUNT - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000};
+
+void appendCounter(std::string& out, const std::string& name, const std::string& labels, double value) {
+    char line[256];
+    snprintf(line, sizeof(line), "%s{%s} %.17g\n", name.c_str(), labels.c_str(), value);
+    out += line;
+}
+
+}
+
+LatencyHistogram::LatencyHistogram() {
+    for (auto& bucket : this->buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::record(int64_t ns) {
+    if (ns < 0) {
+        ns = 0;
+    }
+    int idx = 0;
+    while (idx < BUCKET_COUNT - 1 && ns > BUCKET_BOUNDS_US[idx] * 1000) {
+        idx++;
+    }
+    this->buckets[idx].fetch_add(1, std::memory_order_relaxed);
+    this->count.fetch_add(1, std::memory_order_relaxed);
+    this->sumNs.fetch_add((uint64_t)ns, std::memory_order_relaxed);
+    if ((uint64_t)ns > this->maxNs.load(std::memory_order_relaxed)) {
+        this->maxNs.store((uint64_t)ns, std::memory_order_relaxed);
+    }
+}
+
+nlohmann::json LatencyHistogram::toJson() const {
+    nlohmann::json j;
+    uint64_t n = this->count.load(std::memory_order_relaxed);
+    j["count"] = n;
+    j["meanMs"] = n > 0 ? this->sumNs.load(std::memory_order_relaxed) / 1e6 / n : 0.0;
+    j["maxMs"] = this->maxNs.load(std::memory_order_relaxed) / 1e6;
+    // bucket i counts samples up to bucketBoundsMs[i], the last one everything above
+    std::vector<double> bounds;
+    std::vector<uint64_t> buckets;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        if (i < BUCKET_COUNT - 1) {
+            bounds.push_back(BUCKET_BOUNDS_US[i] / 1000.0);
+        }
+        buckets.push_back(this->buckets[i].load(std::memory_order_relaxed));
+    }
+    j["bucketBoundsMs"] = bounds;
+    j["buckets"] = buckets;
+    return j;
+}
+
+void LatencyHistogram::appendPrometheus(std::string& out, const std::string& name, const std::string& labels) const {
+    uint64_t cumulative = 0;
+    char le[32];
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        cumulative += this->buckets[i].load(std::memory_order_relaxed);
+        if (i < BUCKET_COUNT - 1) {
+            snprintf(le, sizeof(le), "%g", BUCKET_BOUNDS_US[i] / 1e6);
+        } else {
+            snprintf(le, sizeof(le), "+Inf");
+        }
+        appendCounter(out, name + "_bucket", labels + ",le=\"" + le + "\"", (double)cumulative);
+    }
+    appendCounter(out, name + "_sum", labels, this->sumNs.load(std::memory_order_relaxed) / 1e9);
+    appendCounter(out, name + "_count", labels, (double)this->count.load(std::memory_order_relaxed));
+}
+
+void StreamStats::setExpectedFps(float fps) {
+    this->expectedFps.store(fps, std::memory_order_relaxed);
+}
+
+void StreamStats::onReceived(uint64_t timeStamp) {
+    this->framesReceived.fetch_add(1, std::memory_order_relaxed);
+    float fps = this->expectedFps.load(std::memory_order_relaxed);
+    // a gap of more than 1.5 frame periods means the frames in between never arrived
+    if (fps > 0 && this->lastTimeStamp > 0 && timeStamp > this->lastTimeStamp) {
+        double periodMs = 1000.0 / fps;
+        double gapMs = (double)(timeStamp - this->lastTimeStamp);
+        if (gapMs > 1.5 * periodMs) {
+            this->gapDrops.fetch_add((uint64_t)std::llround(gapMs / periodMs) - 1, std::memory_order_relaxed);
+        }
+    }
+    this->lastTimeStamp = timeStamp;
+
+    // host side arrival jitter, measured from when frames reach the recorder
+    auto now = std::chrono::steady_clock::now();
+    if (fps > 0 && this->lastArrival.time_since_epoch().count() > 0) {
+        int64_t intervalNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - this->lastArrival).count();
+        this->arrivalJitter.record(std::llabs(intervalNs - (int64_t)(1e9 / fps)));
+    }
+    this->lastArrival = now;
+}
+
+void StreamStats::onQueued(bool isDropped, size_t queueSize) {
+    if (isDropped) {
+        this->queueDrops.fetch_add(1, std::memory_order_relaxed);
+    }
+    this->queueSize.store(queueSize, std::memory_order_relaxed);
+    if (queueSize > this->peakQueueSize.load(std::memory_order_relaxed)) {
+        this->peakQueueSize.store(queueSize, std::memory_order_relaxed);
+    }
+}
+
+void StreamStats::onDropped() {
+    this->queueDrops.fetch_add(1, std::memory_order_relaxed);
+}
+
+void StreamStats::onWritten(int64_t latencyNs, uint64_t frames) {
+    this->framesWritten.fetch_add(frames, std::memory_order_relaxed);
+    this->writeLatency.record(latencyNs);
+}
+
+void StreamStats::recordEncode(int64_t ns) {
+    this->encodeLatency.record(ns);
+}
+
+void StreamStats::setBytesWritten(uint64_t bytes) {
+    this->bytesWritten.store(bytes, std::memory_order_relaxed);
+}
+
+nlohmann::json StreamStats::toJson() const {
+    nlohmann::json j;
+    j["framesReceived"] = this->framesReceived.load(std::memory_order_relaxed);
+    j["framesWritten"] = this->framesWritten.load(std::memory_order_relaxed);
+    j["gapDrops"] = this->gapDrops.load(std::memory_order_relaxed);
+    j["queueDrops"] = this->queueDrops.load(std::memory_order_relaxed);
+    j["queueSize"] = this->queueSize.load(std::memory_order_relaxed);
+    j["peakQueueSize"] = this->peakQueueSize.load(std::memory_order_relaxed);
+    j["bytesWritten"] = this->bytesWritten.load(std::memory_order_relaxed);
+    j["encodeLatency"] = this->encodeLatency.toJson();
+    j["writeLatency"] = this->writeLatency.toJson();
+    j["arrivalJitter"] = this->arrivalJitter.toJson();
+    return j;
+}
+
+// Prometheus wants every sample of a metric family together, so the output is metric by metric
+std::string StreamStats::toPrometheus(const std::vector<std::pair<std::string, const StreamStats *>>& streams) {
+    struct Counter {
+        const char *name;
+        const char *type;
+        std::atomic<uint64_t> StreamStats::*value;
+    };
+    static const Counter counters[] = {
+        {"rover_frames_received_total", "counter", &StreamStats::framesReceived},
+        {"rover_frames_written_total", "counter", &StreamStats::framesWritten},
+        {"rover_frames_gap_dropped_total", "counter", &StreamStats::gapDrops},
+        {"rover_frames_queue_dropped_total", "counter", &StreamStats::queueDrops},
+        {"rover_queue_size", "gauge", &StreamStats::queueSize},
+        {"rover_bytes_written_total", "counter", &StreamStats::bytesWritten},
+    };
+    std::string out;
+    for (const auto& counter : counters) {
+        out += std::string("# TYPE ") + counter.name + " " + counter.type + "\n";
+        for (const auto& stream : streams) {
+            appendCounter(out, counter.name, "stream=\"" + stream.first + "\"",
+                          (double)(stream.second->*counter.value).load(std::memory_order_relaxed));
+        }
+    }
+    out += "# TYPE rover_encode_latency_seconds histogram\n";
+    for (const auto& stream : streams) {
+        stream.second->encodeLatency.appendPrometheus(out, "rover_encode_latency_seconds", "stream=\"" + stream.first + "\"");
+    }
+    out += "# TYPE rover_write_latency_seconds histogram\n";
+    for (const auto& stream : streams) {
+        stream.second->writeLatency.appendPrometheus(out, "rover_write_latency_seconds", "stream=\"" + stream.first + "\"");
+    }
+    out += "# TYPE rover_arrival_jitter_seconds histogram\n";
+    for (const auto& stream : streams) {
+        stream.second->arrivalJitter.appendPrometheus(out, "rover_arrival_jitter_seconds", "stream=\"" + stream.first + "\"");
+    }
+    return out;
+}
+
+bool writeFileAtomic(const std::string& path, const std::string& content) {
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!ofs) {
+            return false;
+        }
+        ofs.write(content.data(), content.size());
+        if (!ofs.good()) {
+            return false;
+        }
+    }
+    return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,354 @@
+#include <cmath>
+#include <algorithm>
+#include <regex>
+#include <fstream>
+#include "frame_source.hpp"
+
+namespace {
+
+const int PATTERN_COUNT = 8;
+const float IMU_RATE = 200.0f;
+
+OBFormat parseFormat(const std::string& name) {
+    static const std::map<std::string, OBFormat> formats = {
+        {"OB_FORMAT_YUYV", OB_FORMAT_YUYV},
+        {"OB_FORMAT_UYVY", OB_FORMAT_UYVY},
+        {"OB_FORMAT_MJPG", OB_FORMAT_MJPG},
+        {"OB_FORMAT_RGB888", OB_FORMAT_RGB},
+        {"OB_FORMAT_RGB", OB_FORMAT_RGB},
+        {"OB_FORMAT_BGR", OB_FORMAT_BGR},
+        {"OB_FORMAT_RGBA", OB_FORMAT_RGBA},
+        {"OB_FORMAT_BGRA", OB_FORMAT_BGRA},
+        {"OB_FORMAT_Y16", OB_FORMAT_Y16},
+        {"OB_FORMAT_Y12", OB_FORMAT_Y12},
+        {"OB_FORMAT_Y8", OB_FORMAT_Y8},
+    };
+    auto it = formats.find(name);
+    if (it == formats.end()) {
+        return OB_FORMAT_UNKNOWN;
+    }
+    return it->second;
+}
+
+// Profiles in the same order the SDK lists them, one "{type: ..., format: ...}" entry per line
+std::vector<VideoProfileInfo> loadProfiles(const std::string& csvPath) {
+    std::vector<VideoProfileInfo> profiles;
+    std::ifstream ifs(csvPath);
+    if (!ifs.is_open()) {
+        return profiles;
+    }
+    std::regex pattern("format: (\\w+), width: (\\d+), height: (\\d+), fps: (\\d+)");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        std::smatch match;
+        if (!std::regex_search(line, match, pattern)) {
+            continue;
+        }
+        VideoProfileInfo info;
+        info.format = parseFormat(match[1]);
+        info.width = std::stoi(match[2]);
+        info.height = std::stoi(match[3]);
+        info.fps = std::stof(match[4]);
+        info.intrinsic.fx = info.width * 0.7f;
+        info.intrinsic.fy = info.width * 0.7f;
+        info.intrinsic.cx = info.width / 2.0f;
+        info.intrinsic.cy = info.height / 2.0f;
+        info.intrinsic.width = info.width;
+        info.intrinsic.height = info.height;
+        info.hasExtrinsic = true;
+        info.extrinsic = {{1, 0, 0, 0, 1, 0, 0, 0, 1}, {0, 0, 0}};
+        profiles.push_back(info);
+    }
+    return profiles;
+}
+
+int bytesPerPixel(OBFormat format) {
+    switch (format) {
+        case OB_FORMAT_Y8:
+            return 1;
+        case OB_FORMAT_RGB:
+        case OB_FORMAT_BGR:
+            return 3;
+        case OB_FORMAT_RGBA:
+        case OB_FORMAT_BGRA:
+            return 4;
+        default:
+            return 2;
+    }
+}
+
+}
+
+SyntheticFrameSource::SyntheticFrameSource(const std::string& profileDir, bool isRealtime, float rate) :
+    queue(4, isRealtime ? DropPolicy::DROP_OLDEST : DropPolicy::BLOCK) {
+    this->isRealtime = isRealtime;
+    this->rate = rate;
+    this->profiles[OB_SENSOR_COLOR] = loadProfiles(profileDir + "/color_profiles.csv");
+    this->profiles[OB_SENSOR_DEPTH] = loadProfiles(profileDir + "/depth_profiles.csv");
+    this->profiles[OB_SENSOR_IR_LEFT] = loadProfiles(profileDir + "/ir_left_profiles.csv");
+    this->profiles[OB_SENSOR_IR_RIGHT] = loadProfiles(profileDir + "/ir_right_profiles.csv");
+    for (auto &entry : this->profiles) {
+        if (entry.second.empty()) {
+            std::cerr << "No synthetic profiles for sensor type: " << entry.first << " in " << profileDir << std::endl;
+        }
+    }
+}
+
+SyntheticFrameSource::~SyntheticFrameSource() {
+    stop();
+}
+
+std::string SyntheticFrameSource::getName() {
+    return "synthetic";
+}
+
+bool SyntheticFrameSource::hasSensor(OBSensorType sensorType) {
+    if (sensorType == OB_SENSOR_GYRO || sensorType == OB_SENSOR_ACCEL) {
+        return true;
+    }
+    auto it = this->profiles.find(sensorType);
+    return it != this->profiles.end() && !it->second.empty();
+}
+
+VideoProfileInfo SyntheticFrameSource::getVideoProfile(OBSensorType sensorType, int profileIdx) {
+    auto &list = this->profiles.at(sensorType);
+    if (profileIdx < 0 || profileIdx >= (int)list.size()) {
+        throw std::out_of_range("Synthetic profile index out of range: " + std::to_string(profileIdx));
+    }
+    auto info = list[profileIdx];
+    if (sensorType == OB_SENSOR_COLOR) {
+        info.hasExtrinsic = false;
+    }
+    return info;
+}
+
+void SyntheticFrameSource::enableStream(OBSensorType sensorType, int profileIdx) {
+    // kept across records when the source stays open
+    for (auto &enabled : this->streams) {
+        if (enabled.sensorType == sensorType) {
+            return;
+        }
+    }
+    Stream stream;
+    stream.sensorType = sensorType;
+    stream.profileIdx = profileIdx;
+    stream.profile = getVideoProfile(sensorType, profileIdx);
+    getPatterns(sensorType, profileIdx);
+    this->streams.push_back(stream);
+}
+
+void SyntheticFrameSource::startImu(OBSensorType sensorType, int profileIdx, ImuCallback callback) {
+    auto imu = std::make_unique<Imu>();
+    imu->callback = callback;
+    imu->rate = IMU_RATE;
+    Imu *imuPtr = imu.get();
+    this->imus[sensorType] = std::move(imu);
+    if (this->running.load()) {
+        startImuThread(sensorType, imuPtr);
+    }
+}
+
+void SyntheticFrameSource::stopImu(OBSensorType sensorType) {
+    auto it = this->imus.find(sensorType);
+    if (it == this->imus.end()) {
+        return;
+    }
+    it->second->running.store(false);
+    if (it->second->thread.joinable()) {
+        it->second->thread.join();
+    }
+    this->imus.erase(it);
+}
+
+void SyntheticFrameSource::start() {
+    this->startTime = std::chrono::steady_clock::now();
+    this->running.store(true);
+    this->generator = std::thread(&SyntheticFrameSource::generateLoop, this);
+    for (auto &entry : this->imus) {
+        startImuThread(entry.first, entry.second.get());
+    }
+}
+
+void SyntheticFrameSource::stop() {
+    this->running.store(false);
+    this->queue.close();
+    if (this->generator.joinable()) {
+        this->generator.join();
+    }
+    for (auto &entry : this->imus) {
+        entry.second->running.store(false);
+        if (entry.second->thread.joinable()) {
+            entry.second->thread.join();
+        }
+    }
+}
+
+std::shared_ptr<SourceFrameSet> SyntheticFrameSource::waitForFrames(uint32_t timeoutMs) {
+    std::shared_ptr<SourceFrameSet> frameset;
+    if (!this->queue.popFor(frameset, std::chrono::milliseconds(timeoutMs))) {
+        return nullptr;
+    }
+    return frameset;
+}
+
+bool SyntheticFrameSource::setFrameCallback(FrameCallback callback) {
+    return storeFrameCallback(callback);
+}
+
+std::shared_ptr<SourceFrame> SyntheticFrameSource::makeFrame(OBSensorType sensorType, int profileIdx, uint64_t index, uint64_t timeStampUs) {
+    auto profile = getVideoProfile(sensorType, profileIdx);
+    auto &patterns = getPatterns(sensorType, profileIdx);
+
+    auto frame = std::make_shared<SourceFrame>();
+    frame->type = frameTypeOf(sensorType);
+    frame->format = profile.format;
+    frame->width = profile.width;
+    frame->height = profile.height;
+    frame->timeStamp = timeStampUs / 1000;
+    frame->timeStampUs = timeStampUs;
+    frame->buffer = patterns[index % patterns.size()];
+    frame->data = frame->buffer->data();
+    frame->dataSize = frame->buffer->size();
+    return frame;
+}
+
+// A few moving gradients per profile, built once so generating a frame costs nothing
+const SyntheticFrameSource::Patterns& SyntheticFrameSource::getPatterns(OBSensorType sensorType, int profileIdx) {
+    std::lock_guard<std::mutex> lock(this->patternMutex);
+    auto key = std::make_pair((int)sensorType, profileIdx);
+    auto it = this->patternCache.find(key);
+    if (it != this->patternCache.end()) {
+        return it->second;
+    }
+
+    auto profile = getVideoProfile(sensorType, profileIdx);
+    int w = profile.width;
+    int h = profile.height;
+    Patterns patterns;
+    for (int k = 0; k < PATTERN_COUNT; k++) {
+        auto buffer = std::make_shared<std::vector<uint8_t>>();
+        if (profile.format == OB_FORMAT_MJPG) {
+            cv::Mat bgr(h, w, CV_8UC3);
+            for (int y = 0; y < h; y++) {
+                uint8_t *row = bgr.ptr<uint8_t>(y);
+                for (int x = 0; x < w; x++) {
+                    row[x * 3 + 0] = (uint8_t)(x * 255 / w);
+                    row[x * 3 + 1] = (uint8_t)(y * 255 / h);
+                    row[x * 3 + 2] = (uint8_t)((x + y + k * 16) & 0xff);
+                }
+            }
+            cv::imencode(".jpg", bgr, *buffer, {cv::IMWRITE_JPEG_QUALITY, 90});
+        } else if (profile.format == OB_FORMAT_YUYV || profile.format == OB_FORMAT_UYVY) {
+            bool isUyvy = profile.format == OB_FORMAT_UYVY;
+            buffer->resize((size_t)w * h * 2);
+            for (int y = 0; y < h; y++) {
+                uint8_t *row = buffer->data() + (size_t)y * w * 2;
+                for (int x = 0; x < w; x += 2) {
+                    uint8_t y0 = (uint8_t)((x + y + k * 16) & 0xff);
+                    uint8_t y1 = (uint8_t)((x + 1 + y + k * 16) & 0xff);
+                    uint8_t u = (uint8_t)(x * 255 / w);
+                    uint8_t v = (uint8_t)(y * 255 / h);
+                    uint8_t *p = row + x * 2;
+                    if (isUyvy) {
+                        p[0] = u; p[1] = y0; p[2] = v; p[3] = y1;
+                    } else {
+                        p[0] = y0; p[1] = u; p[2] = y1; p[3] = v;
+                    }
+                }
+            }
+        } else if (profile.format == OB_FORMAT_Y16 || profile.format == OB_FORMAT_Y12) {
+            // depth in millimetres between 0.5 m and 4.5 m
+            buffer->resize((size_t)w * h * 2);
+            uint16_t *pixels = reinterpret_cast<uint16_t *>(buffer->data());
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    pixels[(size_t)y * w + x] = (uint16_t)(500 + ((x * 4 + y * 2 + k * 50) % 4000));
+                }
+            }
+        } else {
+            int bpp = bytesPerPixel(profile.format);
+            buffer->resize((size_t)w * h * bpp);
+            for (size_t i = 0; i < buffer->size(); i++) {
+                size_t pixel = i / bpp;
+                (*buffer)[i] = (uint8_t)((pixel % w + pixel / w + k * 16 + i % bpp * 64) & 0xff);
+            }
+        }
+        patterns.push_back(buffer);
+    }
+    return this->patternCache[key] = patterns;
+}
+
+void SyntheticFrameSource::generateLoop() {
+    std::vector<double> periodUs;
+    std::vector<double> nextUs(this->streams.size(), 0);
+    std::vector<uint64_t> index(this->streams.size(), 0);
+    for (auto &stream : this->streams) {
+        float fps = this->rate > 0 ? this->rate : stream.profile.fps;
+        periodUs.push_back(1e6 / (fps > 0 ? fps : 30));
+    }
+    if (this->streams.empty()) {
+        return;
+    }
+
+    while (this->running.load()) {
+        double due = *std::min_element(nextUs.begin(), nextUs.end());
+        if (this->isRealtime) {
+            std::this_thread::sleep_until(this->startTime + std::chrono::microseconds((int64_t)due));
+        }
+
+        if (isCallbackMode()) {
+            // per-frame delivery: every stream keeps its own schedule
+            for (size_t i = 0; i < this->streams.size(); i++) {
+                if (nextUs[i] > due) {
+                    continue;
+                }
+                deliverFrame(makeFrame(this->streams[i].sensorType, this->streams[i].profileIdx, index[i], (uint64_t)nextUs[i]));
+                index[i]++;
+                nextUs[i] += periodUs[i];
+            }
+            continue;
+        }
+
+        // streams due within half a millisecond share a frameset
+        auto frameset = std::make_shared<SourceFrameSet>();
+        for (size_t i = 0; i < this->streams.size(); i++) {
+            if (nextUs[i] > due + 500) {
+                continue;
+            }
+            frameset->frames.push_back(makeFrame(this->streams[i].sensorType, this->streams[i].profileIdx, index[i], (uint64_t)nextUs[i]));
+            index[i]++;
+            nextUs[i] += periodUs[i];
+        }
+        this->queue.push(frameset);
+    }
+}
+
+void SyntheticFrameSource::startImuThread(OBSensorType sensorType, Imu *imu) {
+    imu->running.store(true);
+    imu->thread = std::thread(&SyntheticFrameSource::imuLoop, this, sensorType, imu);
+}
+
+void SyntheticFrameSource::imuLoop(OBSensorType sensorType, Imu *imu) {
+    // IMU samples are always paced in real time
+    auto period = std::chrono::microseconds((int64_t)(1e6 / imu->rate));
+    auto next = std::chrono::steady_clock::now();
+    while (imu->running.load()) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(next - this->startTime).count();
+        float t = elapsed / 1e6f;
+        ImuSample sample;
+        sample.timeStamp = elapsed / 1000;
+        sample.temperature = 40.0f;
+        if (sensorType == OB_SENSOR_GYRO) {
+            sample.x = 0.1f * std::sin(t);
+            sample.y = 0.1f * std::cos(t);
+            sample.z = 0.01f * std::sin(3 * t);
+        } else {
+            sample.x = 0.2f * std::sin(2 * t);
+            sample.y = 0.2f * std::cos(2 * t);
+            sample.z = 9.81f;
+        }
+        imu->callback(sample);
+        next += period;
+        std::this_thread::sleep_until(next);
+    }
+}
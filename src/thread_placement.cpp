@@ -0,0 +1,95 @@
+#include <iostream>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "thread_placement.hpp"
+
+namespace {
+
+std::mutex placementMutex;
+std::map<std::string, ThreadConfig> threadConfigs;
+nlohmann::json placements = nlohmann::json::object();
+
+}
+
+void setThreadConfigs(const std::map<std::string, ThreadConfig>& configs) {
+    std::lock_guard<std::mutex> lock(placementMutex);
+    threadConfigs = configs;
+}
+
+void placeThread(const std::string& role, const std::string& name) {
+    ThreadConfig config;
+    {
+        std::lock_guard<std::mutex> lock(placementMutex);
+        auto it = threadConfigs.find(role);
+        if (it != threadConfigs.end()) {
+            config = it->second;
+        }
+    }
+    pthread_t self = pthread_self();
+    // names show up in top/perf, the kernel keeps 15 characters
+    pthread_setname_np(self, name.substr(0, 15).c_str());
+
+    nlohmann::json placement;
+    placement["role"] = role;
+    placement["tid"] = (long)syscall(SYS_gettid);
+    std::string errorMsg;
+    if (!config.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : config.cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        int err = pthread_setaffinity_np(self, sizeof(set), &set);
+        if (err != 0) {
+            errorMsg += std::string("affinity: ") + strerror(err) + " ";
+        }
+    }
+    if (config.fifoPriority > 0) {
+        sched_param param;
+        param.sched_priority = config.fifoPriority;
+        int err = pthread_setschedparam(self, SCHED_FIFO, &param);
+        if (err != 0) {
+            // usually missing CAP_SYS_NICE / rtprio limit
+            errorMsg += std::string("SCHED_FIFO: ") + strerror(err) + " ";
+        }
+    }
+    if (!errorMsg.empty()) {
+        std::cerr << "Failed to place thread " << name << ": " << errorMsg << std::endl;
+        placement["errorMsg"] = errorMsg;
+    }
+
+    // Record what the kernel reports, not what was asked for
+    placement["requestedCpus"] = config.cpus;
+    placement["requestedFifoPriority"] = config.fifoPriority;
+    cpu_set_t effective;
+    CPU_ZERO(&effective);
+    if (pthread_getaffinity_np(self, sizeof(effective), &effective) == 0) {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &effective)) {
+                cpus.push_back(cpu);
+            }
+        }
+        placement["cpus"] = cpus;
+    }
+    int policy = 0;
+    sched_param param;
+    if (pthread_getschedparam(self, &policy, &param) == 0) {
+        placement["policy"] = policy == SCHED_FIFO ? "SCHED_FIFO" : policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER";
+        placement["priority"] = param.sched_priority;
+    }
+
+    std::lock_guard<std::mutex> lock(placementMutex);
+    placements[name] = placement;
+}
+
+nlohmann::json getThreadPlacement() {
+    std::lock_guard<std::mutex> lock(placementMutex);
+    return placements;
+}
@@ -0,0 +1,91 @@
+#include <charconv>
+#include <cstdio>
+#include "timecode_writer.hpp"
+
+TimecodeWriter::~TimecodeWriter() {
+    close();
+}
+
+bool TimecodeWriter::open(const std::string& fileName, const std::string& header, const std::string& indexName,
+                          const TimecodeConfig& config) {
+    close();
+    if (!this->textWriter.open(fileName, config.fileWriter)) {
+        return false;
+    }
+    std::string text = header + "\n";
+    this->textWriter.write(text.data(), text.size());
+
+    if (!indexName.empty() && this->indexWriter.open(indexName, config.fileWriter)) {
+        TimecodeIndexHeader indexHeader;
+        this->indexWriter.write(&indexHeader, sizeof(indexHeader));
+    }
+
+    this->flushInterval = std::chrono::milliseconds(config.flushIntervalMs);
+    this->lastFlush = std::chrono::steady_clock::now();
+    this->cachedScaleText.clear();
+    return true;
+}
+
+bool TimecodeWriter::isOpened() const {
+    return this->textWriter.isOpened();
+}
+
+void TimecodeWriter::write(uint64_t timeStamp, uint64_t timeStampUs) {
+    append(timeStamp, timeStampUs, 1.0f, false);
+}
+
+void TimecodeWriter::write(uint64_t timeStamp, uint64_t timeStampUs, float valueScale) {
+    append(timeStamp, timeStampUs, valueScale, true);
+}
+
+void TimecodeWriter::append(uint64_t timeStamp, uint64_t timeStampUs, float valueScale, bool hasValueScale) {
+    if (!isOpened()) {
+        return;
+    }
+    char line[64];
+    char *end = std::to_chars(line, line + sizeof(line), timeStamp).ptr;
+    if (hasValueScale) {
+        if (this->cachedScaleText.empty() || valueScale != this->cachedScale) {
+            // same text as operator<< on a float
+            char scale[32];
+            int n = snprintf(scale, sizeof(scale), ",%g", valueScale);
+            this->cachedScaleText.assign(scale, n);
+            this->cachedScale = valueScale;
+        }
+        end += this->cachedScaleText.copy(end, line + sizeof(line) - 1 - end);
+    }
+    *end++ = '\n';
+    this->textWriter.write(line, end - line);
+
+    if (this->indexWriter.isOpened()) {
+        TimecodeIndexRecord record = {timeStampUs, valueScale, 0};
+        this->indexWriter.write(&record, sizeof(record));
+    }
+
+    if (std::chrono::steady_clock::now() - this->lastFlush >= this->flushInterval) {
+        flush();
+    }
+}
+
+void TimecodeWriter::flush() {
+    this->textWriter.flush();
+    this->indexWriter.flush();
+    this->lastFlush = std::chrono::steady_clock::now();
+}
+
+void TimecodeWriter::close() {
+    if (!isOpened()) {
+        return;
+    }
+    this->textWriter.close();
+    this->indexWriter.close();
+}
+
+nlohmann::json TimecodeWriter::getMetadata() const {
+    nlohmann::json j;
+    j["text"] = this->textWriter.getMetadata();
+    if (this->indexWriter.isOpened() || this->indexWriter.getSize() > 0) {
+        j["index"] = this->indexWriter.getMetadata();
+    }
+    return j;
+}
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "trace.hpp"
+
+std::atomic<bool> traceEnabled{false};
+
+namespace {
+
+// Fields are relaxed atomics so a dump can read a ring while its thread keeps writing
+struct TraceSlot {
+    std::atomic<const char *> name{nullptr};
+    std::atomic<int64_t> start{0};
+    std::atomic<int64_t> duration{0};
+};
+
+struct TraceBuffer {
+    explicit TraceBuffer(size_t size) : slots(size) {}
+    std::vector<TraceSlot> slots;
+    std::atomic<uint64_t> head{0};  // events written so far, only the owning thread adds
+    uint64_t dumped = 0;            // dump side only
+    long tid = 0;
+    std::string threadName;
+};
+
+std::mutex bufferMutex;
+std::mutex dumpMutex;
+std::vector<std::shared_ptr<TraceBuffer>> buffers;  // kept after their thread exits
+std::atomic<size_t> bufferSize{65536};
+volatile std::sig_atomic_t dumpRequested = 0;
+
+TraceBuffer *threadBuffer() {
+    thread_local std::shared_ptr<TraceBuffer> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<TraceBuffer>(std::max<size_t>(bufferSize.load(), 1));
+        buffer->tid = (long)syscall(SYS_gettid);
+        char name[16] = {0};
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+        buffer->threadName = name;
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        buffers.push_back(buffer);
+    }
+    return buffer.get();
+}
+
+void onTraceSignal(int signal) {
+    if (signal == SIGUSR1) {
+        dumpRequested = 1;
+    } else if (signal == SIGUSR2) {
+        traceEnabled.store(!traceEnabled.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+void appendJsonString(std::string& out, const std::string& text) {
+    out += '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        if ((unsigned char)c >= 0x20) {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+}
+
+void setTraceEnabled(bool isEnabled) {
+    traceEnabled.store(isEnabled, std::memory_order_relaxed);
+}
+
+void setTraceBufferSize(size_t events) {
+    bufferSize.store(events);
+}
+
+int64_t traceNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void traceEvent(const char *name, int64_t startNs, int64_t durationNs) {
+    TraceBuffer *buffer = threadBuffer();
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    TraceSlot& slot = buffer->slots[head % buffer->slots.size()];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(startNs, std::memory_order_relaxed);
+    slot.duration.store(durationNs, std::memory_order_relaxed);
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+bool writeChromeTrace(const std::string& path) {
+    std::lock_guard<std::mutex> dumpLock(dumpMutex);
+    std::vector<std::shared_ptr<TraceBuffer>> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        snapshot = buffers;
+    }
+    std::ofstream ofs(path);
+    if (!ofs) {
+        return false;
+    }
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool isFirst = true;
+    char line[256];
+    size_t lost = 0;
+    for (auto& buffer : snapshot) {
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t size = buffer->slots.size();
+        // only what was recorded since the last dump and not yet overwritten
+        uint64_t begin = std::max(buffer->dumped, head > size ? head - size : 0);
+        lost += begin - buffer->dumped;
+
+        std::string name;
+        appendJsonString(name, buffer->threadName.empty() ? std::to_string(buffer->tid) : buffer->threadName);
+        snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%ld,\"args\":{\"name\":%s}}",
+                 isFirst ? "" : ",\n", buffer->tid, name.c_str());
+        out += line;
+        isFirst = false;
+
+        std::vector<std::pair<const char *, std::pair<int64_t, int64_t>>> events;
+        events.reserve(head - begin);
+        for (uint64_t i = begin; i < head; i++) {
+            const TraceSlot& slot = buffer->slots[i % size];
+            events.push_back({slot.name.load(std::memory_order_relaxed),
+                              {slot.start.load(std::memory_order_relaxed), slot.duration.load(std::memory_order_relaxed)}});
+        }
+        // the writer may have lapped the ring while we copied: drop what it overwrote
+        uint64_t after = buffer->head.load(std::memory_order_acquire);
+        size_t skip = after > begin + size ? (size_t)std::min<uint64_t>(after - size - begin, events.size()) : 0;
+        lost += skip;
+        for (size_t i = skip; i < events.size(); i++) {
+            snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f}",
+                     events[i].first ? events[i].first : "?", buffer->tid,
+                     events[i].second.first / 1e3, events[i].second.second / 1e3);
+            out += line;
+        }
+        buffer->dumped = head;
+    }
+    out += "\n],\"otherData\":{\"lostEvents\":" + std::to_string(lost) + "}}\n";
+    ofs << out;
+    return ofs.good();
+}
+
+void installTraceSignals() {
+    std::signal(SIGUSR1, onTraceSignal);
+    std::signal(SIGUSR2, onTraceSignal);
+}
+
+bool takeTraceDumpRequest() {
+    if (dumpRequested == 0) {
+        return false;
+    }
+    dumpRequested = 0;
+    return true;
+}